@@ -1,21 +1,27 @@
 #include "../server/server.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 
 int add_numbers(int a, int b) {
     return a + b;
 }
 
 EndpointResponse* handle_add(const RequestContext* request) {
-    const char* a_str = request_get_param(request, "a");
-    const char* b_str = request_get_param(request, "b");
+    long long a_value, b_value;
+    int a_result = request_get_param_long(request, "a", &a_value);
+    int b_result = request_get_param_long(request, "b", &b_value);
 
-    if (!a_str || !b_str) {
+    if (a_result == PARAM_MISSING || b_result == PARAM_MISSING) {
         return response_error(400, "Missing parameters 'a' and 'b'");
     }
+    if (a_result != PARAM_OK || b_result != PARAM_OK || a_value < INT_MIN || a_value > INT_MAX ||
+        b_value < INT_MIN || b_value > INT_MAX) {
+        return response_error(400, "Parameters 'a' and 'b' must be integers");
+    }
 
-    int a = atoi(a_str);
-    int b = atoi(b_str);
+    int a = (int)a_value;
+    int b = (int)b_value;
     int result = add_numbers(a, b);
 
     char response[256];
@@ -3,40 +3,75 @@
 #include <stdlib.h>
 #include <string.h>
 
-EndpointResponse* handle_upload(const RequestContext* request) {
-    UploadedFile file;
+// The body is parsed as it arrives and each MP3 is written to a temp file,
+// so batches of any size are accepted in constant memory.
+void* upload_begin(const RequestContext* request) {
+    return multipart_spool_create(request->content_type, "/tmp");
+}
+
+int upload_data(void* state, const char* data, size_t length) {
+    return state ? multipart_spool_feed(state, data, length) : -1;
+}
 
-    if (parse_multipart_file(request, &file) != 0) {
+EndpointResponse* upload_end(void* state, const RequestContext* request) {
+    (void)request;
+    MultipartSpool* spool = state;
+    if (!spool || multipart_spool_finish(spool) != 0) {
+        multipart_spool_free(spool);
         return response_error(400, "Failed to parse file upload");
     }
 
-    printf("Received file: %s (%zu bytes, %s)\n",
-           file.filename, file.size, file.content_type);
+    char response[4096];
+    size_t offset = snprintf(response, sizeof(response), "{\"status\": \"success\", \"files\": [");
+    int file_count = 0;
 
-    const char* ext = strrchr(file.filename, '.');
-    if (!ext || strcmp(ext, ".mp3") != 0) {
-        return response_error(400, "Only MP3 files are accepted");
-    }
+    for (int i = 0; i < multipart_spool_count(spool); i++) {
+        const SpooledPart* part = multipart_spool_part(spool, i);
+        if (!part->path[0]) {
+            printf("Field %s = %s\n", part->info.name, part->data);
+            continue;
+        }
 
-    printf("\n=== MP3 Buffer Ready ===\n");
-    printf("Buffer: %p, Size: %zu bytes (%.2f MB)\n",
-           (void*)file.data, file.size, file.size / (1024.0 * 1024.0));
-    printf("First 16 bytes: ");
-    for (int i = 0; i < 16 && i < (int)file.size; i++) {
-        printf("%02X ", (unsigned char)file.data[i]);
-    }
-    printf("\n");
-    printf("Usage: fwrite(file.data, 1, file.size, fp) to save to disk\n");
-    printf("========================\n\n");
+        const char* ext = strrchr(part->info.filename, '.');
+        if (!ext || strcmp(ext, ".mp3") != 0) {
+            multipart_spool_free(spool);
+            return response_error(400, "Only MP3 files are accepted");
+        }
+
+        printf("\n=== MP3 Received ===\n");
+        printf("File: %s (%zu bytes, %.2f MB, %s)\n", part->info.filename, part->size,
+               part->size / (1024.0 * 1024.0), part->info.content_type);
+        printf("Spooled to: %s\n", part->path);
+        printf("First 16 bytes: ");
+        for (int j = 0; j < 16 && j < (int)part->size; j++) {
+            printf("%02X ", (unsigned char)part->data[j]);
+        }
+        printf("\n");
+        printf("Usage: rename(part->path, destination) to keep it\n");
+        printf("====================\n\n");
 
-    char response[512];
-    snprintf(response, sizeof(response),
-        "{\"status\": \"success\", \"filename\": \"%s\", \"content_type\": \"%s\", \"size\": %zu, \"buffer_ready\": true}",
-        file.filename, file.content_type, file.size);
+        if (offset < sizeof(response)) {
+            offset += snprintf(response + offset, sizeof(response) - offset,
+                "%s{\"filename\": \"%s\", \"content_type\": \"%s\", \"size\": %zu}",
+                file_count > 0 ? ", " : "", part->info.filename, part->info.content_type, part->size);
+        }
+        file_count++;
+    }
+    if (offset < sizeof(response)) {
+        snprintf(response + offset, sizeof(response) - offset, "]}");
+    }
 
+    multipart_spool_free(spool);
+    if (file_count == 0) {
+        return response_error(400, "No file in upload");
+    }
     return response_json(200, response);
 }
 
+void upload_abort(void* state) {
+    multipart_spool_free(state);
+}
+
 int main() {
     printf("Starting MP3 Upload Server...\n");
 
@@ -45,14 +80,13 @@ int main() {
         return 1;
     }
 
-    SERVER_POST("/upload", handle_upload);
+    SERVER_UPLOAD("/upload", upload_begin, upload_data, upload_end, upload_abort);
 
     printf("Upload server ready!\n");
     printf("Test with:\n");
-    printf("  curl -X POST -F \"file=@music.mp3\" http://localhost:8080/upload\n");
+    printf("  curl -X POST -F \"file=@music.mp3\" -F \"file=@more.mp3\" http://localhost:8080/upload\n");
 
     server_start();
 
     return 0;
 }
-
@@ -0,0 +1,97 @@
+#include "admission.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct ClientCount {
+    in_addr_t addr;
+    int count;
+    struct ClientCount* next;
+} ClientCount;
+
+// Shared by all reactor threads. The total is a plain atomic; the per-address table is only
+// touched (under its lock) when a per-address limit is set.
+static int open_connections;
+static int max_total;
+static int max_per_client;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static ClientCount* clients[ADMISSION_BUCKETS];
+
+static unsigned int hash_addr(in_addr_t addr) {
+    return (unsigned int)(addr * 2654435761u) % ADMISSION_BUCKETS;
+}
+
+void admission_init(int max_connections, int max_connections_per_ip) {
+    pthread_mutex_lock(&clients_lock);
+    for (int i = 0; i < ADMISSION_BUCKETS; i++) {
+        while (clients[i]) {
+            ClientCount* next = clients[i]->next;
+            free(clients[i]);
+            clients[i] = next;
+        }
+    }
+    pthread_mutex_unlock(&clients_lock);
+
+    __atomic_store_n(&open_connections, 0, __ATOMIC_RELAXED);
+    max_total = max_connections;
+    max_per_client = max_connections_per_ip;
+}
+
+// Adds delta to addr's count, creating or dropping its entry. Returns 0, or -1 if the
+// count would exceed max_per_client. Caller holds clients_lock.
+static int client_adjust(in_addr_t addr, int delta) {
+    ClientCount** link = &clients[hash_addr(addr)];
+    while (*link && (*link)->addr != addr) {
+        link = &(*link)->next;
+    }
+
+    ClientCount* client = *link;
+    if (!client) {
+        if (delta < 0) return 0;
+        client = calloc(1, sizeof(ClientCount));
+        if (!client) return -1;
+        client->addr = addr;
+        *link = client;
+    }
+    if (delta > 0 && client->count >= max_per_client) {
+        return -1;
+    }
+
+    client->count += delta;
+    if (client->count <= 0) {
+        *link = client->next;
+        free(client);
+    }
+    return 0;
+}
+
+int admission_acquire(in_addr_t client_addr) {
+    int count = __atomic_add_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+    if (max_total > 0 && count > max_total) {
+        __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+        return ADMIT_SERVER_FULL;
+    }
+
+    if (max_per_client > 0) {
+        pthread_mutex_lock(&clients_lock);
+        int result = client_adjust(client_addr, 1);
+        pthread_mutex_unlock(&clients_lock);
+        if (result != 0) {
+            __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+            return ADMIT_CLIENT_FULL;
+        }
+    }
+    return ADMIT_OK;
+}
+
+void admission_release(in_addr_t client_addr) {
+    if (max_per_client > 0) {
+        pthread_mutex_lock(&clients_lock);
+        client_adjust(client_addr, -1);
+        pthread_mutex_unlock(&clients_lock);
+    }
+    __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+}
+
+int admission_count(void) {
+    return __atomic_load_n(&open_connections, __ATOMIC_RELAXED);
+}
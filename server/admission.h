@@ -0,0 +1,23 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <netinet/in.h>
+
+#define ADMISSION_BUCKETS 1024
+
+#define ADMIT_OK 0
+#define ADMIT_SERVER_FULL 1  // max_connections reached
+#define ADMIT_CLIENT_FULL 2  // max_connections_per_ip reached for this address
+
+// Counts open connections across all reactors, in total and per client address.
+// A limit of 0 disables that check.
+void admission_init(int max_connections, int max_connections_per_ip);
+
+// Called on accept; every ADMIT_OK must be paired with one admission_release()
+int admission_acquire(in_addr_t client_addr);
+void admission_release(in_addr_t client_addr);
+
+// Open connections currently admitted
+int admission_count(void);
+
+#endif
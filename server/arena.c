@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+static __thread Arena* current_arena;
+
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+void arena_init(Arena* arena, BufferPool* pool) {
+    arena->pool = pool;
+    arena->blocks = NULL;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    ArenaBlock* block = arena->blocks;
+    if (!block || block->capacity - block->used < size) {
+        size_t capacity;
+        char* buffer = buffer_pool_acquire(arena->pool, ARENA_HEADER_SIZE + size, &capacity);
+        if (!buffer) return NULL;
+
+        block = (ArenaBlock*)buffer;
+        block->capacity = capacity;
+        block->used = ARENA_HEADER_SIZE;
+        // A block that is still mostly empty stays in front for the next allocations
+        if (arena->blocks && arena->blocks->capacity - arena->blocks->used > capacity - ARENA_HEADER_SIZE - size) {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        } else {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    void* ptr = (char*)block + block->used;
+    block->used += size;
+    return ptr;
+}
+
+int arena_owns(const Arena* arena, const void* ptr) {
+    if (!arena) return 0;
+    for (const ArenaBlock* block = arena->blocks; block; block = block->next) {
+        const char* start = (const char*)block;
+        if ((const char*)ptr >= start && (const char*)ptr < start + block->capacity) return 1;
+    }
+    return 0;
+}
+
+void arena_reset(Arena* arena) {
+    ArenaBlock* block = arena->blocks;
+    while (block) {
+        ArenaBlock* next = block->next;
+        buffer_pool_release(arena->pool, (char*)block, block->capacity);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+Arena* arena_set_current(Arena* arena) {
+    Arena* previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+Arena* arena_current(void) {
+    return current_arena;
+}
+
+void* arena_malloc(size_t size) {
+    void* ptr = current_arena ? arena_alloc(current_arena, size) : NULL;
+    return ptr ? ptr : malloc(size);
+}
+
+char* arena_strdup(const char* text) {
+    size_t length = strlen(text) + 1;
+    char* copy = arena_malloc(length);
+    if (copy) memcpy(copy, text, length);
+    return copy;
+}
+
+void arena_free(void* ptr) {
+    if (ptr && !arena_owns(current_arena, ptr)) {
+        free(ptr);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "buffer_pool.h"
+#include <stddef.h>
+
+#define ARENA_ALIGNMENT 16
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t capacity;  // Including this header
+    size_t used;
+} ArenaBlock;
+
+// Bump allocator for everything one request needs between parsing and the end of the write.
+// Blocks come from the reactor's buffer pool and all go back in one arena_reset(), so a
+// request served from a warm pool never touches malloc.
+typedef struct Arena {
+    BufferPool* pool;
+    ArenaBlock* blocks;  // Newest first
+} Arena;
+
+void arena_init(Arena* arena, BufferPool* pool);
+// Returns NULL if size does not fit in the pool's largest buffer
+void* arena_alloc(Arena* arena, size_t size);
+int arena_owns(const Arena* arena, const void* ptr);
+void arena_reset(Arena* arena);
+
+// The arena response helpers allocate from on this thread, set by the connection while a
+// handler runs. Returns the previous one.
+Arena* arena_set_current(Arena* arena);
+Arena* arena_current(void);
+
+// Allocate from the current arena when there is one and the size fits, otherwise from malloc.
+// arena_free() ignores memory owned by the current arena.
+void* arena_malloc(size_t size);
+char* arena_strdup(const char* text);
+void arena_free(void* ptr);
+
+#endif
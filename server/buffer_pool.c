@@ -0,0 +1,85 @@
+#include "buffer_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t class_size(int size_class) {
+    return (size_t)BUFFER_POOL_MIN_SIZE << size_class;
+}
+
+// Smallest class that fits size, or -1 if none does
+static int class_for_size(size_t size) {
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        if (size <= class_size(i)) return i;
+    }
+    return -1;
+}
+
+void buffer_pool_init(BufferPool* pool, size_t max_size) {
+    memset(pool, 0, sizeof(*pool));
+
+    size_t largest = class_size(BUFFER_POOL_CLASSES - 1);
+    if (max_size > largest) max_size = largest;
+    if (max_size < BUFFER_POOL_MIN_SIZE) max_size = BUFFER_POOL_MIN_SIZE;
+
+    // Round down so a full buffer never exceeds the configured cap
+    int size_class = class_for_size(max_size);
+    if (class_size(size_class) > max_size) size_class--;
+    pool->max_size = class_size(size_class);
+}
+
+void buffer_pool_destroy(BufferPool* pool) {
+    for (int i = 0; i < BUFFER_POOL_CLASSES; i++) {
+        void* buffer = pool->free_lists[i];
+        while (buffer) {
+            void* next = *(void**)buffer;
+            free(buffer);
+            buffer = next;
+        }
+        pool->free_lists[i] = NULL;
+        pool->free_counts[i] = 0;
+    }
+}
+
+char* buffer_pool_acquire(BufferPool* pool, size_t size, size_t* capacity) {
+    if (size > pool->max_size) return NULL;
+
+    int size_class = class_for_size(size);
+    void* buffer = pool->free_lists[size_class];
+    if (buffer) {
+        pool->free_lists[size_class] = *(void**)buffer;
+        pool->free_counts[size_class]--;
+    } else {
+        buffer = malloc(class_size(size_class));
+        if (!buffer) return NULL;
+    }
+
+    *capacity = class_size(size_class);
+    return buffer;
+}
+
+void buffer_pool_release(BufferPool* pool, char* buffer, size_t capacity) {
+    if (!buffer) return;
+
+    int size_class = class_for_size(capacity);
+    if (size_class < 0 || class_size(size_class) != capacity ||
+        pool->free_counts[size_class] >= BUFFER_POOL_MAX_CACHED) {
+        free(buffer);
+        return;
+    }
+
+    *(void**)buffer = pool->free_lists[size_class];
+    pool->free_lists[size_class] = buffer;
+    pool->free_counts[size_class]++;
+}
+
+int buffer_pool_grow(BufferPool* pool, char** buffer, size_t* capacity, size_t used, size_t new_size) {
+    size_t new_capacity;
+    char* new_buffer = buffer_pool_acquire(pool, new_size, &new_capacity);
+    if (!new_buffer) return -1;
+
+    memcpy(new_buffer, *buffer, used);
+    buffer_pool_release(pool, *buffer, *capacity);
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return 0;
+}
@@ -0,0 +1,31 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#define BUFFER_POOL_MIN_SIZE 4096
+#define BUFFER_POOL_CLASSES 8          // 4 KiB .. 512 KiB, doubling
+#define BUFFER_POOL_MAX_CACHED 64      // Free buffers kept per size class
+
+// Size-classed free lists of I/O buffers. Each reactor owns one, so no locking is needed.
+// A free buffer stores the free list link in its first bytes.
+typedef struct BufferPool {
+    void* free_lists[BUFFER_POOL_CLASSES];
+    int free_counts[BUFFER_POOL_CLASSES];
+    size_t max_size;
+} BufferPool;
+
+// max_size caps every buffer the pool hands out; it is rounded down to a size class
+void buffer_pool_init(BufferPool* pool, size_t max_size);
+void buffer_pool_destroy(BufferPool* pool);
+
+// Returns a buffer of at least size bytes (its real size is stored in *capacity),
+// or NULL if size exceeds max_size or memory is exhausted
+char* buffer_pool_acquire(BufferPool* pool, size_t size, size_t* capacity);
+void buffer_pool_release(BufferPool* pool, char* buffer, size_t capacity);
+
+// Moves the first used bytes into a buffer of at least new_size bytes and releases the old one.
+// Returns 0 on success; on failure the original buffer is left untouched.
+int buffer_pool_grow(BufferPool* pool, char** buffer, size_t* capacity, size_t used, size_t new_size);
+
+#endif
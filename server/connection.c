@@ -0,0 +1,934 @@
+#define _GNU_SOURCE
+#include "connection.h"
+#include "reactor.h"
+#include "endpoint.h"
+#include "file_cache.h"
+#include "response_writer.h"
+#include "sse.h"
+#include "raw_upload.h"
+#include "worker_pool.h"
+#include "admission.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#ifdef ENABLE_WEBSOCKET
+#include "websocket.h"
+#include "ws_endpoint.h"
+#include "ws_session.h"
+#endif
+
+#define UPLOAD_CHUNK_SIZE (16 * 1024)  // Space kept free after the request head for body reads
+
+static const char CONTINUE_RESPONSE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// Sent when a worker pool handler misses its deadline; the request buffers still belong to
+// the worker, so nothing is built in the arena
+static const char HANDLER_TIMEOUT_RESPONSE[] =
+    "HTTP/1.1 504 Gateway Timeout\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 30\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "{\"error\": \"Handler timed out\"}";
+
+// A request body being handed to an endpoint's on_data, or spliced to a file, as it arrives
+typedef struct BodyUpload {
+    const RegisteredEndpoint* endpoint;
+    RequestContext context;
+    void* state;
+
+    int is_raw;
+    int splice_unsupported;  // Raw upload falling back to read() and write()
+    RawUpload raw;
+} BodyUpload;
+
+// A handler call running on the worker pool. Lives in the connection's arena; the
+// connection is only freed once the job has come back to its reactor.
+typedef struct HandlerJob {
+    WorkerJob work;
+    EventTask done;
+    Connection* conn;
+    const RegisteredEndpoint* endpoint;
+    RequestContext context;
+    EndpointResponse* response;
+    FileCacheEntry* file;  // Taken on the worker thread, where endpoint_file_response() recorded it
+    int cancelled;
+} HandlerJob;
+
+static int streams_body(const RegisteredEndpoint* endpoint) {
+    return endpoint && (endpoint->body_handlers.on_data || endpoint->raw_upload_handler);
+}
+
+static void connection_on_event(EventLoop* loop, EventHandler* handler, uint32_t events);
+static void connection_on_timeout(Timer* timer);
+
+static int timeout_ms(const Connection* conn, ConnectionTimeout timeout) {
+    const ServerConfig* config = conn->reactor->config;
+    switch (timeout) {
+        case CONN_TIMEOUT_IDLE: return config->keepalive_timeout_ms;
+        case CONN_TIMEOUT_HEADER: return config->header_timeout_ms;
+        case CONN_TIMEOUT_BODY: return config->body_timeout_ms;
+        case CONN_TIMEOUT_HANDLER: return config->handler_timeout_ms;
+        case CONN_TIMEOUT_WEBSOCKET: return config->ws_idle_timeout_ms;
+    }
+    return 0;
+}
+
+// Re-arms the connection's single timer for the phase it is entering
+static void connection_set_timeout(Connection* conn, ConnectionTimeout timeout) {
+    EventLoop* loop = &conn->reactor->loop;
+    int ms = timeout_ms(conn, timeout);
+    conn->timeout = timeout;
+    if (ms > 0) {
+        timer_arm(&loop->timers, &conn->timer, loop->now_ms + ms);
+    } else {
+        timer_cancel(&loop->timers, &conn->timer);
+    }
+}
+
+static void connection_cancel_timeout(Connection* conn) {
+    timer_cancel(&conn->reactor->loop.timers, &conn->timer);
+}
+
+Connection* connection_create(Reactor* reactor, int fd) {
+    Connection* conn = calloc(1, sizeof(Connection));
+    if (!conn) return NULL;
+
+    conn->buffer = buffer_pool_acquire(&reactor->buffer_pool, BUFFER_POOL_MIN_SIZE, &conn->buffer_capacity);
+    if (!conn->buffer) {
+        free(conn);
+        return NULL;
+    }
+
+    arena_init(&conn->arena, &reactor->buffer_pool);
+    conn->handler.on_event = connection_on_event;
+    conn->fd = fd;
+    http_request_reset(&conn->request);
+    conn->state = CONN_STATE_READING_HEADERS;
+    conn->reactor = reactor;
+    conn->timer.on_expire = connection_on_timeout;
+
+    if (event_loop_add(&reactor->loop, fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, &conn->handler) != 0) {
+        buffer_pool_release(&reactor->buffer_pool, conn->buffer, conn->buffer_capacity);
+        free(conn);
+        return NULL;
+    }
+
+    reactor_add_connection(reactor, conn);
+    // A client that connects and never sends anything gets the same deadline as a slow one
+    connection_set_timeout(conn, CONN_TIMEOUT_HEADER);
+    return conn;
+}
+
+// Ends an unfinished upload without a response
+static void upload_abort(Connection* conn) {
+    BodyUpload* upload = conn->upload;
+    conn->upload = NULL;
+    if (upload->is_raw) {
+        raw_upload_discard(&upload->raw);
+    } else if (upload->endpoint->body_handlers.on_abort) {
+        upload->endpoint->body_handlers.on_abort(upload->state);
+    }
+    free(upload);
+}
+
+static void connection_free_body(Connection* conn) {
+    if (!arena_owns(&conn->arena, conn->body)) {
+        free(conn->body);
+    }
+    conn->body = NULL;
+}
+
+void connection_free(Connection* conn) {
+    if (conn->job) {
+        return; // Freed by handler_job_done once the worker lets go of the request
+    }
+#ifdef ENABLE_WEBSOCKET
+    if (conn->ws) {
+        if (ws_session_release(conn->ws) != 0) {
+            return; // Freed by the session's task once it comes back
+        }
+        conn->ws = NULL;
+    }
+#endif
+    if (conn->upload) {
+        upload_abort(conn);
+    }
+    if (conn->stream) {
+        response_writer_detach(conn->stream);
+    }
+    if (conn->sse) {
+        sse_unsubscribe(conn->sse);
+    }
+    http_response_free(conn->response);
+    connection_free_body(conn);
+    arena_reset(&conn->arena);
+    buffer_pool_release(&conn->reactor->buffer_pool, conn->buffer, conn->buffer_capacity);
+    connection_cancel_timeout(conn);
+    admission_release(conn->peer_addr);
+    free(conn);
+}
+
+void connection_close(Connection* conn) {
+    connection_cancel_timeout(conn);
+    event_loop_remove(&conn->reactor->loop, conn->fd);
+    reactor_remove_connection(conn->reactor, conn);
+    close(conn->fd);
+    conn->state = CONN_STATE_CLOSED;
+    connection_free(conn);
+}
+
+// Answers a request no endpoint took: 405 with Allow if its path has routes for other methods
+static HttpResponse* build_unrouted_response(Connection* conn) {
+    char allow[64];
+    if (endpoint_allow_header(&conn->request, allow, sizeof(allow)) > 0) {
+        return http_error_response_with_headers(405, "Method not allowed", conn->keep_alive, allow);
+    }
+    return http_error_response(404, "Endpoint not found", conn->keep_alive);
+}
+
+// Turns a handler's response (NULL answers 404) and the file taken from it into the HTTP
+// response, and frees it
+static HttpResponse* build_response(Connection* conn, EndpointResponse* endpoint_response, FileCacheEntry* file) {
+    if (endpoint_response) {
+        HttpResponse* http_response;
+        if (file) {
+            http_response = http_response_for_file(&conn->request, endpoint_response->status_code, file,
+                                                   endpoint_response->content_type, conn->keep_alive);
+        } else {
+            // The handler's body buffer is handed over rather than copied
+            http_response = http_response_create(
+                endpoint_response->status_code,
+                endpoint_response->body,
+                endpoint_response->body_length,
+                endpoint_response->content_type,
+                conn->keep_alive
+            );
+            if (http_response) {
+                endpoint_response->body = NULL;
+            }
+        }
+
+        endpoint_response_free(endpoint_response);
+        return http_response;
+    } else {
+        return http_error_response(404, "Endpoint not found", conn->keep_alive);
+    }
+}
+
+// Writes headers and body with one sendmsg, then any file with sendfile, resuming at
+// write_offset after a short write.
+// Returns 1 when the response is fully written, 0 when the socket is full, -1 on error
+static int connection_flush(Connection* conn) {
+    HttpResponse* response = conn->response;
+    size_t buffered_length = response->headers_length + response->body_length;
+
+    while (conn->write_offset < buffered_length) {
+        struct iovec iov[2];
+        int iov_count = 0;
+        size_t body_offset = 0;
+
+        if (conn->write_offset < response->headers_length) {
+            iov[iov_count].iov_base = response->headers + conn->write_offset;
+            iov[iov_count].iov_len = response->headers_length - conn->write_offset;
+            iov_count++;
+        } else {
+            body_offset = conn->write_offset - response->headers_length;
+        }
+        if (body_offset < response->body_length) {
+            iov[iov_count].iov_base = (char*)response->body + body_offset;
+            iov[iov_count].iov_len = response->body_length - body_offset;
+            iov_count++;
+        }
+
+        // sendmsg rather than writev for MSG_NOSIGNAL
+        struct msghdr message = {0};
+        message.msg_iov = iov;
+        message.msg_iovlen = iov_count;
+        int flags = MSG_NOSIGNAL | (response->file_length > 0 ? MSG_MORE : 0);
+        ssize_t n = sendmsg(conn->fd, &message, flags);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        conn->write_offset += n;
+    }
+
+    size_t total_length = buffered_length + response->file_length;
+    while (conn->write_offset < total_length) {
+        off_t offset = response->file_offset + (conn->write_offset - buffered_length);
+        ssize_t n = sendfile(conn->fd, response->file->fd, &offset, total_length - conn->write_offset);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        if (n == 0) return -1; // File shrank underneath us
+        conn->write_offset += n;
+    }
+    return 1;
+}
+
+// Reads into dst. Returns bytes read, 0 if the socket is drained, -1 if the connection was closed.
+static ssize_t connection_read(Connection* conn, char* dst, size_t length) {
+    for (;;) {
+        ssize_t n = read(conn->fd, dst, length);
+        if (n > 0) return n;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        connection_close(conn);
+        return -1;
+    }
+}
+
+// Drops the finished request from the buffer and either closes the connection or
+// rearms it for the next (possibly already buffered) request. Returns -1 if closed.
+static int connection_finish_request(Connection* conn) {
+    http_response_free(conn->response);
+    conn->response = NULL;
+    connection_free_body(conn);
+    arena_reset(&conn->arena);
+    conn->requests_served++;
+
+    if (!conn->keep_alive) {
+        connection_close(conn); // Close the socket after HTTP response
+        return -1;
+    }
+
+    size_t consumed = conn->body_offset + conn->body_from_buffer;
+    conn->buffer_length -= consumed;
+    memmove(conn->buffer, conn->buffer + consumed, conn->buffer_length);
+    http_request_reset(&conn->request);
+
+    conn->body_offset = 0;
+    conn->body_length = 0;
+    conn->body_received = 0;
+    conn->body_from_buffer = 0;
+    conn->write_offset = 0;
+    conn->state = CONN_STATE_READING_HEADERS;
+
+    if (conn->buffer_length == 0) {
+        // Hand a buffer grown for one large request back so idle connections stay small
+        if (conn->buffer_capacity > BUFFER_POOL_MIN_SIZE) {
+            BufferPool* pool = &conn->reactor->buffer_pool;
+            size_t capacity;
+            char* buffer = buffer_pool_acquire(pool, BUFFER_POOL_MIN_SIZE, &capacity);
+            if (buffer) {
+                buffer_pool_release(pool, conn->buffer, conn->buffer_capacity);
+                conn->buffer = buffer;
+                conn->buffer_capacity = capacity;
+            }
+        }
+        connection_set_timeout(conn, CONN_TIMEOUT_IDLE);
+    } else {
+        connection_set_timeout(conn, CONN_TIMEOUT_HEADER); // Pipelined request already started
+    }
+    return 0;
+}
+
+// Returns 0 if the connection is ready for the next request, -1 if it was closed or is waiting for EPOLLOUT
+static int connection_send(Connection* conn) {
+    connection_cancel_timeout(conn);
+    conn->write_offset = 0;
+    conn->state = CONN_STATE_WRITING;
+
+    if (!conn->response) {
+        connection_close(conn);
+        return -1;
+    }
+
+    int result = connection_flush(conn);
+    if (result < 0) {
+        connection_close(conn);
+        return -1;
+    }
+    if (result == 0) {
+        return -1; // Resumed by connection_on_writable
+    }
+    return connection_finish_request(conn);
+}
+
+// Answers with a JSON error and closes the connection afterwards
+static int connection_send_error(Connection* conn, int status_code, const char* message) {
+    conn->keep_alive = 0;
+    Arena* previous = arena_set_current(&conn->arena);
+    conn->response = http_error_response(status_code, message, 0);
+    arena_set_current(previous);
+    return connection_send(conn);
+}
+
+// Subscribes the connection to the stream picked by the endpoint's handler
+static int connection_start_sse(Connection* conn, const RegisteredEndpoint* endpoint, const RequestContext* context) {
+    SseStream* stream = endpoint->sse_handler(context);
+    if (!stream) {
+        return connection_send_error(conn, 404, "Stream not found");
+    }
+
+    conn->keep_alive = 0;
+    conn->sse = sse_subscribe(conn, stream);
+    if (!conn->sse) {
+        return connection_send_error(conn, 500, "Internal server error");
+    }
+    conn->state = CONN_STATE_SSE;
+    if (sse_flush(conn->sse) != 0) {
+        connection_close(conn);
+    }
+    return -1;
+}
+
+static void connection_on_readable(Connection* conn);
+
+#ifdef ENABLE_WEBSOCKET
+// Upgrades the connection. It stays on the reactor, handled by a WsSession from now on.
+static int connection_start_websocket(Connection* conn, const RegisteredWsEndpoint* endpoint, const char* path,
+                                      const RouteMatch* match) {
+    const char* key = http_request_header(&conn->request, HTTP_HEADER_SEC_WEBSOCKET_KEY, NULL);
+    if (!key) {
+        return connection_send_error(conn, 400, "Missing Sec-WebSocket-Key");
+    }
+
+    conn->keep_alive = 0;
+    conn->ws = ws_session_start(conn, endpoint, path, match, key, conn->buffer + conn->body_offset,
+                                conn->buffer_length - conn->body_offset);
+    if (!conn->ws) {
+        connection_close(conn);
+        return -1;
+    }
+
+    // Frames are read into the session's own buffer; the request buffer goes back to the pool
+    buffer_pool_release(&conn->reactor->buffer_pool, conn->buffer, conn->buffer_capacity);
+    conn->buffer = NULL;
+    conn->buffer_capacity = 0;
+    conn->buffer_length = 0;
+    arena_reset(&conn->arena);
+
+    conn->state = CONN_STATE_WEBSOCKET;
+    connection_set_timeout(conn, CONN_TIMEOUT_WEBSOCKET);
+    ws_session_on_event(conn->ws, EPOLLIN);
+    return -1;
+}
+#endif
+
+// Runs on a worker thread. No arena is current there, so the response is malloc'd.
+static void handler_job_run(WorkerJob* work) {
+    HandlerJob* job = (HandlerJob*)work;
+    job->response = endpoint_invoke(job->endpoint, &job->context);
+    job->file = endpoint_take_file(job->response);
+    event_loop_post(&job->conn->reactor->loop, &job->done);
+}
+
+static void handler_job_cancel(WorkerJob* work) {
+    HandlerJob* job = (HandlerJob*)work;
+    job->cancelled = 1;
+    event_loop_post(&job->conn->reactor->loop, &job->done);
+}
+
+// Back on the connection's reactor: sends the handler's response, or frees the connection
+// if it was closed in the meantime
+static void handler_job_done(EventLoop* loop, EventTask* task) {
+    (void)loop;
+    HandlerJob* job = (HandlerJob*)((char*)task - offsetof(HandlerJob, done));
+    Connection* conn = job->conn;
+    conn->job = NULL;
+    connection_cancel_timeout(conn);
+
+    if (conn->state == CONN_STATE_CLOSED) {
+        file_cache_release(job->file);
+        endpoint_response_free(job->response);
+        connection_free(conn);
+        return;
+    }
+
+    Arena* previous = arena_set_current(&conn->arena);
+    if (job->cancelled) {
+        conn->keep_alive = 0;
+        conn->response = http_error_response(503, "Server shutting down", 0);
+    } else {
+        conn->response = build_response(conn, job->response, job->file);
+    }
+    arena_set_current(previous);
+    if (connection_send(conn) == 0) {
+        connection_on_readable(conn);
+    }
+}
+
+// Past shed_latency_ms, queueing another job would only make every waiting request late
+static int workers_overloaded(Connection* conn) {
+    int shed_latency = conn->reactor->config->shed_latency_ms;
+    return shed_latency > 0 && conn->reactor->workers &&
+           worker_pool_queue_delay(conn->reactor->workers) > (uint64_t)shed_latency;
+}
+
+static int connection_send_busy(Connection* conn) {
+    Arena* previous = arena_set_current(&conn->arena);
+    conn->response = http_error_response_with_headers(503, "Server busy", conn->keep_alive, "Retry-After: 1\r\n");
+    arena_set_current(previous);
+    return connection_send(conn);
+}
+
+// Hands a HANDLER_BLOCKING or HANDLER_CPU_HEAVY endpoint to the worker pool. The request
+// head and body stay in the connection's buffers, which the reactor leaves alone until
+// the job comes back. A full or too slow queue is answered with 503 and Retry-After.
+static int connection_offload(Connection* conn, const RegisteredEndpoint* endpoint, const RequestContext* context) {
+    HandlerJob* job = arena_alloc(&conn->arena, sizeof(HandlerJob));
+    if (!job) {
+        return connection_send_error(conn, 500, "Internal server error");
+    }
+    memset(job, 0, sizeof(HandlerJob));
+    job->work.run = handler_job_run;
+    job->work.cancel = handler_job_cancel;
+    job->done.run = handler_job_done;
+    job->conn = conn;
+    job->endpoint = endpoint;
+    job->context = *context;
+
+    conn->job = job;
+    conn->state = CONN_STATE_WORKING;
+    if (workers_overloaded(conn) || worker_pool_submit(conn->reactor->workers, &job->work) != 0) {
+        conn->job = NULL;
+        return connection_send_busy(conn);
+    }
+    connection_set_timeout(conn, CONN_TIMEOUT_HANDLER);
+    return -1; // Resumed by handler_job_done
+}
+
+static int connection_dispatch(Connection* conn) {
+    // Everything the router, handler and response builders allocate comes from the connection's arena
+    Arena* previous = arena_set_current(&conn->arena);
+    RequestContext context;
+    RegisteredEndpoint* endpoint = endpoint_match(&conn->request, conn->body, conn->body_length, &context);
+    if (endpoint && endpoint->sse_handler) {
+        arena_set_current(previous);
+        return connection_start_sse(conn, endpoint, &context);
+    }
+    if (endpoint && endpoint->stream_handler) {
+        arena_set_current(previous);
+        // Stream handlers hold a worker for as long as they write, so the pool caps them too
+        int busy = workers_overloaded(conn);
+        if (!busy) {
+            conn->stream = response_writer_start(conn, endpoint->stream_handler, &context,
+                                                 conn->reactor->workers, &busy);
+        }
+        if (busy) {
+            return connection_send_busy(conn);
+        }
+        if (!conn->stream) {
+            return connection_send_error(conn, 500, "Internal server error");
+        }
+        conn->state = CONN_STATE_STREAMING;
+        return -1; // Resumed by connection_stream_resume
+    }
+
+    if (endpoint && endpoint->handler_flags && conn->reactor->workers) {
+        arena_set_current(previous);
+        return connection_offload(conn, endpoint, &context);
+    }
+
+    EndpointResponse* endpoint_response = endpoint ? endpoint_invoke(endpoint, &context) : NULL;
+    conn->response = endpoint ? build_response(conn, endpoint_response, endpoint_take_file(endpoint_response))
+                              : build_unrouted_response(conn);
+    arena_set_current(previous);
+    return connection_send(conn);
+}
+
+// Hands body bytes to the upload's on_data. Returns -1 if the upload was rejected and the connection answered.
+static int upload_feed(Connection* conn, const char* data, size_t length) {
+    BodyUpload* upload = conn->upload;
+    if (length == 0) return 0;
+    int result = upload->is_raw ? raw_upload_write(&upload->raw, data, length)
+                                : upload->endpoint->body_handlers.on_data(upload->state, data, length);
+    if (result == 0) return 0;
+
+    upload_abort(conn);
+    connection_send_error(conn, 500, "Upload failed");
+    return -1;
+}
+
+static int upload_finish(Connection* conn) {
+    BodyUpload* upload = conn->upload;
+    EndpointResponse* endpoint_response;
+    Arena* previous = arena_set_current(&conn->arena);
+    if (upload->is_raw) {
+        StoredBody body;
+        if (raw_upload_finish(&upload->raw, &body) != 0) {
+            arena_set_current(previous);
+            upload_abort(conn);
+            return connection_send_error(conn, 500, "Upload failed");
+        }
+        endpoint_response = endpoint_invoke_end(upload->endpoint, &body, &upload->context);
+        raw_upload_discard(&upload->raw);
+    } else {
+        endpoint_response = endpoint_invoke_end(upload->endpoint, upload->state, &upload->context);
+    }
+    conn->upload = NULL;
+    free(upload);
+
+    conn->response = build_response(conn, endpoint_response, endpoint_take_file(endpoint_response));
+    arena_set_current(previous);
+    return connection_send(conn);
+}
+
+// Starts streaming the body to endpoint, beginning with whatever arrived with the head
+static int upload_start(Connection* conn, const RegisteredEndpoint* endpoint) {
+    BodyUpload* upload = calloc(1, sizeof(BodyUpload));
+    if (!upload) {
+        return connection_send_error(conn, 500, "Internal server error");
+    }
+    Arena* previous = arena_set_current(&conn->arena);
+    RegisteredEndpoint* matched = endpoint_match(&conn->request, NULL, 0, &upload->context);
+    arena_set_current(previous);
+    if (!matched) {
+        free(upload);
+        return connection_send_error(conn, 500, "Internal server error");
+    }
+    upload->endpoint = endpoint;
+    if (endpoint->raw_upload_handler) {
+        upload->is_raw = 1;
+        if (raw_upload_open(&upload->raw, endpoint->upload_directory, endpoint->upload_flags) != 0) {
+            free(upload);
+            return connection_send_error(conn, 500, "Internal server error");
+        }
+    } else if (endpoint->body_handlers.on_begin) {
+        upload->state = endpoint->body_handlers.on_begin(&upload->context);
+    }
+    conn->upload = upload;
+
+    long long content_length = conn->request.content_length > 0 ? conn->request.content_length : 0;
+    conn->body_length = content_length;
+
+    size_t already_read = conn->buffer_length - conn->body_offset;
+    if (already_read > conn->body_length) {
+        already_read = conn->body_length;
+    }
+    if (upload_feed(conn, conn->buffer + conn->body_offset, already_read) != 0) return -1;
+    conn->body_received = already_read;
+
+    if (conn->buffer_length == conn->body_offset + already_read) {
+        // Nothing pipelined behind the body, so the delivered bytes can be dropped
+        conn->buffer_length = conn->body_offset;
+    } else {
+        conn->body_from_buffer = already_read;
+    }
+
+    conn->state = CONN_STATE_READING_BODY;
+    return 0;
+}
+
+// Moves a raw upload from the socket to its file without copying it through user space
+static ssize_t upload_splice(Connection* conn) {
+    BodyUpload* upload = conn->upload;
+    ssize_t n = raw_upload_splice(&upload->raw, conn->fd, conn->reactor->splice_pipe,
+                                  conn->body_length - conn->body_received);
+    if (n == RAW_UPLOAD_CLOSED) {
+        connection_close(conn);
+        return -1;
+    }
+    if (n == RAW_UPLOAD_FILE_ERROR) {
+        upload_abort(conn);
+        connection_send_error(conn, 500, "Upload failed");
+        return -1;
+    }
+    if (n == RAW_UPLOAD_UNSUPPORTED) {
+        upload->splice_unsupported = 1;
+        return 1; // Retried through the read buffer
+    }
+    conn->body_received += n;
+    return n;
+}
+
+// Reads more of a streamed body into the space after the request head and passes it on
+static ssize_t upload_read(Connection* conn) {
+    if (conn->upload->is_raw && !conn->upload->splice_unsupported) {
+        return upload_splice(conn);
+    }
+    size_t space = conn->buffer_capacity - conn->buffer_length;
+    if (space < UPLOAD_CHUNK_SIZE) {
+        // Fails harmlessly once the pool's size limit is reached
+        char* old_buffer = conn->buffer;
+        buffer_pool_grow(&conn->reactor->buffer_pool, &conn->buffer, &conn->buffer_capacity,
+                         conn->buffer_length, conn->buffer_length + UPLOAD_CHUNK_SIZE);
+        conn->request.base = conn->buffer;
+        endpoint_context_rebase(&conn->upload->context, old_buffer, conn->body_offset, conn->buffer);
+        space = conn->buffer_capacity - conn->buffer_length;
+    }
+    char* chunk = conn->buffer + conn->buffer_length;
+    char overflow[4096];
+    if (space == 0) {
+        // The head fills the largest buffer the pool hands out; each chunk is passed on
+        // before the next read, so a small stack buffer does as well
+        chunk = overflow;
+        space = sizeof(overflow);
+    }
+    if (space > conn->body_length - conn->body_received) {
+        space = conn->body_length - conn->body_received;
+    }
+
+    ssize_t n = connection_read(conn, chunk, space);
+    if (n <= 0) return n;
+    if (upload_feed(conn, chunk, n) != 0) return -1;
+    conn->body_received += n;
+    return n;
+}
+
+// Rejects bodies it cannot frame, applies the body size limit and answers Expect before any
+// of the body is read. Returns -1 if the request was rejected.
+static int connection_check_body(Connection* conn, const RegisteredEndpoint* endpoint) {
+    HttpRequest* request = &conn->request;
+    const ServerConfig* config = conn->reactor->config;
+
+    // Chunked bodies are not decoded. Left unread, their bytes would be parsed as the next
+    // request, and with a Content-Length as well the framing is ambiguous (request smuggling).
+    if (http_request_header(request, HTTP_HEADER_TRANSFER_ENCODING, NULL)) {
+        if (request->content_length >= 0) {
+            return connection_send_error(conn, 400, "Both Transfer-Encoding and Content-Length");
+        }
+        return connection_send_error(conn, 501, "Transfer-Encoding not supported");
+    }
+
+    const char* expect = http_request_header(request, HTTP_HEADER_EXPECT, NULL);
+    if (expect && strcasecmp(expect, "100-continue") != 0) {
+        return connection_send_error(conn, 417, "Unsupported expectation");
+    }
+
+    size_t limit = streams_body(endpoint) ? config->max_upload_size : config->max_body_size;
+    long long content_length = request->content_length;
+    if ((limit > 0 && content_length > (long long)limit) || (!streams_body(endpoint) && content_length > INT_MAX)) {
+        return connection_send_error(conn, 413, "Request body too large");
+    }
+
+    // Only asked for when the client is holding the body back
+    if (expect && content_length > 0 && request->version_minor >= 1 && conn->buffer_length == conn->body_offset) {
+        send(conn->fd, CONTINUE_RESPONSE, sizeof(CONTINUE_RESPONSE) - 1, MSG_NOSIGNAL);
+    }
+    return 0;
+}
+
+// Called once the full header block is buffered. Returns -1 if the connection was closed or handed off.
+static int connection_on_headers(Connection* conn) {
+    HttpRequest* request = &conn->request;
+
+#ifdef ENABLE_WEBSOCKET
+    const char* path = http_request_path(request);
+
+    // Check if this is a WebSocket upgrade request
+    RouteMatch match;
+    RegisteredWsEndpoint* ws_endpoint = ws_is_upgrade_request(request) ? ws_endpoint_find(path, &match) : NULL;
+    if (ws_endpoint) {
+        printf("WebSocket upgrade request detected for path: %s\n", path);
+        return connection_start_websocket(conn, ws_endpoint, path, &match);
+    }
+#endif
+
+    const ServerConfig* config = conn->reactor->config;
+    conn->keep_alive = config->keepalive_timeout_ms > 0 &&
+                       conn->reactor->loop.is_running &&
+                       http_request_keep_alive(request) &&
+                       (config->max_keepalive_requests <= 0 ||
+                        conn->requests_served + 1 < config->max_keepalive_requests);
+
+    RegisteredEndpoint* endpoint = endpoint_find(request);
+    if (connection_check_body(conn, endpoint) != 0) return -1;
+    if (streams_body(endpoint)) {
+        return upload_start(conn, endpoint);
+    }
+
+    long long content_length = request->content_length;
+    if (content_length > 0) {
+        conn->body = arena_alloc(&conn->arena, content_length + 1);
+        if (!conn->body) {
+            conn->body = malloc(content_length + 1);
+        }
+        if (!conn->body) {
+            connection_close(conn);
+            return -1;
+        }
+        conn->body[content_length] = '\0';
+        conn->body_length = content_length;
+
+        size_t already_read = conn->buffer_length - conn->body_offset;
+        if (already_read > conn->body_length) {
+            already_read = conn->body_length;
+        }
+        memcpy(conn->body, conn->buffer + conn->body_offset, already_read);
+        conn->body_received = already_read;
+        conn->body_from_buffer = already_read;
+    }
+
+    conn->state = CONN_STATE_READING_BODY;
+    return 0;
+}
+
+// Drives the read side of the state machine until the socket is drained. Requests already
+// sitting in the buffer (pipelining) are answered in order before the socket is read again.
+static void connection_on_readable(Connection* conn) {
+    for (;;) {
+        if (conn->state == CONN_STATE_READING_HEADERS) {
+            int head_length = http_parse_request_head(&conn->request, conn->buffer, conn->buffer_length);
+            if (head_length > 0) {
+                conn->body_offset = head_length;
+                if (connection_on_headers(conn) != 0) return;
+                continue;
+            }
+            if (head_length == HTTP_PARSE_ERROR) {
+                if (connection_send_error(conn, 400, "Malformed request") != 0) return;
+                continue;
+            }
+
+            if (head_length == HTTP_PARSE_TOO_MANY_HEADERS ||
+                (conn->buffer_length == conn->buffer_capacity &&
+                 buffer_pool_grow(&conn->reactor->buffer_pool, &conn->buffer, &conn->buffer_capacity,
+                                  conn->buffer_length, conn->buffer_capacity * 2) != 0)) {
+                if (connection_send_error(conn, 431, "Request header fields too large") != 0) return;
+                continue;
+            }
+            size_t space = conn->buffer_capacity - conn->buffer_length;
+
+            ssize_t n = connection_read(conn, conn->buffer + conn->buffer_length, space);
+            if (n <= 0) return;
+            if (conn->timeout == CONN_TIMEOUT_IDLE) {
+                connection_set_timeout(conn, CONN_TIMEOUT_HEADER);
+            }
+            conn->buffer_length += n;
+        } else if (conn->state == CONN_STATE_READING_BODY) {
+            if (conn->body_received == conn->body_length) {
+                connection_cancel_timeout(conn);
+                if ((conn->upload ? upload_finish(conn) : connection_dispatch(conn)) != 0) return;
+                continue;
+            }
+            // Pushed back each time body bytes arrive, so only a stalled body times out
+            connection_set_timeout(conn, CONN_TIMEOUT_BODY);
+            if (conn->upload) {
+                if (upload_read(conn) <= 0) return;
+                continue;
+            }
+
+            ssize_t n = connection_read(conn, conn->body + conn->body_received, conn->body_length - conn->body_received);
+            if (n <= 0) return;
+            conn->body_received += n;
+        } else {
+            return;
+        }
+    }
+}
+
+static void connection_on_writable(Connection* conn) {
+    int result = connection_flush(conn);
+    if (result < 0) {
+        connection_close(conn);
+        return;
+    }
+    if (result > 0 && connection_finish_request(conn) == 0) {
+        // Edge-triggered: pick up requests that arrived while we were writing
+        connection_on_readable(conn);
+    }
+}
+
+void connection_stream_resume(Connection* conn) {
+    int result = response_writer_flush(conn->stream, conn->fd);
+    if (result < 0) {
+        connection_close(conn);
+        return;
+    }
+    if (result > 0) {
+        response_writer_detach(conn->stream);
+        conn->stream = NULL;
+        if (connection_finish_request(conn) == 0) {
+            connection_on_readable(conn);
+        }
+    }
+}
+
+static void connection_on_timeout(Timer* timer) {
+    Connection* conn = (Connection*)((char*)timer - offsetof(Connection, timer));
+    switch (conn->timeout) {
+        case CONN_TIMEOUT_IDLE:
+            connection_close(conn);
+            break;
+        case CONN_TIMEOUT_HEADER:
+        case CONN_TIMEOUT_BODY:
+            if (conn->upload) {
+                upload_abort(conn);
+            }
+            connection_send_error(conn, 408, "Request timeout");
+            break;
+        case CONN_TIMEOUT_HANDLER:
+            // The job still reads the request, so the connection is only freed once it returns
+            send(conn->fd, HANDLER_TIMEOUT_RESPONSE, sizeof(HANDLER_TIMEOUT_RESPONSE) - 1,
+                 MSG_DONTWAIT | MSG_NOSIGNAL);
+            connection_close(conn);
+            break;
+        case CONN_TIMEOUT_WEBSOCKET:
+#ifdef ENABLE_WEBSOCKET
+            ws_session_fail(conn->ws, WS_CLOSE_GOING_AWAY, "Idle timeout");
+#endif
+            break;
+    }
+}
+
+static void connection_on_event(EventLoop* loop, EventHandler* handler, uint32_t events) {
+    (void)loop;
+    Connection* conn = (Connection*)handler;
+
+    if (events & EPOLLERR) {
+        connection_close(conn);
+        return;
+    }
+
+    if (conn->state == CONN_STATE_WRITING) {
+        if (events & EPOLLOUT) {
+            connection_on_writable(conn);
+        }
+        return;
+    }
+
+    if (conn->state == CONN_STATE_WORKING) {
+        if (events & EPOLLHUP) {
+            connection_close(conn); // The response is dropped when the job comes back
+        }
+        return; // Anything read meanwhile is picked up once the response is sent
+    }
+
+    if (conn->state == CONN_STATE_SSE) {
+        if (events & (EPOLLHUP | EPOLLRDHUP)) {
+            connection_close(conn);
+        } else if ((events & EPOLLOUT) && sse_flush(conn->sse) != 0) {
+            connection_close(conn);
+        }
+        return;
+    }
+
+#ifdef ENABLE_WEBSOCKET
+    if (conn->state == CONN_STATE_WEBSOCKET) {
+        // Anything from the peer, pings included, keeps the connection alive
+        if (events & EPOLLIN) {
+            connection_set_timeout(conn, CONN_TIMEOUT_WEBSOCKET);
+        }
+        ws_session_on_event(conn->ws, events);
+        return;
+    }
+#endif
+
+    if (conn->state == CONN_STATE_STREAMING) {
+        if (events & EPOLLHUP) {
+            connection_close(conn); // Lets the handler's next write fail
+        } else if (events & EPOLLOUT) {
+            connection_stream_resume(conn);
+        }
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+        connection_on_readable(conn);
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "event_loop.h"
+#include "http.h"
+#include "arena.h"
+#include "timer_wheel.h"
+#include <stddef.h>
+#include <netinet/in.h>
+
+struct Reactor;
+
+typedef enum {
+    CONN_STATE_READING_HEADERS,
+    CONN_STATE_READING_BODY,
+    CONN_STATE_WORKING,    // A worker thread is running the handler
+    CONN_STATE_WRITING,
+    CONN_STATE_STREAMING,
+    CONN_STATE_SSE,
+    CONN_STATE_WEBSOCKET,
+    CONN_STATE_CLOSED
+} ConnectionState;
+
+// What the connection's timer is armed for
+typedef enum {
+    CONN_TIMEOUT_IDLE,     // Keep-alive connection waiting for its next request
+    CONN_TIMEOUT_HEADER,   // Request head not complete yet
+    CONN_TIMEOUT_BODY,     // No body bytes for too long
+    CONN_TIMEOUT_HANDLER,  // Worker pool handler still running
+    CONN_TIMEOUT_WEBSOCKET // Nothing received on an upgraded connection for too long
+} ConnectionTimeout;
+
+typedef struct Connection {
+    EventHandler handler;
+    int fd;
+    ConnectionState state;
+    struct Reactor* reactor;
+    in_addr_t peer_addr;  // Counted by admission control until the connection is freed
+
+    // Raw input from the reactor's buffer pool; may hold pipelined requests after the
+    // current one. body_offset marks the end of the current request head.
+    char* buffer;
+    size_t buffer_capacity;
+    size_t buffer_length;
+    size_t body_offset;
+    HttpRequest request;
+
+    // Body, handler response and HTTP response of the current request; reset once it is written
+    Arena arena;
+
+    char* body;             // NUL-terminated; from the arena when it fits
+    size_t body_length;
+    size_t body_received;
+    size_t body_from_buffer;
+    struct BodyUpload* upload;  // Set while the body is being streamed to a BodyHandlers endpoint
+    struct HandlerJob* job;     // Set while the handler runs on the worker pool; the connection is
+                                // not freed before the job comes back
+
+    HttpResponse* response;
+    size_t write_offset;
+    struct ResponseWriter* stream;  // Set while a streaming handler owns the response
+    struct SseSubscriber* sse;      // Set once the connection is a Server-Sent Events subscriber
+    struct WsSession* ws;           // Set once the connection is upgraded to WebSocket
+
+    int keep_alive;
+    int requests_served;
+
+    // Reactor connection table
+    struct Connection* prev;
+    struct Connection* next;
+
+    // On the reactor's timer wheel while a header, body, keep-alive, handler or WebSocket idle
+    // deadline applies
+    Timer timer;
+    ConnectionTimeout timeout;
+} Connection;
+
+Connection* connection_create(struct Reactor* reactor, int fd);
+void connection_close(Connection* conn);
+// Frees a closed connection whose free was put off while a posted task still pointed at it
+void connection_free(Connection* conn);
+// Called on the reactor thread when a streaming handler has produced output or finished
+void connection_stream_resume(Connection* conn);
+
+#endif
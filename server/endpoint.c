@@ -1,152 +1,463 @@
 #define _GNU_SOURCE
 #include "endpoint.h"
+#include "router.h"
+#include "file_cache.h"
+#include "arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <math.h>
+
+static Router endpoint_router;
+
+static const char* method_names[] = {
+    [HTTP_METHOD_GET] = "GET",
+    [HTTP_METHOD_POST] = "POST",
+    [HTTP_METHOD_PUT] = "PUT",
+    [HTTP_METHOD_DELETE] = "DELETE",
+};
+#define METHOD_COUNT ((int)(sizeof(method_names) / sizeof(method_names[0])))
+
+// File attached by endpoint_file_response() during the current dispatch on this thread.
+// Users allocate EndpointResponse themselves, so the file travels beside it, not inside it.
+static __thread const EndpointResponse* file_response;
+static __thread FileCacheEntry* file_entry;
+
+static void release_pending_file(void) {
+    file_cache_release(file_entry);
+    file_response = NULL;
+    file_entry = NULL;
+}
 
-RegisteredEndpoint endpoint_registry[MAX_ENDPOINTS];
-int endpoint_count = 0;
+FileCacheEntry* endpoint_take_file(const EndpointResponse* response) {
+    if (!response || response != file_response) return NULL;
+    FileCacheEntry* file = file_entry;
+    file_response = NULL;
+    file_entry = NULL;
+    return file;
+}
 
 void endpoint_system_init(void) {
-    endpoint_count = 0;
-    for (int i = 0; i < MAX_ENDPOINTS; i++) {
-        endpoint_registry[i].is_active = 0;
+    router_free(&endpoint_router, free);
+}
+
+// Copies the handler fields of `handlers` (everything but path and method) into a new route
+static int register_endpoint(const char* path, HttpMethod method, RegisteredEndpoint handlers) {
+    RegisteredEndpoint* endpoint = malloc(sizeof(RegisteredEndpoint));
+    if (!endpoint) return -1;
+
+    *endpoint = handlers;
+    strncpy(endpoint->path, path, MAX_PATH_LENGTH - 1);
+    endpoint->path[MAX_PATH_LENGTH - 1] = '\0';
+    endpoint->method = method;
+
+    if (router_insert(&endpoint_router, path, method, endpoint) != 0) {
+        free(endpoint);
+        return -1;
     }
+
+    printf("Registered endpoint: %s\n", path);
+    return 0;
 }
 
 int endpoint_register(const char* path, HttpMethod method, EndpointHandler handler) {
-    if (endpoint_count >= MAX_ENDPOINTS) {
-        fprintf(stderr, "Error: Maximum number of endpoints reached\n");
-        return -1;
+    return register_endpoint(path, method, (RegisteredEndpoint){ .handler = handler });
+}
+
+int endpoint_register_flags(const char* path, HttpMethod method, EndpointHandler handler, int flags) {
+    return register_endpoint(path, method, (RegisteredEndpoint){ .handler = handler, .handler_flags = flags });
+}
+
+int endpoint_register_stream(const char* path, HttpMethod method, StreamHandler handler) {
+    return register_endpoint(path, method, (RegisteredEndpoint){ .stream_handler = handler });
+}
+
+int endpoint_register_sse(const char* path, SseHandler handler) {
+    return register_endpoint(path, HTTP_METHOD_GET, (RegisteredEndpoint){ .sse_handler = handler });
+}
+
+int endpoint_register_body(const char* path, HttpMethod method, BodyHandlers handlers) {
+    return register_endpoint(path, method, (RegisteredEndpoint){ .body_handlers = handlers });
+}
+
+int endpoint_register_raw_upload(const char* path, HttpMethod method, const char* directory,
+                                 int flags, RawUploadHandler handler) {
+    RegisteredEndpoint handlers = { .raw_upload_handler = handler, .upload_flags = flags };
+    snprintf(handlers.upload_directory, sizeof(handlers.upload_directory), "%s", directory ? directory : "/tmp");
+    return register_endpoint(path, method, handlers);
+}
+
+// Returns -1 for methods no endpoint can be registered for; their requests get 405
+static int parse_method(const char* method_str) {
+    for (int i = 0; i < METHOD_COUNT; i++) {
+        if (strcmp(method_str, method_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes one character of [in, end) ('+' is a space) and returns where the next one starts
+static const char* url_decode_char(const char* in, const char* end, char* c) {
+    int high, low;
+    if (*in == '%' && end - in >= 3 && (high = hex_value(in[1])) >= 0 && (low = hex_value(in[2])) >= 0) {
+        *c = (char)(high << 4 | low);
+        return in + 3;
     }
+    *c = *in == '+' ? ' ' : *in;
+    return in + 1;
+}
 
-    int slot = -1;
-    for (int i = 0; i < MAX_ENDPOINTS; i++) {
-        if (!endpoint_registry[i].is_active) {
-            slot = i;
-            break;
+// Percent-decodes [in, end) to out and returns the end of the output.
+// out may equal in: the output is never longer than the input.
+static char* url_decode(char* out, const char* in, const char* end) {
+    while (in < end) {
+        in = url_decode_char(in, end, out++);
+    }
+    return out;
+}
+
+// Compares a name still encoded in the query with a decoded one
+static int query_name_matches(const char* name, size_t length, const char* wanted) {
+    const char* end = name + length;
+    while (name < end) {
+        char c;
+        name = url_decode_char(name, end, &c);
+        if (*wanted == '\0' || *wanted++ != c) return 0;
+    }
+    return *wanted == '\0';
+}
+
+// Rewrites "a=x%20y&flag&b=1" in place as "a=x y\0\0\0" "flag\0" "b=1": each value is decoded
+// where it lies and NUL-terminated where its '&' was, padded with NULs if it shrank. Names
+// stay encoded (they cannot contain '='), so a name without a value keeps its place too.
+static void decode_query(RequestContext* context) {
+    char* in = context->query;
+    char* end = in + context->query_length;
+    while (in < end) {
+        char* pair_end = memchr(in, '&', end - in);
+        if (!pair_end) pair_end = end;
+        char* equals = memchr(in, '=', pair_end - in);
+        if (equals) {
+            char* value_end = url_decode(equals + 1, equals + 1, pair_end);
+            memset(value_end, '\0', pair_end - value_end);
         }
+        if (pair_end < end) *pair_end = '\0';
+        in = pair_end + 1;
     }
+    context->query_decoded = 1;
+}
 
-    if (slot == -1) {
-        fprintf(stderr, "Error: No available endpoint slots\n");
-        return -1;
+EndpointResponse* endpoint_dispatch(const char* method_str, const char* path, const char* query_string, const char* body, int body_length) {
+    return endpoint_dispatch_with_body(method_str, path, query_string, "", body, body_length);
+}
+
+// match is filled whenever some route matches the path, even if method has no endpoint there
+static RegisteredEndpoint* find_endpoint(int method, const char* path, RouteMatch* match) {
+    if (!router_lookup(&endpoint_router, path, match) || method < 0) return NULL;
+    return match->values[method];
+}
+
+// Size of the block decode_path_params() fills: the RequestParam array, then the values
+static size_t path_params_size(const RouteMatch* match) {
+    size_t size = match->param_count * sizeof(RequestParam);
+    for (int i = 0; i < match->param_count; i++) {
+        size += match->params[i].length + 1;
+    }
+    return size;
+}
+
+static void decode_path_params(RequestParam* params, const RouteMatch* match) {
+    char* out = (char*)(params + match->param_count);
+    for (int i = 0; i < match->param_count; i++) {
+        const RouteParam* param = &match->params[i];
+        params[i].name = param->name;
+        params[i].value = out;
+        out = url_decode(out, param->value, param->value + param->length);
+        *out++ = '\0';
     }
+}
 
-    strncpy(endpoint_registry[slot].path, path, MAX_PATH_LENGTH - 1);
-    endpoint_registry[slot].path[MAX_PATH_LENGTH - 1] = '\0';
-    endpoint_registry[slot].method = method;
-    endpoint_registry[slot].handler = handler;
-    endpoint_registry[slot].is_active = 1;
+static int capture_path_params(RequestContext* context, const RouteMatch* match) {
+    context->path_params = NULL;
+    context->path_param_count = 0;
+    if (match->param_count == 0) return 0;
 
-    endpoint_count++;
-    printf("Registered endpoint: %s\n", path);
+    // Never malloc'd behind the connection's back: with an arena current, it must fit there
+    size_t size = path_params_size(match);
+    Arena* arena = arena_current();
+    RequestParam* params = arena ? arena_alloc(arena, size) : malloc(size);
+    if (!params) return -1;
+
+    decode_path_params(params, match);
+    context->path_params = params;
+    context->path_param_count = match->param_count;
     return 0;
 }
 
-static HttpMethod parse_method(const char* method_str) {
-    if (strcmp(method_str, "GET") == 0) return HTTP_METHOD_GET;
-    if (strcmp(method_str, "POST") == 0) return HTTP_METHOD_POST;
-    if (strcmp(method_str, "PUT") == 0) return HTTP_METHOD_PUT;
-    if (strcmp(method_str, "DELETE") == 0) return HTTP_METHOD_DELETE;
-    return HTTP_METHOD_GET;
+// path, content_type and query are borrowed; the query is decoded in place later, so it
+// must be writable
+static int init_context(RequestContext* context, HttpMethod method, const char* path, char* query,
+                        const char* content_type, const char* body, int body_length, const HttpRequest* http,
+                        const RouteMatch* match) {
+    context->method = method;
+    context->path = path;
+    context->body = (char*)body;
+    context->body_length = body_length;
+    context->content_type = content_type ? content_type : "";
+    context->http = http;
+    context->query = query;
+    context->query_length = query ? strlen(query) : 0;
+    context->query_decoded = 0;
+    return capture_path_params(context, match);
+}
+
+RequestParam* endpoint_copy_path_params(const RouteMatch* match, int* count) {
+    *count = 0;
+    if (match->param_count == 0) return NULL;
+
+    RequestParam* params = malloc(path_params_size(match));
+    if (!params) return NULL;
+    decode_path_params(params, match);
+    *count = match->param_count;
+    return params;
+}
+
+void endpoint_context_release(RequestContext* context) {
+    arena_free(context->path_params);
+    context->path_params = NULL;
+    context->path_param_count = 0;
 }
 
-static void parse_query_string(const char* query_string, RequestContext* context) {
-    if (!query_string || strlen(query_string) == 0) {
-        context->param_count = 0;
-        return;
+int endpoint_context_detach(RequestContext* context) {
+    if (!context->path_params) return 0;
+
+    const RequestParam* params = context->path_params;
+    const char* last = params[context->path_param_count - 1].value;
+    size_t size = last + strlen(last) + 1 - (const char*)params;
+    RequestParam* copy = malloc(size);
+    if (!copy) return -1;
+
+    memcpy(copy, params, size);
+    for (int i = 0; i < context->path_param_count; i++) {
+        copy[i].value = (char*)copy + (params[i].value - (const char*)params);
     }
+    context->path_params = copy;
+    return 0;
+}
 
-    context->param_count = 0;
-    char* query_copy = strdup(query_string);
-    char* pair = strtok(query_copy, "&");
+void endpoint_context_rebase(RequestContext* context, const char* old_head, size_t length, char* new_head) {
+    uintptr_t start = (uintptr_t)old_head;
+    uintptr_t end = start + length;
+    if ((uintptr_t)context->path >= start && (uintptr_t)context->path < end) {
+        context->path = new_head + (context->path - old_head);
+    }
+    if ((uintptr_t)context->content_type >= start && (uintptr_t)context->content_type < end) {
+        context->content_type = new_head + (context->content_type - old_head);
+    }
+    if (context->query && (uintptr_t)context->query >= start && (uintptr_t)context->query < end) {
+        context->query = new_head + (context->query - old_head);
+    }
+}
 
-    while (pair && context->param_count < MAX_PARAMS) {
-        char* equals = strchr(pair, '=');
-        if (equals) {
-            *equals = '\0';
-            strncpy(context->params[context->param_count].name, pair, MAX_PARAM_LENGTH - 1);
-            strncpy(context->params[context->param_count].value, equals + 1, MAX_PARAM_LENGTH - 1);
-            context->params[context->param_count].name[MAX_PARAM_LENGTH - 1] = '\0';
-            context->params[context->param_count].value[MAX_PARAM_LENGTH - 1] = '\0';
-            context->param_count++;
-        }
-        pair = strtok(NULL, "&");
+static EndpointResponse* dispatch(const char* method_str, const char* path, const char* query_string, const char* content_type,
+                                  const char* body, int body_length, const HttpRequest* http) {
+    int method = parse_method(method_str);
+    RouteMatch match;
+    RegisteredEndpoint* endpoint = find_endpoint(method, path, &match);
+    if (!endpoint) {
+        return match.values ? endpoint_error_response(405, "Method not allowed")
+                            : endpoint_error_response(404, "Endpoint not found");
+    }
+    // A caller's query may be read-only; the request buffer's is decoded where it lies
+    char* query = http ? (char*)query_string : (query_string ? strdup(query_string) : NULL);
+    if (query_string && !query) {
+        return endpoint_error_response(500, "Internal server error");
     }
 
-    free(query_copy);
+    RequestContext context;
+    EndpointResponse* response;
+    if (init_context(&context, method, path, query, content_type, body, body_length, http, &match) != 0) {
+        response = endpoint_error_response(500, "Internal server error");
+    } else {
+        response = endpoint_invoke(endpoint, &context);
+        endpoint_context_release(&context);
+    }
+    if (!http) free(query);
+    return response;
 }
 
-EndpointResponse* endpoint_dispatch(const char* method_str, const char* path, const char* query_string, const char* body, int body_length) {
-    return endpoint_dispatch_with_body(method_str, path, query_string, "", body, body_length);
+EndpointResponse* endpoint_invoke(const RegisteredEndpoint* endpoint, const RequestContext* context) {
+    if (!endpoint->handler) {
+        return endpoint_error_response(500, "Endpoint needs a streaming connection");
+    }
+
+    release_pending_file();
+    EndpointResponse* response = endpoint->handler(context);
+    if (file_response != response) {
+        release_pending_file();
+    }
+    return response;
+}
+
+EndpointResponse* endpoint_invoke_end(const RegisteredEndpoint* endpoint, void* state, const RequestContext* context) {
+    release_pending_file();
+    EndpointResponse* response = endpoint->raw_upload_handler
+        ? endpoint->raw_upload_handler(context, state)
+        : endpoint->body_handlers.on_end(state, context);
+    if (file_response != response) {
+        release_pending_file();
+    }
+    return response;
 }
 
 EndpointResponse* endpoint_dispatch_with_body(const char* method_str, const char* path, const char* query_string, const char* content_type, const char* body, int body_length) {
-    HttpMethod method = parse_method(method_str);
+    return dispatch(method_str, path, query_string, content_type, body, body_length, NULL);
+}
 
-    for (int i = 0; i < MAX_ENDPOINTS; i++) {
-        if (endpoint_registry[i].is_active &&
-            endpoint_registry[i].method == method &&
-            strcmp(endpoint_registry[i].path, path) == 0) {
+EndpointResponse* endpoint_dispatch_http(const HttpRequest* http, const char* body, int body_length) {
+    const char* content_type = http_request_header(http, HTTP_HEADER_CONTENT_TYPE, NULL);
+    return dispatch(http_request_method(http), http_request_path(http), http_request_query(http),
+                    content_type, body, body_length, http);
+}
 
-            RequestContext context;
-            context.method = method;
-            strncpy(context.path, path, MAX_PATH_LENGTH - 1);
-            context.path[MAX_PATH_LENGTH - 1] = '\0';
-            context.body = (char*)body;
-            context.body_length = body_length;
-            strncpy(context.content_type, content_type ? content_type : "", sizeof(context.content_type) - 1);
-            context.content_type[sizeof(context.content_type) - 1] = '\0';
+RegisteredEndpoint* endpoint_find(const HttpRequest* http) {
+    RouteMatch match;
+    return find_endpoint(parse_method(http_request_method(http)), http_request_path(http), &match);
+}
 
-            parse_query_string(query_string, &context);
+int endpoint_allow_header(const HttpRequest* http, char* out, size_t size) {
+    RouteMatch match;
+    if (!router_lookup(&endpoint_router, http_request_path(http), &match)) return 0;
 
-            return endpoint_registry[i].handler(&context);
+    size_t length = snprintf(out, size, "Allow:");
+    const char* separator = " ";
+    for (int i = 0; i < METHOD_COUNT && length < size; i++) {
+        if (match.values[i]) {
+            length += snprintf(out + length, size - length, "%s%s", separator, method_names[i]);
+            separator = ", ";
         }
     }
+    if (length < size) {
+        length += snprintf(out + length, size - length, "\r\n");
+    }
+    return length < size ? (int)length : 0;
+}
+
+RegisteredEndpoint* endpoint_match(const HttpRequest* http, const char* body, int body_length, RequestContext* context) {
+    int method = parse_method(http_request_method(http));
+    RouteMatch match;
+    RegisteredEndpoint* endpoint = find_endpoint(method, http_request_path(http), &match);
+    if (!endpoint) return NULL;
 
-    return endpoint_error_response(404, "Endpoint not found");
+    // The parser NUL-terminated the query inside the connection's writable buffer
+    if (init_context(context, method, http_request_path(http), (char*)http_request_query(http),
+                     http_request_header(http, HTTP_HEADER_CONTENT_TYPE, NULL), body, body_length, http, &match) != 0) {
+        return NULL;
+    }
+    return endpoint;
 }
 
 void endpoint_response_free(EndpointResponse* response) {
     if (response) {
-        if (response->body) {
-            free(response->body);
+        if (response == file_response) {
+            release_pending_file();
         }
-        if (response->content_type) {
-            free(response->content_type);
-        }
-        free(response);
+        // Helper-built responses may live in the connection's arena; user-built ones don't
+        arena_free(response->body);
+        arena_free(response->content_type);
+        arena_free(response);
     }
 }
 
 EndpointResponse* endpoint_create_response(int status_code, const char* body, const char* content_type) {
-    EndpointResponse* response = malloc(sizeof(EndpointResponse));
+    EndpointResponse* response = arena_malloc(sizeof(EndpointResponse));
     if (!response) return NULL;
 
     response->status_code = status_code;
-    response->body = body ? strdup(body) : NULL;
-    response->content_type = content_type ? strdup(content_type) : strdup("application/json");
+    response->body = body ? arena_strdup(body) : NULL;
+    response->content_type = arena_strdup(content_type ? content_type : "application/json");
     response->body_length = body ? strlen(body) : 0;
 
     return response;
 }
 
 const char* endpoint_get_param(const RequestContext* request, const char* param_name) {
-    for (int i = 0; i < request->param_count; i++) {
-        if (strcmp(request->params[i].name, param_name) == 0) {
-            return request->params[i].value;
+    if (!request->query) return NULL;
+    if (!request->query_decoded) {
+        // Decoding is the context's own bookkeeping; the handler sees no change
+        decode_query((RequestContext*)request);
+    }
+
+    // A name without '=' reads as an empty value
+    const char* pair = request->query;
+    const char* end = pair + request->query_length;
+    while (pair < end) {
+        if (*pair == '\0') {
+            pair++;  // Padding, or an empty pair
+            continue;
         }
+        size_t name_length = strcspn(pair, "=");
+        const char* value = pair + name_length;
+        if (*value == '=') value++;
+        if (query_name_matches(pair, name_length, param_name)) return value;
+        pair = value + strlen(value);
     }
     return NULL;
 }
 
+int endpoint_get_param_long(const RequestContext* request, const char* param_name, long long* value) {
+    const char* text = endpoint_get_param(request, param_name);
+    if (!text) return PARAM_MISSING;
+
+    char* end;
+    errno = 0;
+    long long parsed = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE) return PARAM_INVALID;
+    *value = parsed;
+    return PARAM_OK;
+}
+
+int endpoint_get_param_double(const RequestContext* request, const char* param_name, double* value) {
+    const char* text = endpoint_get_param(request, param_name);
+    if (!text) return PARAM_MISSING;
+
+    char* end;
+    errno = 0;
+    double parsed = strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE || !isfinite(parsed)) return PARAM_INVALID;
+    *value = parsed;
+    return PARAM_OK;
+}
+
 int endpoint_get_param_int(const RequestContext* request, const char* param_name, int default_value) {
-    const char* value = endpoint_get_param(request, param_name);
-    if (value) {
-        return atoi(value);
+    long long value;
+    if (endpoint_get_param_long(request, param_name, &value) != PARAM_OK || value < INT_MIN || value > INT_MAX) {
+        return default_value;
     }
-    return default_value;
+    return (int)value;
+}
+
+const char* endpoint_get_path_param(const RequestContext* request, const char* param_name) {
+    for (int i = 0; i < request->path_param_count; i++) {
+        if (strcmp(request->path_params[i].name, param_name) == 0) {
+            return request->path_params[i].value;
+        }
+    }
+    return NULL;
+}
+
+const char* endpoint_get_header(const RequestContext* request, const char* header_name) {
+    if (!request->http) return NULL;
+    return http_request_find_header(request->http, header_name, NULL);
 }
 
 EndpointResponse* endpoint_json_response(int status_code, const char* json_body) {
@@ -154,142 +465,121 @@ EndpointResponse* endpoint_json_response(int status_code, const char* json_body)
 }
 
 EndpointResponse* endpoint_error_response(int status_code, const char* error_message) {
-    char* json_body = malloc(256);
-    snprintf(json_body, 256, "{\"error\": \"%s\"}", error_message);
-    EndpointResponse* response = endpoint_create_response(status_code, json_body, "application/json");
-    free(json_body);
-    return response;
+    char json_body[256];
+    snprintf(json_body, sizeof(json_body), "{\"error\": \"%s\"}", error_message);
+    return endpoint_create_response(status_code, json_body, "application/json");
 }
 
 EndpointResponse* endpoint_binary_response(int status_code, const void* data,
                                           size_t data_length, const char* content_type) {
-    EndpointResponse* response = malloc(sizeof(EndpointResponse));
+    EndpointResponse* response = arena_malloc(sizeof(EndpointResponse));
     if (!response) return NULL;
 
     response->status_code = status_code;
 
-    response->body = malloc(data_length);
-    if (!response->body) { free(response); return NULL; }
+    response->body = arena_malloc(data_length);
+    if (!response->body) { arena_free(response); return NULL; }
     memcpy(response->body, data, data_length);
 
     response->body_length = data_length;
-    response->content_type = strdup(content_type);
+    response->content_type = arena_strdup(content_type);
 
     return response;
 }
 
-EndpointResponse* endpoint_file_response(int status_code, const char* file_path) {
-    FILE* file = fopen(file_path, "rb");
-    if (!file) {
-        fprintf(stderr, "Error: Could not open file %s\n", file_path);
-        return endpoint_error_response(404, "File not found");
-    }
-
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-
-    char* file_data = malloc(file_size);
-    if (!file_data) { fclose(file); return NULL; }
-    size_t bytes_read = fread(file_data, 1, file_size, file);
-    fclose(file);
+EndpointResponse* endpoint_binary_response_take(int status_code, void* data,
+                                               size_t data_length, const char* content_type) {
+    EndpointResponse* response = arena_malloc(sizeof(EndpointResponse));
+    if (!response) return NULL;
 
-    const char* content_type = "application/octet-stream";
-    const char* ext = strrchr(file_path, '.');
-    if (ext) {
-        if (strcmp(ext, ".mp3") == 0) content_type = "audio/mpeg";
-        else if (strcmp(ext, ".png") == 0) content_type = "image/png";
-        else if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) content_type = "image/jpeg";
-        else if (strcmp(ext, ".gif") == 0) content_type = "image/gif";
-        else if (strcmp(ext, ".pdf") == 0) content_type = "application/pdf";
-        else if (strcmp(ext, ".txt") == 0) content_type = "text/plain";
-        else if (strcmp(ext, ".html") == 0) content_type = "text/html";
-    }
+    response->status_code = status_code;
+    response->body = data;
+    response->body_length = data_length;
+    response->content_type = arena_strdup(content_type);
 
-    EndpointResponse* response = endpoint_binary_response(status_code, file_data, bytes_read, content_type);
-    free(file_data);
     return response;
 }
 
-int parse_multipart_file(const RequestContext* request, UploadedFile* file) {
-    if (!request || !file || !request->body || request->body_length == 0) {
-        return -1;
+EndpointResponse* endpoint_file_response(int status_code, const char* file_path) {
+    FileCacheEntry* file = file_cache_open(file_path);
+    if (!file) {
+        fprintf(stderr, "Error: Could not open file %s\n", file_path);
+        return endpoint_error_response(404, "File not found");
     }
 
-    const char* boundary_start = strstr(request->content_type, "boundary=");
-    if (!boundary_start) {
-        return -1;
+    EndpointResponse* response = arena_malloc(sizeof(EndpointResponse));
+    if (!response) {
+        file_cache_release(file);
+        return NULL;
     }
-    boundary_start += 9;
-
-    char boundary[256];
-    snprintf(boundary, sizeof(boundary), "--%s", boundary_start);
 
-    const char* part_start = strstr(request->body, boundary);
-    if (!part_start) {
-        return -1;
-    }
-    part_start += strlen(boundary);
+    response->status_code = status_code;
+    response->body = NULL;
+    response->body_length = file->size;
+    response->content_type = arena_strdup(file->content_type);
 
-    if (*part_start == '\r') part_start++;
-    if (*part_start == '\n') part_start++;
+    release_pending_file();
+    file_response = response;
+    file_entry = file;
+    return response;
+}
 
-    const char* disposition = strstr(part_start, "Content-Disposition:");
-    if (!disposition) {
-        return -1;
+// Records where the first file part lies in the buffered body. The whole body is fed at once,
+// so a part's data arrives as consecutive pieces of it.
+typedef struct {
+    UploadedFile* file;
+    int state;  // 0 = looking, 1 = in the file part, 2 = done
+} FirstFileSearch;
+
+static int first_file_begin(void* user, const MultipartPart* part) {
+    FirstFileSearch* search = user;
+    if (search->state == 0 && part->filename[0]) {
+        strcpy(search->file->filename, part->filename);
+        strcpy(search->file->content_type, part->content_type);
+        search->state = 1;
     }
+    return 0;
+}
 
-    const char* filename_start = strstr(disposition, "filename=\"");
-    if (filename_start) {
-        filename_start += 10;
-        const char* filename_end = strchr(filename_start, '"');
-        if (filename_end) {
-            size_t filename_len = filename_end - filename_start;
-            if (filename_len >= sizeof(file->filename)) {
-                filename_len = sizeof(file->filename) - 1;
-            }
-            strncpy(file->filename, filename_start, filename_len);
-            file->filename[filename_len] = '\0';
+static int first_file_data(void* user, const MultipartPart* part, const char* data, size_t length) {
+    (void)part;
+    FirstFileSearch* search = user;
+    if (search->state == 1) {
+        if (!search->file->data) {
+            search->file->data = data;
         }
+        search->file->size = data + length - search->file->data;
     }
+    return 0;
+}
 
-    const char* file_content_type = strstr(part_start, "Content-Type:");
-    if (file_content_type) {
-        file_content_type += 13;
-        while (*file_content_type == ' ') file_content_type++;
-
-        const char* ct_end = strstr(file_content_type, "\r\n");
-        if (ct_end) {
-            size_t ct_len = ct_end - file_content_type;
-            if (ct_len >= sizeof(file->content_type)) {
-                ct_len = sizeof(file->content_type) - 1;
-            }
-            strncpy(file->content_type, file_content_type, ct_len);
-            file->content_type[ct_len] = '\0';
-        }
+static int first_file_end(void* user, const MultipartPart* part) {
+    (void)part;
+    FirstFileSearch* search = user;
+    if (search->state == 1) {
+        search->state = 2;
     }
+    return 0;
+}
 
-    const char* file_data_start = strstr(part_start, "\r\n\r\n");
-    if (!file_data_start) {
+int parse_multipart_file(const RequestContext* request, UploadedFile* file) {
+    if (!request || !file || !request->body || request->body_length == 0) {
         return -1;
     }
-    file_data_start += 4;
-
-    char end_boundary[256];
-    snprintf(end_boundary, sizeof(end_boundary), "\r\n%s", boundary);
-
-    size_t search_len = request->body_length - (file_data_start - request->body);
-    const char* file_data_end = memmem(file_data_start, search_len, end_boundary, strlen(end_boundary));
 
-    if (!file_data_end) {
-        file_data_end = memmem(file_data_start, search_len, boundary, strlen(boundary));
-        if (!file_data_end) {
-            return -1;
-        }
+    memset(file, 0, sizeof(*file));
+    FirstFileSearch search = { file, 0 };
+    MultipartCallbacks callbacks = {
+        .on_part_begin = first_file_begin,
+        .on_part_data = first_file_data,
+        .on_part_end = first_file_end
+    };
+    MultipartParser* parser = multipart_parser_create(request->content_type, &callbacks, &search);
+    if (!parser) {
+        return -1;
     }
 
-    file->data = file_data_start;
-    file->size = file_data_end - file_data_start;
-
-    return 0;
+    int result = multipart_parser_feed(parser, request->body, request->body_length);
+    multipart_parser_free(parser);
+    return result == 0 && search.state == 2 ? 0 : -1;
 }
@@ -3,35 +3,79 @@
 
 #include "http.h"
 #include "server.h"
-
-#define MAX_ENDPOINTS 50
+#include "router.h"
 
 typedef struct {
     char path[MAX_PATH_LENGTH];
     HttpMethod method;
     EndpointHandler handler;
-    int is_active;
+    int handler_flags;             // HANDLER_BLOCKING / HANDLER_CPU_HEAVY: run on the worker pool
+    StreamHandler stream_handler;  // Set instead of handler for streaming endpoints
+    SseHandler sse_handler;        // Set instead of handler for Server-Sent Events endpoints
+    BodyHandlers body_handlers;    // on_data is set instead of handler for streaming-body endpoints
+    RawUploadHandler raw_upload_handler;  // Set instead of handler for endpoints that splice the body to a file
+    char upload_directory[128];
+    int upload_flags;
 } RegisteredEndpoint;
 
-extern RegisteredEndpoint endpoint_registry[MAX_ENDPOINTS];
-extern int endpoint_count;
-
+// Endpoints live in a radix-trie router (router.h), so paths may capture ":name" segments
+// and a trailing "*name"; there is no limit on how many are registered.
 void endpoint_system_init(void);
 int endpoint_register(const char* path, HttpMethod method, EndpointHandler handler);
+int endpoint_register_flags(const char* path, HttpMethod method, EndpointHandler handler, int flags);
+int endpoint_register_stream(const char* path, HttpMethod method, StreamHandler handler);
+int endpoint_register_sse(const char* path, SseHandler handler);
+int endpoint_register_body(const char* path, HttpMethod method, BodyHandlers handlers);
+int endpoint_register_raw_upload(const char* path, HttpMethod method, const char* directory,
+                                 int flags, RawUploadHandler handler);
 EndpointResponse* endpoint_dispatch(const char* method_str, const char* path, const char* query_string, const char* body, int body_length);
 EndpointResponse* endpoint_dispatch_with_body(const char* method_str, const char* path, const char* query_string, const char* content_type, const char* body, int body_length);
+EndpointResponse* endpoint_dispatch_http(const HttpRequest* http, const char* body, int body_length);
+// Finds the endpoint registered for the request's path and method, or returns NULL
+RegisteredEndpoint* endpoint_find(const HttpRequest* http);
+// For a request endpoint_find() rejected: writes "Allow: GET, POST\r\n" listing the methods
+// registered for its path and returns the length, or returns 0 if no route matches (404)
+int endpoint_allow_header(const HttpRequest* http, char* out, size_t size);
+// Like endpoint_find() but also fills context. Its route captures come from the current arena
+// if there is one (and go away with it), otherwise from malloc (see endpoint_context_release()).
+RegisteredEndpoint* endpoint_match(const HttpRequest* http, const char* body, int body_length, RequestContext* context);
+// Frees a context's malloc'd route captures; does nothing for ones in the current arena
+void endpoint_context_release(RequestContext* context);
+// Gives context a malloc'd copy of its route captures, for a context that outlives the arena
+int endpoint_context_detach(RequestContext* context);
+// Decodes match's route captures into one malloc'd block, for holders other than a request
+// (WebSocket clients). Returns NULL with *count 0 if there are none, or NULL on failure.
+RequestParam* endpoint_copy_path_params(const RouteMatch* match, int* count);
+// Repoints the context's path, content type and query after the request head moved
+void endpoint_context_rebase(RequestContext* context, const char* old_head, size_t length, char* new_head);
+// Runs a plain (non-streaming) endpoint's handler
+EndpointResponse* endpoint_invoke(const RegisteredEndpoint* endpoint, const RequestContext* context);
+// Runs a streaming-body endpoint's on_end (state is its on_begin result) or a raw upload
+// endpoint's handler (state is the StoredBody) once the whole body has arrived
+EndpointResponse* endpoint_invoke_end(const RegisteredEndpoint* endpoint, void* state, const RequestContext* context);
 void endpoint_response_free(EndpointResponse* response);
 
 EndpointResponse* endpoint_create_response(int status_code, const char* body, const char* content_type);
 const char* endpoint_get_param(const RequestContext* request, const char* param_name);
 int endpoint_get_param_int(const RequestContext* request, const char* param_name, int default_value);
+int endpoint_get_param_long(const RequestContext* request, const char* param_name, long long* value);
+int endpoint_get_param_double(const RequestContext* request, const char* param_name, double* value);
+const char* endpoint_get_path_param(const RequestContext* request, const char* param_name);
+const char* endpoint_get_header(const RequestContext* request, const char* header_name);
 
 EndpointResponse* endpoint_json_response(int status_code, const char* json_body);
 EndpointResponse* endpoint_error_response(int status_code, const char* error_message);
 
 EndpointResponse* endpoint_binary_response(int status_code, const void* data,
                                           size_t data_length, const char* content_type);
+// Like endpoint_binary_response() but takes ownership of data (malloc'd) instead of copying it
+EndpointResponse* endpoint_binary_response_take(int status_code, void* data,
+                                               size_t data_length, const char* content_type);
 
+// The file is served from the open-descriptor cache with sendfile(); the response has
+// no body buffer, only body_length set to the file size
 EndpointResponse* endpoint_file_response(int status_code, const char* file_path);
+// Claims the file attached to response by endpoint_file_response() on this thread, if any
+struct FileCacheEntry* endpoint_take_file(const EndpointResponse* response);
 
 #endif
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include "event_loop.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+
+static void run_tasks(EventLoop* loop) {
+    pthread_mutex_lock(&loop->task_lock);
+    EventTask* task = loop->task_head;
+    loop->task_head = NULL;
+    loop->task_tail = NULL;
+    pthread_mutex_unlock(&loop->task_lock);
+
+    while (task) {
+        EventTask* next = task->next;
+        task->next = NULL;
+        task->run(loop, task);
+        task = next;
+    }
+}
+
+// Tasks run once the whole batch is dispatched, since one may close a connection whose
+// event is still waiting further down the batch
+static void on_wake(EventLoop* loop, EventHandler* handler, uint32_t events) {
+    (void)handler;
+    (void)events;
+    uint64_t value;
+    while (read(loop->wake_fd, &value, sizeof(value)) > 0) {
+    }
+    loop->woken = 1;
+}
+
+int event_loop_init(EventLoop* loop) {
+    memset(loop, 0, sizeof(*loop));
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd == -1) {
+        perror("eventfd");
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    pthread_mutex_init(&loop->task_lock, NULL);
+    loop->is_running = 1;
+    loop->now_ms = event_loop_clock_ms();
+    timer_wheel_init(&loop->timers, loop->now_ms);
+    loop->wake_handler.on_event = on_wake;
+    if (event_loop_add(loop, loop->wake_fd, EPOLLIN, &loop->wake_handler) != 0) {
+        close(loop->wake_fd);
+        close(loop->epoll_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+void event_loop_destroy(EventLoop* loop) {
+    // Tasks posted after the last wake still own resources; let them release them
+    run_tasks(loop);
+    pthread_mutex_destroy(&loop->task_lock);
+
+    if (loop->wake_fd >= 0) {
+        close(loop->wake_fd);
+        loop->wake_fd = -1;
+    }
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
+
+int event_loop_add(EventLoop* loop, int fd, uint32_t events, EventHandler* handler) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("epoll_ctl ADD");
+        return -1;
+    }
+    return 0;
+}
+
+int event_loop_modify(EventLoop* loop, int fd, uint32_t events, EventHandler* handler) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = handler;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        perror("epoll_ctl MOD");
+        return -1;
+    }
+    return 0;
+}
+
+int event_loop_remove(EventLoop* loop, int fd) {
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+int event_loop_run(EventLoop* loop) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    while (loop->is_running) {
+        timer_wheel_advance(&loop->timers, event_loop_clock_ms());
+        int timeout = loop->prepare ? loop->prepare(loop) : -1;
+        int next_timer = timer_wheel_timeout(&loop->timers);
+        if (next_timer >= 0 && (timeout < 0 || next_timer < timeout)) {
+            timeout = next_timer;
+        }
+
+        int n = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout);
+        loop->now_ms = event_loop_clock_ms();
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            EventHandler* handler = events[i].data.ptr;
+            handler->on_event(loop, handler, events[i].events);
+        }
+        if (loop->woken) {
+            loop->woken = 0;
+            run_tasks(loop);
+        }
+    }
+    return 0;
+}
+
+void event_loop_stop(EventLoop* loop) {
+    loop->is_running = 0;
+    event_loop_wake(loop);
+}
+
+void event_loop_wake(EventLoop* loop) {
+    uint64_t one = 1;
+    ssize_t n = write(loop->wake_fd, &one, sizeof(one));
+    (void)n;
+}
+
+void event_loop_post(EventLoop* loop, EventTask* task) {
+    task->next = NULL;
+    pthread_mutex_lock(&loop->task_lock);
+    int was_empty = loop->task_head == NULL;
+    if (loop->task_tail) {
+        loop->task_tail->next = task;
+    } else {
+        loop->task_head = task;
+    }
+    loop->task_tail = task;
+    pthread_mutex_unlock(&loop->task_lock);
+
+    if (was_empty) {
+        event_loop_wake(loop);
+    }
+}
+
+uint64_t event_loop_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
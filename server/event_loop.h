@@ -0,0 +1,63 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "timer_wheel.h"
+
+#define EVENT_LOOP_MAX_EVENTS 256
+
+struct EventLoop;
+
+// Embedded as the first member of anything registered with the loop;
+// epoll hands the pointer back and the callback casts to the outer struct.
+typedef struct EventHandler {
+    void (*on_event)(struct EventLoop* loop, struct EventHandler* handler, uint32_t events);
+} EventHandler;
+
+// Work handed to the loop thread from another thread with event_loop_post()
+typedef struct EventTask {
+    void (*run)(struct EventLoop* loop, struct EventTask* task);
+    struct EventTask* next;
+} EventTask;
+
+typedef struct EventLoop {
+    int epoll_fd;
+    int wake_fd;
+    EventHandler wake_handler;
+    int woken;  // The wake fd fired in the batch being dispatched
+    volatile int is_running;
+
+    // Monotonic clock, refreshed each time epoll_wait returns
+    uint64_t now_ms;
+
+    // Advanced before every epoll_wait; timers are armed from the loop thread only
+    TimerWheel timers;
+
+    // Optional: called before every epoll_wait to expire timers.
+    // Returns ms until it next needs to run, or -1 for no deadline.
+    int (*prepare)(struct EventLoop* loop);
+
+    // Posted tasks, run in order on the loop thread after the batch that saw the wake
+    pthread_mutex_t task_lock;
+    EventTask* task_head;
+    EventTask* task_tail;
+} EventLoop;
+
+int event_loop_init(EventLoop* loop);
+void event_loop_destroy(EventLoop* loop);
+
+int event_loop_add(EventLoop* loop, int fd, uint32_t events, EventHandler* handler);
+int event_loop_modify(EventLoop* loop, int fd, uint32_t events, EventHandler* handler);
+int event_loop_remove(EventLoop* loop, int fd);
+
+// Runs until event_loop_stop() is called (from any thread)
+int event_loop_run(EventLoop* loop);
+void event_loop_stop(EventLoop* loop);
+void event_loop_wake(EventLoop* loop);
+// Thread-safe; task->run is called on the loop thread
+void event_loop_post(EventLoop* loop, EventTask* task);
+
+uint64_t event_loop_clock_ms(void);
+
+#endif
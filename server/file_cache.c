@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include "file_cache.h"
+#include "event_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Shared by all reactor threads
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static FileCacheEntry* buckets[FILE_CACHE_BUCKETS];
+static FileCacheEntry* lru_head;  // Most recently used
+static FileCacheEntry* lru_tail;
+static int entry_count = 0;
+static int max_entries = FILE_CACHE_DEFAULT_ENTRIES;
+
+static unsigned int hash_path(const char* path) {
+    unsigned int hash = 2166136261u;
+    while (*path) {
+        hash = (hash ^ (unsigned char)*path++) * 16777619u;
+    }
+    return hash % FILE_CACHE_BUCKETS;
+}
+
+static void entry_destroy(FileCacheEntry* entry) {
+    close(entry->fd);
+    free(entry->path);
+    free(entry);
+}
+
+static void lru_unlink(FileCacheEntry* entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(FileCacheEntry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = entry;
+    } else {
+        lru_tail = entry;
+    }
+    lru_head = entry;
+}
+
+// Removes an entry from the cache and drops the cache's reference. Caller holds cache_lock.
+static void entry_detach(FileCacheEntry* entry) {
+    FileCacheEntry** link = &buckets[hash_path(entry->path)];
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+    entry->hash_next = NULL;
+
+    lru_unlink(entry);
+    entry->is_cached = 0;
+    entry_count--;
+
+    if (--entry->refcount == 0) {
+        entry_destroy(entry);
+    }
+}
+
+static void evict_to(int limit) {
+    while (entry_count > limit && lru_tail) {
+        entry_detach(lru_tail);
+    }
+}
+
+void file_cache_init(int entries) {
+    pthread_mutex_lock(&cache_lock);
+    max_entries = entries < 0 ? 0 : entries;
+    evict_to(max_entries);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void file_cache_clear(void) {
+    pthread_mutex_lock(&cache_lock);
+    evict_to(0);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static FileCacheEntry* entry_open(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    FileCacheEntry* entry = calloc(1, sizeof(FileCacheEntry));
+    if (!entry) {
+        close(fd);
+        return NULL;
+    }
+    entry->path = strdup(path);
+    if (!entry->path) {
+        free(entry);
+        close(fd);
+        return NULL;
+    }
+
+    entry->fd = fd;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->inode = st.st_ino;
+    entry->content_type = file_cache_content_type(path);
+    snprintf(entry->etag, sizeof(entry->etag), "\"%lx-%llx-%llx\"",
+             (unsigned long)st.st_ino, (unsigned long long)st.st_size, (unsigned long long)st.st_mtime);
+    struct tm modified;
+    gmtime_r(&entry->mtime, &modified);
+    strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &modified);
+    entry->refcount = 1;
+    return entry;
+}
+
+FileCacheEntry* file_cache_open(const char* path) {
+    uint64_t now = event_loop_clock_ms();
+
+    pthread_mutex_lock(&cache_lock);
+
+    unsigned int bucket = hash_path(path);
+    FileCacheEntry* entry = buckets[bucket];
+    while (entry && strcmp(entry->path, path) != 0) {
+        entry = entry->hash_next;
+    }
+
+    // A file replaced or modified on disk gets a fresh descriptor
+    if (entry && now - entry->checked_ms >= FILE_CACHE_REVALIDATE_MS) {
+        struct stat st;
+        if (stat(path, &st) != 0 || st.st_ino != entry->inode ||
+            st.st_size != entry->size || st.st_mtime != entry->mtime) {
+            entry_detach(entry);
+            entry = NULL;
+        } else {
+            entry->checked_ms = now;
+        }
+    }
+
+    if (entry) {
+        lru_unlink(entry);
+        lru_push_front(entry);
+        entry->refcount++;
+        pthread_mutex_unlock(&cache_lock);
+        return entry;
+    }
+
+    entry = entry_open(path);
+    if (entry && max_entries > 0) {
+        entry->checked_ms = now;
+        entry->is_cached = 1;
+        entry->refcount++;
+        entry->hash_next = buckets[bucket];
+        buckets[bucket] = entry;
+        lru_push_front(entry);
+        entry_count++;
+        evict_to(max_entries);
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+    return entry;
+}
+
+void file_cache_release(FileCacheEntry* entry) {
+    if (!entry) return;
+
+    pthread_mutex_lock(&cache_lock);
+    int destroy = --entry->refcount == 0;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (destroy) {
+        entry_destroy(entry);
+    }
+}
+
+const char* file_cache_content_type(const char* path) {
+    static const struct {
+        const char* extension;
+        const char* content_type;
+    } types[] = {
+        {".mp3", "audio/mpeg"},
+        {".wav", "audio/wav"},
+        {".ogg", "audio/ogg"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".svg", "image/svg+xml"},
+        {".pdf", "application/pdf"},
+        {".json", "application/json"},
+        {".txt", "text/plain"},
+        {".html", "text/html"},
+        {".css", "text/css"},
+        {".js", "application/javascript"},
+    };
+
+    const char* ext = strrchr(path, '.');
+    if (ext) {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (strcmp(ext, types[i].extension) == 0) return types[i].content_type;
+        }
+    }
+    return "application/octet-stream";
+}
@@ -0,0 +1,46 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define FILE_CACHE_DEFAULT_ENTRIES 64
+#define FILE_CACHE_BUCKETS 128
+#define FILE_CACHE_REVALIDATE_MS 1000  // How often a cached entry is re-stat'ed
+
+// An open file plus the metadata needed to answer a request for it.
+// Entries are reference counted: the cache holds one reference while the entry is
+// cached, and every in-flight response holds another, so eviction never closes a
+// descriptor that sendfile() is still reading from.
+typedef struct FileCacheEntry {
+    char* path;
+    int fd;
+    off_t size;
+    time_t mtime;
+    ino_t inode;
+    const char* content_type;
+    char etag[64];           // Strong validator, quoted
+    char last_modified[32];  // HTTP-date
+
+    int refcount;
+    int is_cached;
+    uint64_t checked_ms;
+
+    struct FileCacheEntry* hash_next;
+    struct FileCacheEntry* lru_prev;
+    struct FileCacheEntry* lru_next;
+} FileCacheEntry;
+
+// Sets how many descriptors are kept open (0 disables caching; files are still served with sendfile)
+void file_cache_init(int max_entries);
+// Closes every cached descriptor not in use by a response
+void file_cache_clear(void);
+
+// Returns a referenced entry for path, opening it on a miss, or NULL if it cannot be opened
+FileCacheEntry* file_cache_open(const char* path);
+void file_cache_release(FileCacheEntry* entry);
+
+const char* file_cache_content_type(const char* path);
+
+#endif
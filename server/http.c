@@ -1,125 +1,735 @@
 #define _GNU_SOURCE
 #include "http.h"
+#include "file_cache.h"
+#include "arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
 
-HttpResponse* http_build_response(int status_code, const char* body) {
-    const char* status_text = (status_code == 200) ?  "OK" : "NOT FOUND";
-    int body_length = strlen(body);
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-    const char* format = "HTTP/1.1 %d %s\r\n"
-                        "Content-Type: application/json\r\n"
-                        "Content-Length: %d\r\n"
-                        "Connection: close\r\n"
-                        "\r\n"
-                        "%s";
+typedef struct {
+    const char* line;  // Complete status line with CRLF
+    uint8_t line_length;
+    const char* text;
+} HttpStatus;
 
-    int response_length = snprintf(NULL, 0, format,
-        status_code, status_text, body_length, body) + 1;
+#define HTTP_STATUS(code, reason) \
+    [code] = { "HTTP/1.1 " #code " " reason "\r\n", sizeof("HTTP/1.1 " #code " " reason "\r\n") - 1, reason }
 
-    HttpResponse* response = malloc(sizeof(HttpResponse));
-    response->status_code = status_code;
-    response->body = malloc(response_length);
-    response->body_length = response_length;
+// Indexed by status code so a lookup is one load
+static const HttpStatus status_table[HTTP_MAX_STATUS + 1] = {
+    HTTP_STATUS(100, "Continue"),
+    HTTP_STATUS(101, "Switching Protocols"),
+    HTTP_STATUS(200, "OK"),
+    HTTP_STATUS(201, "Created"),
+    HTTP_STATUS(202, "Accepted"),
+    HTTP_STATUS(204, "No Content"),
+    HTTP_STATUS(206, "Partial Content"),
+    HTTP_STATUS(301, "Moved Permanently"),
+    HTTP_STATUS(302, "Found"),
+    HTTP_STATUS(303, "See Other"),
+    HTTP_STATUS(304, "Not Modified"),
+    HTTP_STATUS(307, "Temporary Redirect"),
+    HTTP_STATUS(308, "Permanent Redirect"),
+    HTTP_STATUS(400, "Bad Request"),
+    HTTP_STATUS(401, "Unauthorized"),
+    HTTP_STATUS(402, "Payment Required"),
+    HTTP_STATUS(403, "Forbidden"),
+    HTTP_STATUS(404, "Not Found"),
+    HTTP_STATUS(405, "Method Not Allowed"),
+    HTTP_STATUS(406, "Not Acceptable"),
+    HTTP_STATUS(408, "Request Timeout"),
+    HTTP_STATUS(409, "Conflict"),
+    HTTP_STATUS(410, "Gone"),
+    HTTP_STATUS(411, "Length Required"),
+    HTTP_STATUS(412, "Precondition Failed"),
+    HTTP_STATUS(413, "Content Too Large"),
+    HTTP_STATUS(414, "URI Too Long"),
+    HTTP_STATUS(415, "Unsupported Media Type"),
+    HTTP_STATUS(416, "Range Not Satisfiable"),
+    HTTP_STATUS(417, "Expectation Failed"),
+    HTTP_STATUS(422, "Unprocessable Content"),
+    HTTP_STATUS(426, "Upgrade Required"),
+    HTTP_STATUS(429, "Too Many Requests"),
+    HTTP_STATUS(431, "Request Header Fields Too Large"),
+    HTTP_STATUS(500, "Internal Server Error"),
+    HTTP_STATUS(501, "Not Implemented"),
+    HTTP_STATUS(502, "Bad Gateway"),
+    HTTP_STATUS(503, "Service Unavailable"),
+    HTTP_STATUS(504, "Gateway Timeout"),
+    HTTP_STATUS(505, "HTTP Version Not Supported"),
+};
+
+const char* http_status_text(int status_code) {
+    if (status_code >= 0 && status_code <= HTTP_MAX_STATUS && status_table[status_code].text) {
+        return status_table[status_code].text;
+    }
+    // Unregistered codes get the generic phrase for their class
+    switch (status_code / 100) {
+        case 1: return "Informational";
+        case 2: return "Success";
+        case 3: return "Redirection";
+        case 4: return "Client Error";
+        default: return "Server Error";
+    }
+}
 
-    sprintf(response->body, format,
-        status_code, status_text, body_length, body);
+// Entity headers for the usual content types, up to the Content-Length value
+static const struct {
+    const char* content_type;
+    const char* block;
+    size_t block_length;
+} content_type_blocks[] = {
+#define CONTENT_TYPE_BLOCK(type) { type, "Content-Type: " type "\r\nContent-Length: ", sizeof("Content-Type: " type "\r\nContent-Length: ") - 1 }
+    CONTENT_TYPE_BLOCK("application/json"),
+    CONTENT_TYPE_BLOCK("text/plain"),
+    CONTENT_TYPE_BLOCK("application/octet-stream"),
+    CONTENT_TYPE_BLOCK("audio/mpeg"),
+#undef CONTENT_TYPE_BLOCK
+};
 
-    return response;
+static const char CONNECTION_KEEP_ALIVE[] = "Connection: keep-alive\r\n";
+static const char CONNECTION_CLOSE[] = "Connection: close\r\n";
+
+// Formatted once per second per thread
+static __thread char date_header[64];
+static __thread size_t date_header_length;
+static __thread time_t date_header_second = -1;
+
+const char* http_date_header(size_t* length) {
+    time_t now = time(NULL);
+    if (now != date_header_second) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        date_header_length = strftime(date_header, sizeof(date_header), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        date_header_second = now;
+    }
+    *length = date_header_length;
+    return date_header;
 }
 
-HttpResponse* http_build_binary_response(int status_code, const void* body,
-                                        size_t body_length, const char* content_type) {
-    const char* status_text = "OK";
-    if (status_code == 404) status_text = "Not Found";
-    else if (status_code == 500) status_text = "Internal Server Error";
+size_t http_format_uint(char* out, unsigned long long value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    for (size_t i = 0; i < count; i++) {
+        out[i] = digits[count - 1 - i];
+    }
+    return count;
+}
 
-    const char* header_format = "HTTP/1.1 %d %s\r\n"
-                               "Content-Type: %s\r\n"
-                               "Content-Length: %zu\r\n"
-                               "Connection: close\r\n"
-                               "\r\n";
+static char* append(char* out, const char* data, size_t length) {
+    memcpy(out, data, length);
+    return out + length;
+}
+
+// Builds the status line and headers with memcpy from the templates above. extra_headers
+// (each line ending in CRLF) may be NULL; a negative content_length leaves out Content-Type
+// and Content-Length (304 responses). extra_body bytes are reserved after the headers.
+static HttpResponse* response_alloc_with(int status_code, const char* content_type, long long content_length,
+                                         int keep_alive, const char* extra_headers, size_t extra_body) {
+    if (!content_type) content_type = "application/json";
 
-    int header_length = snprintf(NULL, 0, header_format,
-        status_code, status_text, content_type, body_length);
+    char status_line[64];
+    const char* line;
+    size_t line_length;
+    if (status_code >= 0 && status_code <= HTTP_MAX_STATUS && status_table[status_code].line) {
+        line = status_table[status_code].line;
+        line_length = status_table[status_code].line_length;
+    } else {
+        line_length = snprintf(status_line, sizeof(status_line), "HTTP/1.1 %d %s\r\n",
+                               status_code, http_status_text(status_code));
+        line = status_line;
+    }
 
-    size_t total_length = header_length + body_length;
-    char* response_buffer = malloc(total_length);
-    if (!response_buffer) return NULL;
+    const char* type_block = NULL;
+    size_t type_block_length = 0;
+    size_t type_length = 0;
+    char length_digits[20];
+    size_t digits_length = 0;
+    if (content_length >= 0) {
+        for (size_t i = 0; i < sizeof(content_type_blocks) / sizeof(content_type_blocks[0]); i++) {
+            if (strcmp(content_type, content_type_blocks[i].content_type) == 0) {
+                type_block = content_type_blocks[i].block;
+                type_block_length = content_type_blocks[i].block_length;
+                break;
+            }
+        }
+        if (!type_block) {
+            type_length = strlen(content_type);
+            type_block_length = 14 + type_length + 18;  // "Content-Type: " ... "\r\nContent-Length: "
+        }
+        digits_length = http_format_uint(length_digits, (unsigned long long)content_length);
+    }
 
-    int written = sprintf(response_buffer, header_format,
-        status_code, status_text, content_type, body_length);
+    size_t date_length;
+    const char* date = http_date_header(&date_length);
+    const char* connection = keep_alive ? CONNECTION_KEEP_ALIVE : CONNECTION_CLOSE;
+    size_t connection_length = keep_alive ? sizeof(CONNECTION_KEEP_ALIVE) - 1 : sizeof(CONNECTION_CLOSE) - 1;
+    size_t extra_length = extra_headers ? strlen(extra_headers) : 0;
 
-    memcpy(response_buffer + written, body, body_length);
+    size_t header_length = line_length + date_length + connection_length + extra_length + 2;
+    if (content_length >= 0) {
+        header_length += type_block_length + digits_length + 2;
+    }
 
-    HttpResponse* response = malloc(sizeof(HttpResponse));
+    HttpResponse* response = arena_malloc(sizeof(HttpResponse) + header_length + 1 + extra_body);
+    if (!response) return NULL;
+    memset(response, 0, sizeof(HttpResponse));
+    response->in_arena = arena_owns(arena_current(), response);
+    response->owns_body = 1;
     response->status_code = status_code;
-    response->body = response_buffer;
-    response->body_length = total_length;
+    response->headers = (char*)(response + 1);
+
+    char* out = append(response->headers, line, line_length);
+    if (content_length >= 0) {
+        if (type_block) {
+            out = append(out, type_block, type_block_length);
+        } else {
+            out = append(out, "Content-Type: ", 14);
+            out = append(out, content_type, type_length);
+            out = append(out, "\r\nContent-Length: ", 18);
+        }
+        out = append(out, length_digits, digits_length);
+        out = append(out, "\r\n", 2);
+    }
+    out = append(out, date, date_length);
+    out = append(out, extra_headers, extra_length);
+    out = append(out, connection, connection_length);
+    out = append(out, "\r\n", 2);
+    *out = '\0';
+    response->headers_length = out - response->headers;
+    return response;
+}
+
+static HttpResponse* response_alloc(int status_code, const char* content_type, long long content_length,
+                                    int keep_alive, const char* extra_headers) {
+    return response_alloc_with(status_code, content_type, content_length, keep_alive, extra_headers, 0);
+}
+
+HttpResponse* http_error_response(int status_code, const char* message, int keep_alive) {
+    return http_error_response_with_headers(status_code, message, keep_alive, NULL);
+}
+
+HttpResponse* http_error_response_with_headers(int status_code, const char* message, int keep_alive,
+                                               const char* extra_headers) {
+    if (!message) message = http_status_text(status_code);
+    size_t message_length = strlen(message);
+    size_t body_length = 11 + message_length + 2;  // {"error": "..."}
+
+    HttpResponse* response = response_alloc_with(status_code, "application/json", body_length,
+                                                 keep_alive, extra_headers, body_length);
+    if (!response) return NULL;
+
+    // The body shares the response's allocation
+    char* body = response->headers + response->headers_length + 1;
+    char* out = append(body, "{\"error\": \"", 11);
+    out = append(out, message, message_length);
+    append(out, "\"}", 2);
+    response->body = body;
+    response->body_length = body_length;
+    response->owns_body = 0;
     return response;
 }
 
+HttpResponse* http_response_create(int status_code, void* body, size_t body_length,
+                                   const char* content_type, int keep_alive) {
+    HttpResponse* response = response_alloc(status_code, content_type, body_length, keep_alive, NULL);
+    if (!response) return NULL;
+
+    response->body = body;
+    response->body_length = body_length;
+    response->owns_body = !arena_owns(arena_current(), body);
+    return response;
+}
+
+#define HTTP_MAX_RANGES 8
+#define HTTP_MAX_MULTIRANGE_BYTES (1024 * 1024)  // Multi-range bodies are assembled in memory
+
+typedef struct {
+    off_t start;
+    off_t end;  // Inclusive
+} ByteRange;
+
+// Parses "bytes=a-b, c-, -n" against a file of the given size. Returns the number of
+// satisfiable ranges, 0 if the header should be ignored (bad syntax, too many ranges),
+// or -1 if no range can be satisfied.
+static int parse_range(const char* value, off_t size, ByteRange* ranges, int max_ranges) {
+    if (strncasecmp(value, "bytes=", 6) != 0) return 0;
+    const char* p = value + 6;
+
+    int count = 0;
+    int seen = 0;
+    for (;;) {
+        while (*p == ' ' || *p == '\t') p++;
+
+        long long first = -1, last = -1;
+        char* end;
+        if (*p >= '0' && *p <= '9') {
+            first = strtoll(p, &end, 10);
+            p = end;
+        }
+        if (*p != '-') return 0;
+        p++;
+        if (*p >= '0' && *p <= '9') {
+            last = strtoll(p, &end, 10);
+            p = end;
+        }
+        if (first < 0 && last < 0) return 0;
+        if (first >= 0 && last >= 0 && last < first) return 0;
+        if (++seen > max_ranges) return 0;
+
+        ByteRange range;
+        if (first < 0) {
+            // Suffix range: the last `last` bytes
+            range.start = last >= size ? 0 : size - last;
+            range.end = size - 1;
+            if (last == 0) range.start = size;
+        } else {
+            range.start = first;
+            range.end = (last < 0 || last >= size) ? size - 1 : last;
+        }
+        if (range.start < size) {
+            ranges[count++] = range;
+        }
+
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+        if (*p != ',') return 0;
+        p++;
+    }
+
+    return count > 0 ? count : -1;
+}
+
+// Checks an If-None-Match / If-Range style list of entity tags against etag.
+// Weak comparison ignores a W/ prefix on either side.
+static int etag_list_matches(const char* list, const char* etag, int weak) {
+    size_t etag_length = strlen(etag);
+    const char* p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '*') return 1;
+
+        int is_weak = strncmp(p, "W/", 2) == 0;
+        if (is_weak) p += 2;
+        const char* tag_end = strchr(p, ',');
+        size_t tag_length = tag_end ? (size_t)(tag_end - p) : strlen(p);
+        while (tag_length > 0 && (p[tag_length - 1] == ' ' || p[tag_length - 1] == '\t')) tag_length--;
+
+        if ((weak || !is_weak) && tag_length == etag_length && memcmp(p, etag, etag_length) == 0) {
+            return 1;
+        }
+        if (!tag_end) break;
+        p = tag_end;
+    }
+    return 0;
+}
+
+static time_t parse_http_date(const char* value) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end) return (time_t)-1;
+    return timegm(&tm);
+}
+
+static int is_not_modified(const HttpRequest* request, const FileCacheEntry* file) {
+    const char* if_none_match = http_request_header(request, HTTP_HEADER_IF_NONE_MATCH, NULL);
+    if (if_none_match) {
+        return etag_list_matches(if_none_match, file->etag, 1);
+    }
+
+    const char* if_modified_since = http_request_header(request, HTTP_HEADER_IF_MODIFIED_SINCE, NULL);
+    if (if_modified_since) {
+        time_t since = parse_http_date(if_modified_since);
+        return since != (time_t)-1 && file->mtime <= since;
+    }
+    return 0;
+}
+
+// If-Range: the Range header only applies while the client's copy is still current
+static int range_applies(const HttpRequest* request, const FileCacheEntry* file) {
+    const char* if_range = http_request_header(request, HTTP_HEADER_IF_RANGE, NULL);
+    if (!if_range) return 1;
+    if (if_range[0] == '"') {
+        return etag_list_matches(if_range, file->etag, 0);
+    }
+    return strcmp(if_range, file->last_modified) == 0;
+}
+
+// Builds a multipart/byteranges response; the parts are read into one buffer with pread()
+static HttpResponse* multirange_response(FileCacheEntry* file, const ByteRange* ranges, int count,
+                                         const char* content_type, const char* validators, int keep_alive) {
+    char boundary[48];
+    snprintf(boundary, sizeof(boundary), "range_%lx_%llx",
+             (unsigned long)file->inode, (unsigned long long)file->mtime);
+
+    char part_header[512];
+    size_t total_length = 0;
+    for (int i = 0; i < count; i++) {
+        total_length += snprintf(part_header, sizeof(part_header),
+            "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+            boundary, content_type, (long long)ranges[i].start, (long long)ranges[i].end, (long long)file->size);
+        total_length += ranges[i].end - ranges[i].start + 1;
+    }
+    total_length += snprintf(part_header, sizeof(part_header), "\r\n--%s--\r\n", boundary);
+    if (total_length > HTTP_MAX_MULTIRANGE_BYTES) return NULL;
+
+    char* body = malloc(total_length + 1); // sprintf() terminates the closing boundary
+    if (!body) return NULL;
 
-void http_parse_request(const char* request, char* method, char* path) {
-    sscanf(request, "%s %s", method, path);
+    size_t offset = 0;
+    for (int i = 0; i < count; i++) {
+        offset += sprintf(body + offset,
+            "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+            boundary, content_type, (long long)ranges[i].start, (long long)ranges[i].end, (long long)file->size);
+        size_t length = ranges[i].end - ranges[i].start + 1;
+        if (pread(file->fd, body + offset, length, ranges[i].start) != (ssize_t)length) {
+            free(body);
+            return NULL;
+        }
+        offset += length;
+    }
+    offset += sprintf(body + offset, "\r\n--%s--\r\n", boundary);
+
+    char multipart_type[96];
+    snprintf(multipart_type, sizeof(multipart_type), "multipart/byteranges; boundary=%s", boundary);
+    HttpResponse* response = response_alloc(206, multipart_type, offset, keep_alive, validators);
+    if (!response) {
+        free(body);
+        return NULL;
+    }
+    response->body = body;
+    response->body_length = offset;
+    return response;
 }
 
-const char* http_get_header(const char* request, const char* header_name) {
-    static char header_value[512];
-    char search_pattern[128];
-    snprintf(search_pattern, sizeof(search_pattern), "%s:", header_name);
+HttpResponse* http_response_for_file(const HttpRequest* request, int status_code, FileCacheEntry* file,
+                                     const char* content_type, int keep_alive) {
+    if (!content_type) content_type = file->content_type;
+
+    char validators[160];
+    snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\n",
+             file->etag, file->last_modified);
+
+    if (status_code == 200 && request) {
+        if (is_not_modified(request, file)) {
+            file_cache_release(file);
+            return response_alloc(304, NULL, -1, keep_alive, validators);
+        }
+
+        const char* range_header = http_request_header(request, HTTP_HEADER_RANGE, NULL);
+        if (range_header && range_applies(request, file)) {
+            ByteRange ranges[HTTP_MAX_RANGES];
+            int count = parse_range(range_header, file->size, ranges, HTTP_MAX_RANGES);
+            char range_headers[256];
 
-    const char* header_start = strcasestr(request, search_pattern);
-    if (!header_start) {
+            if (count < 0) {
+                snprintf(range_headers, sizeof(range_headers), "%sContent-Range: bytes */%lld\r\n",
+                         validators, (long long)file->size);
+                file_cache_release(file);
+                return response_alloc(416, content_type, 0, keep_alive, range_headers);
+            }
+            if (count == 1) {
+                snprintf(range_headers, sizeof(range_headers), "%sContent-Range: bytes %lld-%lld/%lld\r\n",
+                         validators, (long long)ranges[0].start, (long long)ranges[0].end, (long long)file->size);
+                size_t length = ranges[0].end - ranges[0].start + 1;
+                HttpResponse* response = response_alloc(206, content_type, length, keep_alive, range_headers);
+                if (!response) {
+                    file_cache_release(file);
+                    return NULL;
+                }
+                response->file = file;
+                response->file_offset = ranges[0].start;
+                response->file_length = length;
+                return response;
+            }
+            if (count > 1) {
+                HttpResponse* response = multirange_response(file, ranges, count, content_type, validators, keep_alive);
+                if (response) {
+                    file_cache_release(file);
+                    return response;
+                }
+                // Too large to assemble: fall back to the whole file
+            }
+        }
+    }
+
+    HttpResponse* response = response_alloc(status_code, content_type, file->size, keep_alive, validators);
+    if (!response) {
+        file_cache_release(file);
         return NULL;
     }
 
-    header_start += strlen(search_pattern);
+    response->file = file;
+    response->file_offset = 0;
+    response->file_length = file->size;
+    return response;
+}
+
+HttpResponse* http_build_binary_response(int status_code, const void* body,
+                                        size_t body_length, const char* content_type,
+                                        int keep_alive) {
+    void* copy = NULL;
+    if (body_length > 0) {
+        copy = arena_malloc(body_length);
+        if (!copy) return NULL;
+        memcpy(copy, body, body_length);
+    }
+
+    HttpResponse* response = http_response_create(status_code, copy, body_length, content_type, keep_alive);
+    if (!response) arena_free(copy);
+    return response;
+}
+
+HttpResponse* http_build_response(int status_code, const char* body, int keep_alive) {
+    return http_build_binary_response(status_code, body, strlen(body), "application/json", keep_alive);
+}
 
-    while (*header_start == ' ' || *header_start == '\t') {
-        header_start++;
+void http_response_free(HttpResponse* response) {
+    if (response) {
+        if (response->owns_body) {
+            free(response->body);
+        }
+        file_cache_release(response->file);
+        if (!response->in_arena) {
+            free(response);
+        }
     }
+}
+
+static const struct {
+    const char* name;
+    size_t length;
+    HttpHeaderId id;
+} known_headers[] = {
+    {"Host", 4, HTTP_HEADER_HOST},
+    {"Connection", 10, HTTP_HEADER_CONNECTION},
+    {"Content-Length", 14, HTTP_HEADER_CONTENT_LENGTH},
+    {"Content-Type", 12, HTTP_HEADER_CONTENT_TYPE},
+    {"Transfer-Encoding", 17, HTTP_HEADER_TRANSFER_ENCODING},
+    {"Expect", 6, HTTP_HEADER_EXPECT},
+    {"Upgrade", 7, HTTP_HEADER_UPGRADE},
+    {"Sec-WebSocket-Key", 17, HTTP_HEADER_SEC_WEBSOCKET_KEY},
+    {"Range", 5, HTTP_HEADER_RANGE},
+    {"If-None-Match", 13, HTTP_HEADER_IF_NONE_MATCH},
+    {"If-Modified-Since", 17, HTTP_HEADER_IF_MODIFIED_SINCE},
+    {"If-Range", 8, HTTP_HEADER_IF_RANGE},
+    {"Last-Event-ID", 13, HTTP_HEADER_LAST_EVENT_ID},
+    {"Cookie", 6, HTTP_HEADER_COOKIE},
+    {"Authorization", 13, HTTP_HEADER_AUTHORIZATION},
+};
 
-    const char* header_end = strstr(header_start, "\r\n");
-    if (!header_end) {
-        header_end = header_start + strlen(header_start);
+#define KNOWN_HEADER_COUNT (sizeof(known_headers) / sizeof(known_headers[0]))
+
+static int known_header_id(const char* name, size_t length) {
+    for (size_t i = 0; i < KNOWN_HEADER_COUNT; i++) {
+        if (known_headers[i].length == length && strncasecmp(known_headers[i].name, name, length) == 0) {
+            return known_headers[i].id;
+        }
     }
+    return -1;
+}
 
-    size_t len = header_end - header_start;
-    if (len >= sizeof(header_value)) {
-        len = sizeof(header_value) - 1;
+// First byte equal to a or b in [p, end), or end. 16 bytes per step with SSE2.
+static char* find_either(char* p, char* end, char a, char b) {
+#if defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
     }
-    strncpy(header_value, header_start, len);
-    header_value[len] = '\0';
+#endif
+    while (p < end && *p != a && *p != b) p++;
+    return p;
+}
+
+static HttpSpan make_span(const char* base, const char* start, const char* end) {
+    HttpSpan span = { (uint32_t)(start - base), (uint32_t)(end - start) };
+    return span;
+}
 
-    return header_value;
+void http_request_reset(HttpRequest* request) {
+    request->base = NULL;
+    request->method.length = 0;
+    request->path.length = 0;
+    request->query.length = 0;
+    request->version_minor = -1;
+    request->content_length = -1;
+    request->header_count = 0;
+    memset(request->known, 0, sizeof(request->known));
+    request->parse_offset = 0;
 }
 
-int http_get_content_length(const char* request) {
-    const char* content_length = http_get_header(request, "Content-Length");
-    if (content_length) {
-        return atoi(content_length);
+// "METHOD target[ HTTP/1.x]" -> NUL-terminated method, path and query
+static int parse_request_line(HttpRequest* request, char* line, char* end) {
+    char* base = request->base;
+
+    char* method_end = find_either(line, end, ' ', ' ');
+    if (method_end == line || method_end == end) return HTTP_PARSE_ERROR;
+
+    char* target = method_end + 1;
+    char* target_end = find_either(target, end, ' ', ' ');
+    if (target_end == target) return HTTP_PARSE_ERROR;
+
+    char* query_mark = find_either(target, target_end, '?', '?');
+    request->method = make_span(base, line, method_end);
+    request->path = make_span(base, target, query_mark);
+    if (query_mark < target_end) {
+        request->query = make_span(base, query_mark + 1, target_end);
+    } else {
+        request->query = make_span(base, target_end, target_end);
     }
+
+    if (target_end < end) {
+        const char* version = target_end + 1;
+        if (end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0 ||
+            version[7] < '0' || version[7] > '9') {
+            return HTTP_PARSE_ERROR;
+        }
+        request->version_minor = version[7] - '0';
+    }
+
+    *method_end = '\0';
+    *query_mark = '\0';
+    *target_end = '\0';
     return 0;
 }
 
-void http_get_content_type(const char* request, char* content_type, size_t max_len) {
-    const char* ct = http_get_header(request, "Content-Type");
-    if (ct) {
-        strncpy(content_type, ct, max_len - 1);
-        content_type[max_len - 1] = '\0';
-    } else {
-        content_type[0] = '\0';
+static int parse_header_line(HttpRequest* request, char* line, char* end) {
+    char* base = request->base;
+
+    char* colon = find_either(line, end, ':', ':');
+    if (colon == line || colon == end) return HTTP_PARSE_ERROR;
+    if (request->header_count >= HTTP_MAX_HEADERS) return HTTP_PARSE_TOO_MANY_HEADERS;
+
+    char* value = colon + 1;
+    while (value < end && (*value == ' ' || *value == '\t')) value++;
+    char* value_end = end;
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+
+    HttpHeaderSpan* header = &request->headers[request->header_count];
+    header->name = make_span(base, line, colon);
+    header->value = make_span(base, value, value_end);
+
+    int id = known_header_id(line, colon - line);
+    if (id == HTTP_HEADER_CONTENT_LENGTH) {
+        if (value == value_end) return HTTP_PARSE_ERROR;
+        long long content_length = 0;
+        for (const char* p = value; p < value_end; p++) {
+            if (*p < '0' || *p > '9' || content_length > (LLONG_MAX - 9) / 10) return HTTP_PARSE_ERROR;
+            content_length = content_length * 10 + (*p - '0');
+        }
+        // Conflicting duplicates are a request smuggling vector
+        if (request->content_length >= 0 && request->content_length != content_length) return HTTP_PARSE_ERROR;
+        request->content_length = content_length;
+    }
+    if (id >= 0 && !request->known[id]) {
+        request->known[id] = request->header_count + 1;
     }
+    request->header_count++;
+
+    *colon = '\0';
+    *value_end = '\0';
+    return 0;
 }
 
-const char* http_find_body(const char* request) {
-    const char* body_start = strstr(request, "\r\n\r\n");
-    if (body_start) {
-        return body_start + 4;
+// Parses complete lines from parse_offset onwards, so a head split across reads is only
+// scanned once per line. Returns the head length once the blank line is seen.
+int http_parse_request_head(HttpRequest* request, char* buffer, size_t length) {
+    request->base = buffer;
+    char* end = buffer + length;
+    char* line = buffer + request->parse_offset;
+
+    for (;;) {
+        char* newline = find_either(line, end, '\n', '\n');
+        if (newline == end) {
+            request->parse_offset = line - buffer;
+            return HTTP_PARSE_INCOMPLETE;
+        }
+
+        char* line_end = (newline > line && newline[-1] == '\r') ? newline - 1 : newline;
+        char* next = newline + 1;
+
+        if (line_end == line) {
+            if (request->method.length == 0) {
+                // Tolerate blank lines before the request line
+                line = next;
+                continue;
+            }
+            request->parse_offset = next - buffer;
+            return (int)(next - buffer);
+        }
+
+        int result = request->method.length == 0
+            ? parse_request_line(request, line, line_end)
+            : parse_header_line(request, line, line_end);
+        if (result != 0) return result;
+
+        line = next;
+    }
+}
+
+const char* http_request_method(const HttpRequest* request) {
+    return request->base + request->method.offset;
+}
+
+const char* http_request_path(const HttpRequest* request) {
+    return request->base + request->path.offset;
+}
+
+const char* http_request_query(const HttpRequest* request) {
+    return request->base + request->query.offset;
+}
+
+const char* http_request_header(const HttpRequest* request, HttpHeaderId id, size_t* length) {
+    int index = request->known[id];
+    if (!index) return NULL;
+    const HttpHeaderSpan* header = &request->headers[index - 1];
+    if (length) *length = header->value.length;
+    return request->base + header->value.offset;
+}
+
+const char* http_request_find_header(const HttpRequest* request, const char* name, size_t* length) {
+    size_t name_length = strlen(name);
+    int id = known_header_id(name, name_length);
+    if (id >= 0) {
+        return http_request_header(request, id, length);
+    }
+
+    for (int i = 0; i < request->header_count; i++) {
+        const HttpHeaderSpan* header = &request->headers[i];
+        if (header->name.length == name_length &&
+            strncasecmp(request->base + header->name.offset, name, name_length) == 0) {
+            if (length) *length = header->value.length;
+            return request->base + header->value.offset;
+        }
     }
     return NULL;
 }
 
+// HTTP/1.1 defaults to persistent connections, HTTP/1.0 (or no version) to close
+int http_request_keep_alive(const HttpRequest* request) {
+    int keep_alive = request->version_minor >= 1;
+
+    const char* connection = http_request_header(request, HTTP_HEADER_CONNECTION, NULL);
+    if (connection) {
+        if (strcasestr(connection, "close")) keep_alive = 0;
+        else if (strcasestr(connection, "keep-alive")) keep_alive = 1;
+    }
+    return keep_alive;
+}
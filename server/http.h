@@ -2,24 +2,119 @@
 #define HTTP_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define HTTP_OK 200
 #define HTTP_NOT_FOUND 404
 
+#define HTTP_MAX_HEADERS 64
+
+// http_parse_request_head() results (a positive value is the head length)
+#define HTTP_PARSE_INCOMPLETE 0
+#define HTTP_PARSE_ERROR -1
+#define HTTP_PARSE_TOO_MANY_HEADERS -2
+
+struct FileCacheEntry;
+
+// Status line and headers are kept apart from the body so both can go out in one
+// writev without copying the payload behind the headers
 typedef struct {
     int status_code;
-    char* body;
-    int body_length;
+    char* headers;          // Lives in the same allocation as the struct
+    size_t headers_length;
+    void* body;
+    size_t body_length;
+    int in_arena;           // Allocated from the connection's arena; freed by its reset
+    int owns_body;          // body is freed with the response (not arena or inline memory)
+
+    // Sent with sendfile() after the body; the response holds a cache reference
+    struct FileCacheEntry* file;
+    off_t file_offset;
+    size_t file_length;
 } HttpResponse;
 
-HttpResponse* http_build_response(int status_code, const char* body);
+// Headers the server or common handlers look up; their position is recorded while parsing
+typedef enum {
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_SEC_WEBSOCKET_KEY,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_LAST_EVENT_ID,
+    HTTP_HEADER_COOKIE,
+    HTTP_HEADER_AUTHORIZATION,
+    HTTP_HEADER_KNOWN_COUNT
+} HttpHeaderId;
+
+// Offsets into the request buffer, so the index survives the buffer moving
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} HttpSpan;
+
+typedef struct {
+    HttpSpan name;
+    HttpSpan value;
+} HttpHeaderSpan;
+
+// Parsed request head. The parser NUL-terminates the method, path, query, header
+// names and header values in place, so every span is also a C string at base + offset.
+typedef struct HttpRequest {
+    char* base;
+    HttpSpan method;
+    HttpSpan path;
+    HttpSpan query;
+    int version_minor;                         // HTTP/1.x minor version, -1 if the request line had none
+    long long content_length;                  // -1 if absent
+    HttpHeaderSpan headers[HTTP_MAX_HEADERS];
+    uint8_t header_count;
+    uint8_t known[HTTP_HEADER_KNOWN_COUNT];    // headers[] index + 1, 0 if absent
+    size_t parse_offset;                       // Start of the first line not parsed yet
+} HttpRequest;
+
+#define HTTP_MAX_STATUS 599
+
+const char* http_status_text(int status_code);
+// "Date: ...\r\n" for the current second, reformatted at most once a second per thread
+const char* http_date_header(size_t* length);
+// Writes value in decimal without a terminator and returns the digit count (at most 20)
+size_t http_format_uint(char* out, unsigned long long value);
+
+HttpResponse* http_build_response(int status_code, const char* body, int keep_alive);
 HttpResponse* http_build_binary_response(int status_code, const void* body,
-                                        size_t body_length, const char* content_type);
-void http_parse_request(const char* request, char* method, char* path);
+                                        size_t body_length, const char* content_type,
+                                        int keep_alive);
+// Takes ownership of body (malloc'd) instead of copying it
+HttpResponse* http_response_create(int status_code, void* body, size_t body_length,
+                                   const char* content_type, int keep_alive);
+// Serves file with sendfile(), answering conditional (If-None-Match, If-Modified-Since)
+// and Range requests when status_code is 200. Always consumes the caller's reference to file.
+HttpResponse* http_response_for_file(const struct HttpRequest* request, int status_code,
+                                     struct FileCacheEntry* file, const char* content_type,
+                                     int keep_alive);
+// {"error": message} with the body in the same allocation; a NULL message uses the status text
+HttpResponse* http_error_response(int status_code, const char* message, int keep_alive);
+// Same, with extra header lines (each ending in CRLF), e.g. Allow on a 405
+HttpResponse* http_error_response_with_headers(int status_code, const char* message, int keep_alive,
+                                               const char* extra_headers);
+void http_response_free(HttpResponse* response);
+
+void http_request_reset(HttpRequest* request);
+int http_parse_request_head(HttpRequest* request, char* buffer, size_t length);
 
-const char* http_get_header(const char* request, const char* header_name);
-int http_get_content_length(const char* request);
-void http_get_content_type(const char* request, char* content_type, size_t max_len);
-const char* http_find_body(const char* request);
+const char* http_request_method(const HttpRequest* request);
+const char* http_request_path(const HttpRequest* request);
+const char* http_request_query(const HttpRequest* request);
+const char* http_request_header(const HttpRequest* request, HttpHeaderId id, size_t* length);
+const char* http_request_find_header(const HttpRequest* request, const char* name, size_t* length);
+int http_request_keep_alive(const HttpRequest* request);
 
 #endif
@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include "multipart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// Copies the value of `key` from a header value like `form-data; name="a"; filename="b"`
+static void header_param(const char* value, const char* key, char* out, size_t out_size) {
+    size_t key_length = strlen(key);
+    const char* p = strchr(value, ';');
+
+    while (p) {
+        p++;
+        while (*p == ' ' || *p == '\t') p++;
+        if (strncasecmp(p, key, key_length) == 0 && p[key_length] == '=') {
+            p += key_length + 1;
+            size_t length = 0;
+            if (*p == '"') {
+                p++;
+                while (p[length] && p[length] != '"') length++;
+            } else {
+                while (p[length] && p[length] != ';' && p[length] != ' ') length++;
+            }
+            if (length >= out_size) length = out_size - 1;
+            memcpy(out, p, length);
+            out[length] = '\0';
+            return;
+        }
+        // Skip to the next parameter, stepping over quoted semicolons
+        int quoted = 0;
+        while (*p && (quoted || *p != ';')) {
+            if (*p == '"') quoted = !quoted;
+            p++;
+        }
+        p = *p ? p : NULL;
+    }
+}
+
+static void copy_value(const char* value, char* out, size_t out_size) {
+    size_t length = strlen(value);
+    if (length >= out_size) length = out_size - 1;
+    memcpy(out, value, length);
+    out[length] = '\0';
+}
+
+// Fills parser->part from the buffered header block, which ends in an empty line
+static void parse_part_headers(MultipartParser* parser) {
+    memset(&parser->part, 0, sizeof(parser->part));
+    parser->headers[parser->headers_length] = '\0';
+
+    char* line = parser->headers;
+    char* line_end;
+    while ((line_end = strstr(line, "\r\n")) != NULL && line_end != line) {
+        *line_end = '\0';
+        char* colon = strchr(line, ':');
+        if (colon) {
+            *colon = '\0';
+            char* value = colon + 1;
+            while (*value == ' ' || *value == '\t') value++;
+
+            if (strcasecmp(line, "Content-Disposition") == 0) {
+                header_param(value, "name", parser->part.name, sizeof(parser->part.name));
+                header_param(value, "filename", parser->part.filename, sizeof(parser->part.filename));
+            } else if (strcasecmp(line, "Content-Type") == 0) {
+                copy_value(value, parser->part.content_type, sizeof(parser->part.content_type));
+            }
+        }
+        line = line_end + 2;
+    }
+}
+
+static void emit_data(MultipartParser* parser, const char* data, size_t length) {
+    if (length == 0 || parser->state != MULTIPART_STATE_DATA || !parser->callbacks.on_part_data) return;
+    if (parser->callbacks.on_part_data(parser->user, &parser->part, data, length) != 0) {
+        parser->state = MULTIPART_STATE_ERROR;
+    }
+}
+
+static void delimiter_found(MultipartParser* parser) {
+    if (parser->state == MULTIPART_STATE_DATA && parser->callbacks.on_part_end &&
+        parser->callbacks.on_part_end(parser->user, &parser->part) != 0) {
+        parser->state = MULTIPART_STATE_ERROR;
+        return;
+    }
+    parser->state = MULTIPART_STATE_AFTER_BOUNDARY;
+}
+
+// Scans for the delimiter, passing everything before it on as part data (or dropping it in
+// the preamble). memchr finds candidate CRs; the boundary itself can never contain one, so a
+// failed partial match never hides the start of another. Returns bytes consumed.
+static size_t scan_data(MultipartParser* parser, const char* data, size_t length) {
+    const char* delimiter = parser->delimiter;
+    size_t delimiter_length = parser->delimiter_length;
+    size_t i = 0;
+
+    if (parser->match > 0) {
+        while (parser->match < delimiter_length && i < length && data[i] == delimiter[parser->match]) {
+            parser->match++;
+            i++;
+        }
+        if (parser->match == delimiter_length) {
+            parser->match = 0;
+            delimiter_found(parser);
+            return i;
+        }
+        if (i == length) return i;
+
+        size_t held = parser->match;
+        parser->match = 0;
+        emit_data(parser, delimiter, held);
+        if (parser->state == MULTIPART_STATE_ERROR) return i;
+    }
+
+    size_t start = i;
+    while (i < length) {
+        const char* cr = memchr(data + i, '\r', length - i);
+        if (!cr) break;
+
+        size_t position = cr - data;
+        size_t available = length - position;
+        size_t compare = available < delimiter_length ? available : delimiter_length;
+        if (memcmp(cr, delimiter, compare) == 0) {
+            emit_data(parser, data + start, position - start);
+            if (compare == delimiter_length) {
+                delimiter_found(parser);
+                return position + delimiter_length;
+            }
+            parser->match = compare;
+            return length;
+        }
+        i = position + 1;
+    }
+    emit_data(parser, data + start, length - start);
+    return length;
+}
+
+MultipartParser* multipart_parser_create(const char* content_type, const MultipartCallbacks* callbacks, void* user) {
+    if (!content_type) return NULL;
+
+    char boundary[MULTIPART_MAX_BOUNDARY + 2];
+    boundary[0] = '\0';
+    header_param(content_type, "boundary", boundary, sizeof(boundary));
+    size_t boundary_length = strlen(boundary);
+    if (boundary_length == 0 || boundary_length > MULTIPART_MAX_BOUNDARY) {
+        return NULL;
+    }
+
+    MultipartParser* parser = calloc(1, sizeof(MultipartParser));
+    if (!parser) return NULL;
+    if (callbacks) {
+        parser->callbacks = *callbacks;
+    }
+    parser->user = user;
+    parser->delimiter_length = snprintf(parser->delimiter, sizeof(parser->delimiter), "\r\n--%s", boundary);
+
+    // The first boundary has no CRLF before it, so start as if one was just seen
+    parser->state = MULTIPART_STATE_PREAMBLE;
+    parser->match = 2;
+    return parser;
+}
+
+int multipart_parser_feed(MultipartParser* parser, const char* data, size_t length) {
+    size_t i = 0;
+    while (i < length) {
+        switch (parser->state) {
+            case MULTIPART_STATE_PREAMBLE:
+            case MULTIPART_STATE_DATA:
+                i += scan_data(parser, data + i, length - i);
+                break;
+
+            case MULTIPART_STATE_AFTER_BOUNDARY:
+                // "--" closes the body, CRLF starts the next part; trailing whitespace is allowed
+                if (data[i] == '-') {
+                    parser->state = MULTIPART_STATE_AFTER_BOUNDARY_DASH;
+                } else if (data[i] == '\r') {
+                    parser->state = MULTIPART_STATE_AFTER_BOUNDARY_CR;
+                } else if (data[i] != ' ' && data[i] != '\t') {
+                    parser->state = MULTIPART_STATE_ERROR;
+                }
+                i++;
+                break;
+
+            case MULTIPART_STATE_AFTER_BOUNDARY_DASH:
+                parser->state = data[i++] == '-' ? MULTIPART_STATE_DONE : MULTIPART_STATE_ERROR;
+                break;
+
+            case MULTIPART_STATE_AFTER_BOUNDARY_CR:
+                parser->state = data[i++] == '\n' ? MULTIPART_STATE_HEADERS : MULTIPART_STATE_ERROR;
+                parser->headers_length = 0;
+                break;
+
+            case MULTIPART_STATE_HEADERS: {
+                if (parser->headers_length == sizeof(parser->headers) - 1) {
+                    parser->state = MULTIPART_STATE_ERROR;
+                    break;
+                }
+                parser->headers[parser->headers_length++] = data[i++];
+
+                size_t n = parser->headers_length;
+                if ((n == 2 && memcmp(parser->headers, "\r\n", 2) == 0) ||
+                    (n >= 4 && memcmp(parser->headers + n - 4, "\r\n\r\n", 4) == 0)) {
+                    parse_part_headers(parser);
+                    parser->state = MULTIPART_STATE_DATA;
+                    parser->match = 0;
+                    if (parser->callbacks.on_part_begin &&
+                        parser->callbacks.on_part_begin(parser->user, &parser->part) != 0) {
+                        parser->state = MULTIPART_STATE_ERROR;
+                    }
+                }
+                break;
+            }
+
+            case MULTIPART_STATE_DONE:
+                return 0; // The epilogue is ignored
+
+            case MULTIPART_STATE_ERROR:
+                return -1;
+        }
+    }
+    return parser->state == MULTIPART_STATE_ERROR ? -1 : 0;
+}
+
+int multipart_parser_finish(MultipartParser* parser) {
+    return parser->state == MULTIPART_STATE_DONE ? 0 : -1;
+}
+
+void multipart_parser_free(MultipartParser* parser) {
+    free(parser);
+}
+
+static int spool_part_begin(void* user, const MultipartPart* info) {
+    MultipartSpool* spool = user;
+    if (spool->part_count == spool->part_capacity) {
+        if (spool->part_capacity == MULTIPART_MAX_PARTS) return -1;
+        int capacity = spool->part_capacity ? spool->part_capacity * 2 : 4;
+        SpooledPart* parts = realloc(spool->parts, capacity * sizeof(SpooledPart));
+        if (!parts) return -1;
+        spool->parts = parts;
+        spool->part_capacity = capacity;
+    }
+
+    SpooledPart* part = &spool->parts[spool->part_count++];
+    memset(part, 0, sizeof(*part));
+    part->info = *info;
+
+    if (info->filename[0]) {
+        snprintf(part->path, sizeof(part->path), "%s/upload-XXXXXX", spool->directory);
+        spool->fd = mkostemp(part->path, O_CLOEXEC);
+        if (spool->fd == -1) {
+            perror("mkostemp");
+            part->path[0] = '\0';
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int spool_part_data(void* user, const MultipartPart* info, const char* data, size_t length) {
+    (void)info;
+    MultipartSpool* spool = user;
+    SpooledPart* part = &spool->parts[spool->part_count - 1];
+
+    if (spool->fd != -1) {
+        while (length > 0) {
+            ssize_t n = write(spool->fd, data, length);
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                perror("write");
+                return -1;
+            }
+            data += n;
+            length -= n;
+            part->size += n;
+        }
+        return 0;
+    }
+
+    if (part->size + length + 1 > spool->field_capacity) {
+        if (part->size + length > MULTIPART_MAX_FIELD_SIZE) return -1;
+        size_t capacity = spool->field_capacity ? spool->field_capacity : 256;
+        while (capacity < part->size + length + 1) capacity *= 2;
+        char* field = realloc(spool->field, capacity);
+        if (!field) return -1;
+        spool->field = field;
+        spool->field_capacity = capacity;
+    }
+    memcpy(spool->field + part->size, data, length);
+    part->size += length;
+    return 0;
+}
+
+static int spool_part_end(void* user, const MultipartPart* info) {
+    (void)info;
+    MultipartSpool* spool = user;
+    SpooledPart* part = &spool->parts[spool->part_count - 1];
+
+    if (spool->fd != -1) {
+        int fd = spool->fd;
+        spool->fd = -1;
+        if (part->size > 0) {
+            void* map = mmap(NULL, part->size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                perror("mmap");
+                close(fd);
+                return -1;
+            }
+            part->data = map;
+        }
+        close(fd);
+        return 0;
+    }
+
+    if (!spool->field) {
+        spool->field = malloc(1);
+        if (!spool->field) return -1;
+    }
+    spool->field[part->size] = '\0';
+    part->data = spool->field;
+    spool->field = NULL;
+    spool->field_capacity = 0;
+    return 0;
+}
+
+MultipartSpool* multipart_spool_create(const char* content_type, const char* directory) {
+    MultipartSpool* spool = calloc(1, sizeof(MultipartSpool));
+    if (!spool) return NULL;
+
+    MultipartCallbacks callbacks = {
+        .on_part_begin = spool_part_begin,
+        .on_part_data = spool_part_data,
+        .on_part_end = spool_part_end
+    };
+    spool->parser = multipart_parser_create(content_type, &callbacks, spool);
+    if (!spool->parser) {
+        free(spool);
+        return NULL;
+    }
+    snprintf(spool->directory, sizeof(spool->directory), "%s", directory ? directory : "/tmp");
+    spool->fd = -1;
+    return spool;
+}
+
+int multipart_spool_feed(MultipartSpool* spool, const char* data, size_t length) {
+    if (spool->failed) return -1;
+    if (multipart_parser_feed(spool->parser, data, length) != 0) {
+        spool->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int multipart_spool_finish(MultipartSpool* spool) {
+    return spool->failed ? -1 : multipart_parser_finish(spool->parser);
+}
+
+int multipart_spool_count(const MultipartSpool* spool) {
+    return spool->part_count;
+}
+
+const SpooledPart* multipart_spool_part(const MultipartSpool* spool, int index) {
+    if (index < 0 || index >= spool->part_count) return NULL;
+    return &spool->parts[index];
+}
+
+void multipart_spool_free(MultipartSpool* spool) {
+    if (!spool) return;
+
+    if (spool->fd != -1) {
+        close(spool->fd);
+    }
+    for (int i = 0; i < spool->part_count; i++) {
+        SpooledPart* part = &spool->parts[i];
+        if (part->path[0]) {
+            if (part->data) {
+                munmap((void*)part->data, part->size);
+            }
+            unlink(part->path);
+        } else {
+            free((char*)part->data);
+        }
+    }
+    free(spool->parts);
+    free(spool->field);
+    multipart_parser_free(spool->parser);
+    free(spool);
+}
@@ -0,0 +1,53 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include "server.h"
+#include <stddef.h>
+
+#define MULTIPART_MAX_BOUNDARY 70        // RFC 2046 limit
+#define MULTIPART_MAX_HEADERS 4096       // Header block of a single part
+#define MULTIPART_MAX_FIELD_SIZE (64 * 1024)  // Spooled form fields are kept in memory up to this size
+#define MULTIPART_MAX_PARTS 64
+
+typedef enum {
+    MULTIPART_STATE_PREAMBLE,
+    MULTIPART_STATE_AFTER_BOUNDARY,
+    MULTIPART_STATE_AFTER_BOUNDARY_DASH,
+    MULTIPART_STATE_AFTER_BOUNDARY_CR,
+    MULTIPART_STATE_HEADERS,
+    MULTIPART_STATE_DATA,
+    MULTIPART_STATE_DONE,
+    MULTIPART_STATE_ERROR
+} MultipartState;
+
+struct MultipartParser {
+    MultipartState state;
+    MultipartCallbacks callbacks;
+    void* user;
+
+    // "\r\n--boundary". Bytes that may start a delimiter at the end of one feed are held
+    // back as `match`; they are always a prefix of the delimiter, so nothing is copied.
+    char delimiter[MULTIPART_MAX_BOUNDARY + 5];
+    size_t delimiter_length;
+    size_t match;
+
+    char headers[MULTIPART_MAX_HEADERS];
+    size_t headers_length;
+    MultipartPart part;
+};
+
+struct MultipartSpool {
+    MultipartParser* parser;
+    char directory[200];
+    SpooledPart* parts;
+    int part_count;
+    int part_capacity;
+
+    // The part being written: file parts go to fd, fields to the field buffer
+    int fd;
+    char* field;
+    size_t field_capacity;
+    int failed;
+};
+
+#endif
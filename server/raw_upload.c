@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include "raw_upload.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        crc_table[i] = crc;
+    }
+}
+
+static void crc_update(RawUpload* upload, const unsigned char* data, size_t length) {
+    uint32_t crc = upload->crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    upload->crc = crc;
+}
+
+// Checksums bytes spliced into the file at offset while they are still in the page cache,
+// so the finished upload never has to be read back as a whole
+static int crc_update_from_file(RawUpload* upload, off_t offset, size_t length) {
+    unsigned char buffer[16 * 1024];
+    while (length > 0) {
+        ssize_t n = pread(upload->fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer), offset);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        crc_update(upload, buffer, n);
+        offset += n;
+        length -= n;
+    }
+    return 0;
+}
+
+int raw_upload_open(RawUpload* upload, const char* directory, int flags) {
+    memset(upload, 0, sizeof(*upload));
+    upload->flags = flags;
+    if (flags & RAW_UPLOAD_CRC32) {
+        pthread_once(&crc_table_once, crc_table_init);
+        upload->crc = 0xFFFFFFFFu;
+    }
+    snprintf(upload->path, sizeof(upload->path), "%s/upload-XXXXXX", directory ? directory : "/tmp");
+
+    upload->fd = mkostemp(upload->path, O_CLOEXEC);
+    if (upload->fd == -1) {
+        perror("mkostemp");
+        return -1;
+    }
+    return 0;
+}
+
+static int open_pipe(int pipe_fds[2]) {
+    if (pipe_fds[0] != -1) return 0;
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        perror("pipe2");
+        pipe_fds[0] = pipe_fds[1] = -1;
+        return -1;
+    }
+    // A bigger pipe means fewer splice() round trips per upload
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, RAW_UPLOAD_PIPE_SIZE);
+    return 0;
+}
+
+void raw_upload_close_pipe(int pipe_fds[2]) {
+    if (pipe_fds[0] != -1) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        pipe_fds[0] = pipe_fds[1] = -1;
+    }
+}
+
+ssize_t raw_upload_splice(RawUpload* upload, int socket_fd, int pipe_fds[2], size_t max) {
+    if (open_pipe(pipe_fds) != 0) return RAW_UPLOAD_UNSUPPORTED;
+
+    size_t moved = 0;
+    while (moved < max) {
+        size_t want = max - moved < RAW_UPLOAD_PIPE_SIZE ? max - moved : RAW_UPLOAD_PIPE_SIZE;
+        ssize_t in = splice(socket_fd, NULL, pipe_fds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in == 0) return RAW_UPLOAD_CLOSED;
+        if (in == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINVAL || errno == ENOSYS) return RAW_UPLOAD_UNSUPPORTED;
+            return RAW_UPLOAD_CLOSED;
+        }
+
+        // Drain the pipe completely so it is empty for the next caller
+        off_t start = upload->size;
+        size_t length = in;
+        while (in > 0) {
+            ssize_t out = splice(pipe_fds[0], NULL, upload->fd, NULL, in, SPLICE_F_MOVE);
+            if (out == -1 && errno == EINTR) continue;
+            if (out <= 0) {
+                perror("splice");
+                raw_upload_close_pipe(pipe_fds);
+                return RAW_UPLOAD_FILE_ERROR;
+            }
+            in -= out;
+            moved += out;
+            upload->size += out;
+        }
+        if ((upload->flags & RAW_UPLOAD_CRC32) && crc_update_from_file(upload, start, length) != 0) {
+            perror("pread");
+            return RAW_UPLOAD_FILE_ERROR;
+        }
+    }
+    return moved;
+}
+
+int raw_upload_write(RawUpload* upload, const char* data, size_t length) {
+    if (upload->flags & RAW_UPLOAD_CRC32) {
+        crc_update(upload, (const unsigned char*)data, length);
+    }
+    while (length > 0) {
+        ssize_t n = write(upload->fd, data, length);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("write");
+            return -1;
+        }
+        data += n;
+        length -= n;
+        upload->size += n;
+    }
+    return 0;
+}
+
+int raw_upload_finish(RawUpload* upload, StoredBody* body) {
+    body->path = upload->path;
+    body->size = upload->size;
+    body->crc32 = (upload->flags & RAW_UPLOAD_CRC32) ? upload->crc ^ 0xFFFFFFFFu : 0;
+    return 0;
+}
+
+void raw_upload_discard(RawUpload* upload) {
+    if (upload->fd == -1) return;
+
+    // The name may have been renamed away and reused by another upload since
+    struct stat file_stat, path_stat;
+    if (fstat(upload->fd, &file_stat) == 0 && stat(upload->path, &path_stat) == 0 &&
+        file_stat.st_dev == path_stat.st_dev && file_stat.st_ino == path_stat.st_ino) {
+        unlink(upload->path);
+    }
+    close(upload->fd);
+    upload->fd = -1;
+}
@@ -0,0 +1,42 @@
+#ifndef RAW_UPLOAD_H
+#define RAW_UPLOAD_H
+
+#include "server.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RAW_UPLOAD_PIPE_SIZE (1024 * 1024)  // Requested with F_SETPIPE_SZ; the kernel may give less
+
+// raw_upload_splice() results besides the byte count
+#define RAW_UPLOAD_CLOSED -1       // The client went away
+#define RAW_UPLOAD_FILE_ERROR -2   // Writing the file failed (e.g. disk full)
+#define RAW_UPLOAD_UNSUPPORTED -3  // splice() does not work here; use raw_upload_write()
+
+typedef struct {
+    int fd;
+    char path[256];
+    size_t size;
+    int flags;
+    uint32_t crc;  // Running CRC-32 of what has been written so far, with RAW_UPLOAD_CRC32
+} RawUpload;
+
+// Creates the temp file in directory (NULL = /tmp). Returns 0 on success.
+int raw_upload_open(RawUpload* upload, const char* directory, int flags);
+
+// Moves up to max bytes from socket_fd into the file through pipe_fds (opened on first use).
+// Returns the bytes moved, 0 if the socket had nothing to read, or a RAW_UPLOAD_* error.
+ssize_t raw_upload_splice(RawUpload* upload, int socket_fd, int pipe_fds[2], size_t max);
+
+// Appends bytes that were already read into user space
+int raw_upload_write(RawUpload* upload, const char* data, size_t length);
+
+// Fills body. The file stays until raw_upload_discard().
+int raw_upload_finish(RawUpload* upload, StoredBody* body);
+
+// Closes the file and deletes it unless the handler renamed it away
+void raw_upload_discard(RawUpload* upload);
+
+void raw_upload_close_pipe(int pipe_fds[2]);
+
+#endif
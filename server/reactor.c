@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include "reactor.h"
+#include "sse.h"
+#include "raw_upload.h"
+#include "admission.h"
+#include "worker_pool.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Sent to connections refused at accept time, without reading their request
+static const char SHED_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 24\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "{\"error\": \"Server busy\"}";
+
+// True while requests queue longer than shed_latency_ms, either behind this reactor's
+// last batch of events or behind the worker pool
+static int reactor_overloaded(Reactor* reactor) {
+    int limit = reactor->config->shed_latency_ms;
+    if (limit <= 0) return 0;
+    return reactor->busy_ms > (uint64_t)limit ||
+           (reactor->workers && worker_pool_queue_delay(reactor->workers) > (uint64_t)limit);
+}
+
+static void on_accept(EventLoop* loop, EventHandler* handler, uint32_t events) {
+    (void)loop;
+    (void)events;
+    Reactor* reactor = (Reactor*)((char*)handler - offsetof(Reactor, listen_handler));
+
+    for (;;) {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int client_fd = accept4(reactor->listen_fd, (struct sockaddr*)&client_addr,
+                                &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return;
+        }
+
+        // Best effort: the socket buffer of a fresh connection always has room for it
+        in_addr_t addr = client_addr.sin_addr.s_addr;
+        if (reactor_overloaded(reactor) || admission_acquire(addr) != ADMIT_OK) {
+            send(client_fd, SHED_RESPONSE, sizeof(SHED_RESPONSE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(client_fd);
+            continue;
+        }
+
+        Connection* conn = connection_create(reactor, client_fd);
+        if (!conn) {
+            admission_release(addr);
+            close(client_fd);
+            continue;
+        }
+        conn->peer_addr = addr;
+    }
+}
+
+// Measures the last batch of events and sends SSE heartbeats. Connection timeouts live on
+// the loop's timer wheel.
+static int reactor_prepare(EventLoop* loop) {
+    Reactor* reactor = (Reactor*)loop;
+    uint64_t now = event_loop_clock_ms();
+    reactor->busy_ms = now - loop->now_ms;
+    return sse_heartbeat(reactor, now);
+}
+
+int reactor_init(Reactor* reactor, int listen_fd, const ServerConfig* config) {
+    memset(reactor, 0, sizeof(*reactor));
+    reactor->listen_fd = listen_fd;
+    reactor->config = config;
+    reactor->splice_pipe[0] = -1;
+    reactor->splice_pipe[1] = -1;
+    buffer_pool_init(&reactor->buffer_pool, config->max_request_head_size);
+
+    if (event_loop_init(&reactor->loop) != 0) {
+        return -1;
+    }
+    reactor->loop.prepare = reactor_prepare;
+
+    // Level-triggered so a transient accept error (e.g. EMFILE) is retried
+    reactor->listen_handler.on_event = on_accept;
+    if (event_loop_add(&reactor->loop, listen_fd, EPOLLIN, &reactor->listen_handler) != 0) {
+        event_loop_destroy(&reactor->loop);
+        return -1;
+    }
+
+    return 0;
+}
+
+int reactor_run(Reactor* reactor) {
+    return event_loop_run(&reactor->loop);
+}
+
+void reactor_stop(Reactor* reactor) {
+    event_loop_stop(&reactor->loop);
+}
+
+void reactor_close_streams(Reactor* reactor) {
+    Connection* conn = reactor->connections;
+    while (conn) {
+        Connection* next = conn->next;
+        if (conn->state == CONN_STATE_STREAMING) {
+            connection_close(conn);
+        }
+        conn = next;
+    }
+}
+
+void reactor_destroy(Reactor* reactor) {
+    while (reactor->connections) {
+        connection_close(reactor->connections);
+    }
+    if (reactor->listen_fd >= 0) {
+        close(reactor->listen_fd);
+        reactor->listen_fd = -1;
+    }
+    raw_upload_close_pipe(reactor->splice_pipe);
+    // Posted tasks may still hand buffers back (connections freed after their worker job)
+    event_loop_destroy(&reactor->loop);
+    buffer_pool_destroy(&reactor->buffer_pool);
+}
+
+void reactor_add_connection(Reactor* reactor, Connection* conn) {
+    conn->prev = NULL;
+    conn->next = reactor->connections;
+    if (reactor->connections) {
+        reactor->connections->prev = conn;
+    }
+    reactor->connections = conn;
+    reactor->connection_count++;
+}
+
+void reactor_remove_connection(Reactor* reactor, Connection* conn) {
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        reactor->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    conn->prev = NULL;
+    conn->next = NULL;
+    reactor->connection_count--;
+}
@@ -0,0 +1,49 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "event_loop.h"
+#include "connection.h"
+#include "server.h"
+#include "buffer_pool.h"
+
+// One event loop owning a listening socket and every connection it accepts
+typedef struct Reactor {
+    EventLoop loop;
+    EventHandler listen_handler;
+    int listen_fd;
+    const ServerConfig* config;
+
+    // Connection read buffers
+    BufferPool buffer_pool;
+
+    Connection* connections;
+    int connection_count;
+
+    // Server-Sent Events subscribers on this reactor, for heartbeats
+    struct SseSubscriber* sse_subscribers;
+    uint64_t next_heartbeat_ms;
+
+    // Pipe for splicing raw uploads to disk, opened on first use. It is always empty between
+    // calls, so every upload on the reactor shares it.
+    int splice_pipe[2];
+
+    // Time spent handling the last batch of events: how long a newly ready socket waited
+    uint64_t busy_ms;
+
+    // Shared by every reactor for HANDLER_BLOCKING / HANDLER_CPU_HEAVY endpoints and stream
+    // handlers (may be NULL)
+    struct WorkerPool* workers;
+} Reactor;
+
+int reactor_init(Reactor* reactor, int listen_fd, const ServerConfig* config);
+int reactor_run(Reactor* reactor);
+void reactor_stop(Reactor* reactor);
+// After the loop has stopped: closes streaming responses, whose handlers would otherwise
+// wait forever for the loop to drain their output
+void reactor_close_streams(Reactor* reactor);
+void reactor_destroy(Reactor* reactor);
+
+void reactor_add_connection(Reactor* reactor, Connection* conn);
+void reactor_remove_connection(Reactor* reactor, Connection* conn);
+
+#endif
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include "response_writer.h"
+#include "connection.h"
+#include "reactor.h"
+#include "endpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+static void writer_release(ResponseWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    int destroy = --writer->refcount == 0;
+    pthread_mutex_unlock(&writer->lock);
+
+    if (destroy) {
+        pthread_cond_destroy(&writer->drained);
+        pthread_mutex_destroy(&writer->lock);
+        free(writer->pending);
+        free(writer->sending);
+        free(writer->head);
+        free(writer->body);
+        endpoint_context_release(&writer->context);
+        free(writer);
+    }
+}
+
+static void writer_task(EventLoop* loop, EventTask* task) {
+    (void)loop;
+    ResponseWriter* writer = (ResponseWriter*)task;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->task_posted = 0;
+    struct Connection* conn = writer->conn;
+    pthread_mutex_unlock(&writer->lock);
+
+    if (conn) {
+        connection_stream_resume(conn);
+    }
+    writer_release(writer);
+}
+
+// Caller holds writer->lock
+static void writer_notify(ResponseWriter* writer) {
+    if (writer->conn && !writer->task_posted) {
+        writer->task_posted = 1;
+        writer->refcount++;
+        event_loop_post(writer->loop, &writer->task);
+    }
+}
+
+// Caller holds writer->lock
+static int writer_append(ResponseWriter* writer, const void* data, size_t length) {
+    if (writer->pending_length + length > writer->pending_capacity) {
+        size_t capacity = writer->pending_capacity ? writer->pending_capacity : 4096;
+        while (capacity < writer->pending_length + length) capacity *= 2;
+        char* pending = realloc(writer->pending, capacity);
+        if (!pending) return -1;
+        writer->pending = pending;
+        writer->pending_capacity = capacity;
+    }
+    memcpy(writer->pending + writer->pending_length, data, length);
+    writer->pending_length += length;
+    return 0;
+}
+
+// Caller holds writer->lock
+static int writer_append_head(ResponseWriter* writer) {
+    if (writer->headers_sent) return 0;
+    writer->headers_sent = 1;
+
+    size_t date_length;
+    const char* date = http_date_header(&date_length);
+    char head[384];
+    int length = snprintf(head, sizeof(head),
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: %s\r\n"
+        "%s"
+        "%.*s"
+        "Connection: %s\r\n"
+        "\r\n",
+        writer->status_code, http_status_text(writer->status_code), writer->content_type,
+        writer->chunked ? "Transfer-Encoding: chunked\r\n" : "",
+        (int)date_length, date,
+        writer->keep_alive ? "keep-alive" : "close");
+    return writer_append(writer, head, length);
+}
+
+// Ends the stream with the terminating chunk, or as failed if the handler never ran
+static void stream_finish(ResponseWriter* writer, int cancelled) {
+    pthread_mutex_lock(&writer->lock);
+    if (cancelled) {
+        writer->failed = 1;
+    } else if (!writer->failed) {
+        if (writer_append_head(writer) != 0 ||
+            (writer->chunked && writer_append(writer, "0\r\n\r\n", 5) != 0)) {
+            writer->failed = 1;
+        }
+    }
+    writer->finished = 1;
+    writer_notify(writer);
+    pthread_mutex_unlock(&writer->lock);
+
+    writer_release(writer);
+}
+
+static void stream_job_run(WorkerJob* work) {
+    ResponseWriter* writer = (ResponseWriter*)((char*)work - offsetof(ResponseWriter, work));
+    writer->handler(&writer->context, writer);
+    stream_finish(writer, 0);
+}
+
+// Queued at shutdown: the client is closed without a response
+static void stream_job_cancel(WorkerJob* work) {
+    stream_finish((ResponseWriter*)((char*)work - offsetof(ResponseWriter, work)), 1);
+}
+
+ResponseWriter* response_writer_start(struct Connection* conn, StreamHandler handler, const RequestContext* context,
+                                      WorkerPool* workers, int* busy) {
+    *busy = 0;
+    if (!workers) {
+        // Handlers block on slow clients, so they never run on the event loop
+        *busy = 1;
+        return NULL;
+    }
+
+    ResponseWriter* writer = calloc(1, sizeof(ResponseWriter));
+    if (!writer) return NULL;
+
+    // The handler outlives nothing it borrows: take the body and copy the request head
+    writer->head = malloc(conn->body_offset);
+    if (!writer->head) {
+        free(writer);
+        return NULL;
+    }
+    memcpy(writer->head, conn->buffer, conn->body_offset);
+    writer->request = conn->request;
+    writer->request.base = writer->head;
+    if (conn->body && arena_owns(&conn->arena, conn->body)) {
+        // Arena memory is reused by the connection's next request
+        writer->body = malloc(conn->body_length + 1);
+        if (!writer->body) {
+            free(writer->head);
+            free(writer);
+            return NULL;
+        }
+        memcpy(writer->body, conn->body, conn->body_length + 1);
+    } else {
+        writer->body = conn->body;
+        conn->body = NULL;
+    }
+
+    writer->context = *context;
+    writer->context.http = &writer->request;
+    writer->context.body = writer->body;
+    endpoint_context_rebase(&writer->context, conn->buffer, conn->body_offset, writer->head);
+    if (endpoint_context_detach(&writer->context) != 0) {
+        free(writer->body);
+        free(writer->head);
+        free(writer);
+        return NULL;
+    }
+
+    writer->task.run = writer_task;
+    writer->work.run = stream_job_run;
+    writer->work.cancel = stream_job_cancel;
+    writer->loop = &conn->reactor->loop;
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->drained, NULL);
+    writer->refcount = 2;  // Connection and worker job
+    writer->conn = conn;
+    writer->handler = handler;
+    writer->status_code = 200;
+    strcpy(writer->content_type, "text/plain; charset=utf-8");
+    writer->chunked = conn->request.version_minor >= 1;
+    writer->keep_alive = conn->keep_alive && writer->chunked;
+
+    if (worker_pool_submit(workers, &writer->work) != 0) {
+        *busy = 1;
+        writer->refcount = 1;
+        writer->conn = NULL;
+        writer_release(writer);
+        return NULL;
+    }
+    conn->keep_alive = writer->keep_alive;
+    return writer;
+}
+
+int response_writer_flush(ResponseWriter* writer, int fd) {
+    for (;;) {
+        while (writer->sending_offset < writer->sending_length) {
+            ssize_t n = send(fd, writer->sending + writer->sending_offset,
+                             writer->sending_length - writer->sending_offset, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                return -1;
+            }
+            writer->sending_offset += n;
+        }
+        writer->sending_length = 0;
+        writer->sending_offset = 0;
+
+        pthread_mutex_lock(&writer->lock);
+        if (writer->pending_length > 0) {
+            // Swap buffers so neither side copies or allocates per chunk
+            char* buffer = writer->sending;
+            size_t capacity = writer->sending_capacity;
+            writer->sending = writer->pending;
+            writer->sending_capacity = writer->pending_capacity;
+            writer->sending_length = writer->pending_length;
+            writer->pending = buffer;
+            writer->pending_capacity = capacity;
+            writer->pending_length = 0;
+            pthread_cond_broadcast(&writer->drained);
+            pthread_mutex_unlock(&writer->lock);
+            continue;
+        }
+        int result = writer->failed ? -1 : writer->finished;
+        pthread_mutex_unlock(&writer->lock);
+        return result;
+    }
+}
+
+void response_writer_detach(ResponseWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->conn = NULL;
+    writer->failed = 1;
+    pthread_cond_broadcast(&writer->drained);
+    pthread_mutex_unlock(&writer->lock);
+
+    writer_release(writer);
+}
+
+int response_writer_begin(ResponseWriter* writer, int status_code, const char* content_type) {
+    pthread_mutex_lock(&writer->lock);
+    int result = writer->headers_sent ? -1 : 0;
+    if (result == 0) {
+        writer->status_code = status_code;
+        if (content_type) {
+            strncpy(writer->content_type, content_type, sizeof(writer->content_type) - 1);
+            writer->content_type[sizeof(writer->content_type) - 1] = '\0';
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return result;
+}
+
+int response_writer_write(ResponseWriter* writer, const void* data, size_t length) {
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->failed && writer->pending_length >= RESPONSE_WRITER_HIGH_WATER) {
+        pthread_cond_wait(&writer->drained, &writer->lock);
+    }
+
+    int result = writer->failed ? -1 : writer_append_head(writer);
+    if (result == 0 && length > 0) {
+        if (writer->chunked) {
+            char size_line[24];
+            int size_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", length);
+            result = writer_append(writer, size_line, size_length);
+            if (result == 0) result = writer_append(writer, data, length);
+            if (result == 0) result = writer_append(writer, "\r\n", 2);
+        } else {
+            result = writer_append(writer, data, length);
+        }
+    }
+    if (result == 0) {
+        writer_notify(writer);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return result;
+}
+
+int response_writer_print(ResponseWriter* writer, const char* text) {
+    return response_writer_write(writer, text, strlen(text));
+}
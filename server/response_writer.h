@@ -0,0 +1,67 @@
+#ifndef RESPONSE_WRITER_H
+#define RESPONSE_WRITER_H
+
+#include "server.h"
+#include "http.h"
+#include "event_loop.h"
+#include "worker_pool.h"
+#include <pthread.h>
+
+#define RESPONSE_WRITER_HIGH_WATER (64 * 1024)  // Pending bytes before response_writer_write() blocks
+
+struct Connection;
+
+// Shared between the handler, which runs on a worker thread and appends chunk-framed output
+// to `pending`, and the reactor, which swaps `pending` for the drained `sending` buffer and
+// writes it. The handler blocks once `pending` reaches the high-water mark, so a slow client
+// holds back the producer instead of growing the buffer.
+struct ResponseWriter {
+    EventTask task;  // Posted to the reactor when new output is pending
+    WorkerJob work;  // Runs the handler
+    EventLoop* loop;
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+    int refcount;
+
+    struct Connection* conn;  // NULL once the connection has gone away
+    int task_posted;
+    int failed;
+    int finished;
+
+    int status_code;
+    char content_type[128];
+    int headers_sent;
+    int chunked;      // HTTP/1.0 clients get the raw body delimited by close
+    int keep_alive;
+
+    char* pending;
+    size_t pending_length;
+    size_t pending_capacity;
+
+    // Reactor thread only
+    char* sending;
+    size_t sending_length;
+    size_t sending_capacity;
+    size_t sending_offset;
+
+    // The handler's copy of the request, independent of the connection buffer
+    StreamHandler handler;
+    RequestContext context;
+    HttpRequest request;
+    char* head;
+    char* body;
+};
+
+// Copies the request out of conn and submits handler to workers. Returns NULL if the writer
+// could not be set up, and sets *busy if that is because the pool (or its absence) refused the job.
+ResponseWriter* response_writer_start(struct Connection* conn, StreamHandler handler, const RequestContext* context,
+                                      WorkerPool* workers, int* busy);
+
+// Reactor side: writes pending output to fd. Returns 1 once the stream is complete,
+// 0 while waiting for the socket or the handler, -1 on error.
+int response_writer_flush(ResponseWriter* writer, int fd);
+
+// Called when the connection closes; later writes fail and the writer is freed once the handler returns
+void response_writer_detach(ResponseWriter* writer);
+
+#endif
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include "router.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct RouteNode {
+    char* prefix;  // Literal text this node consumes ("" for ":" and "*" nodes)
+    size_t prefix_length;
+    RouteNode** children;  // Literal children; no two share a first byte
+    int child_count;
+    RouteNode* param;     // ":name" child
+    RouteNode* wildcard;  // "*name" child (always a leaf)
+    char* name;           // Capture name of a ":" or "*" node
+    void* values[ROUTER_MAX_METHODS];
+    int has_value;
+};
+
+static RouteNode* node_create(const char* prefix, size_t length) {
+    RouteNode* node = calloc(1, sizeof(RouteNode));
+    if (!node) return NULL;
+    node->prefix = strndup(prefix, length);
+    if (!node->prefix) {
+        free(node);
+        return NULL;
+    }
+    node->prefix_length = length;
+    return node;
+}
+
+static int add_child(RouteNode* node, RouteNode* child) {
+    RouteNode** children = realloc(node->children, (node->child_count + 1) * sizeof(RouteNode*));
+    if (!children) return -1;
+    children[node->child_count++] = child;
+    node->children = children;
+    return 0;
+}
+
+// Cuts node's prefix after length bytes; everything below it moves to a new child holding
+// the rest of the prefix. node keeps its place in the parent's children.
+static int split_node(RouteNode* node, size_t length) {
+    RouteNode** children = malloc(sizeof(RouteNode*));
+    RouteNode* tail = node_create(node->prefix + length, node->prefix_length - length);
+    if (!children || !tail) {
+        free(children);
+        free(tail);
+        return -1;
+    }
+
+    tail->children = node->children;
+    tail->child_count = node->child_count;
+    tail->param = node->param;
+    tail->wildcard = node->wildcard;
+    memcpy(tail->values, node->values, sizeof(node->values));
+    tail->has_value = node->has_value;
+
+    children[0] = tail;
+    node->children = children;
+    node->child_count = 1;
+    node->param = NULL;
+    node->wildcard = NULL;
+    memset(node->values, 0, sizeof(node->values));
+    node->has_value = 0;
+    node->prefix[length] = '\0';
+    node->prefix_length = length;
+    return 0;
+}
+
+// Literal text up to the next segment starting with ':' or '*'
+static size_t literal_length(const char* pattern) {
+    size_t length = 0;
+    while (pattern[length] &&
+           !(length > 0 && pattern[length - 1] == '/' && (pattern[length] == ':' || pattern[length] == '*'))) {
+        length++;
+    }
+    return length;
+}
+
+int router_insert(Router* router, const char* pattern, int method, void* value) {
+    if (!pattern || pattern[0] != '/' || method < 0 || method >= ROUTER_MAX_METHODS) {
+        fprintf(stderr, "Error: Invalid route %s\n", pattern ? pattern : "(null)");
+        return -1;
+    }
+    if (!router->root) {
+        router->root = node_create("", 0);
+        if (!router->root) return -1;
+    }
+
+    RouteNode* node = router->root;
+    const char* rest = pattern;
+    int param_count = 0;
+    while (*rest) {
+        if (*rest == ':' || *rest == '*') {
+            int is_wildcard = *rest == '*';
+            const char* name = rest + 1;
+            size_t name_length = strcspn(name, "/");
+            rest = name + name_length;
+            if ((is_wildcard && *rest) || (!is_wildcard && name_length == 0) ||
+                ++param_count > ROUTER_MAX_PARAMS) {
+                fprintf(stderr, "Error: Invalid route %s\n", pattern);
+                return -1;
+            }
+            if (is_wildcard && name_length == 0) {
+                name = "*";
+                name_length = 1;
+            }
+
+            RouteNode** slot = is_wildcard ? &node->wildcard : &node->param;
+            if (!*slot) {
+                *slot = node_create("", 0);
+                if (!*slot) return -1;
+                (*slot)->name = strndup(name, name_length);
+                if (!(*slot)->name) return -1;
+            } else if (strlen((*slot)->name) != name_length || strncmp((*slot)->name, name, name_length) != 0) {
+                fprintf(stderr, "Error: Route %s conflicts with parameter %s\n", pattern, (*slot)->name);
+                return -1;
+            }
+            node = *slot;
+            continue;
+        }
+
+        size_t length = literal_length(rest);
+        RouteNode* child = NULL;
+        for (int i = 0; i < node->child_count; i++) {
+            if (node->children[i]->prefix[0] == *rest) {
+                child = node->children[i];
+                break;
+            }
+        }
+        if (!child) {
+            child = node_create(rest, length);
+            if (!child) return -1;
+            if (add_child(node, child) != 0) {
+                free(child->prefix);
+                free(child);
+                return -1;
+            }
+            node = child;
+            rest += length;
+            continue;
+        }
+
+        size_t common = 0;
+        while (common < length && common < child->prefix_length && child->prefix[common] == rest[common]) {
+            common++;
+        }
+        if (common < child->prefix_length && split_node(child, common) != 0) return -1;
+        node = child;
+        rest += common;
+    }
+
+    if (node->values[method]) {
+        fprintf(stderr, "Error: Route %s is already registered\n", pattern);
+        return -1;
+    }
+    node->values[method] = value;
+    node->has_value = 1;
+    return 0;
+}
+
+static void capture(RouteMatch* match, const RouteNode* node, const char* value, size_t length) {
+    RouteParam* param = &match->params[match->param_count++];
+    param->name = node->name;
+    param->value = value;
+    param->length = length;
+}
+
+// Tries literal children, then the ":" child, then the "*" child, backing out of a branch
+// (and its captures) if nothing below it matches
+static const RouteNode* match_node(const RouteNode* node, const char* path, RouteMatch* match) {
+    if (*path == '\0') {
+        if (node->has_value) return node;
+        if (node->wildcard && node->wildcard->has_value) {
+            capture(match, node->wildcard, path, 0);
+            return node->wildcard;
+        }
+        return NULL;
+    }
+
+    for (int i = 0; i < node->child_count; i++) {
+        const RouteNode* child = node->children[i];
+        if (child->prefix[0] == *path) {
+            if (strncmp(path, child->prefix, child->prefix_length) == 0) {
+                const RouteNode* found = match_node(child, path + child->prefix_length, match);
+                if (found) return found;
+            }
+            break;
+        }
+    }
+
+    if (node->param) {
+        size_t length = strcspn(path, "/");
+        if (length > 0) {
+            int saved = match->param_count;
+            capture(match, node->param, path, length);
+            const RouteNode* found = match_node(node->param, path + length, match);
+            if (found) return found;
+            match->param_count = saved;
+        }
+    }
+
+    if (node->wildcard && node->wildcard->has_value) {
+        capture(match, node->wildcard, path, strlen(path));
+        return node->wildcard;
+    }
+    return NULL;
+}
+
+int router_lookup(const Router* router, const char* path, RouteMatch* match) {
+    match->values = NULL;
+    match->param_count = 0;
+    if (!router->root || !path) return 0;
+
+    const RouteNode* node = match_node(router->root, path, match);
+    if (!node) return 0;
+    match->values = node->values;
+    return 1;
+}
+
+static void node_free(RouteNode* node, void (*free_value)(void* value)) {
+    if (!node) return;
+    for (int i = 0; i < node->child_count; i++) {
+        node_free(node->children[i], free_value);
+    }
+    node_free(node->param, free_value);
+    node_free(node->wildcard, free_value);
+    if (free_value) {
+        for (int i = 0; i < ROUTER_MAX_METHODS; i++) {
+            if (node->values[i]) free_value(node->values[i]);
+        }
+    }
+    free(node->children);
+    free(node->prefix);
+    free(node->name);
+    free(node);
+}
+
+void router_free(Router* router, void (*free_value)(void* value)) {
+    node_free(router->root, free_value);
+    router->root = NULL;
+}
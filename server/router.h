@@ -0,0 +1,46 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "server.h"
+#include <stddef.h>
+
+#define ROUTER_MAX_METHODS 8
+#define ROUTER_MAX_PARAMS MAX_PATH_PARAMS
+
+// Compressed radix trie from path patterns to one value per method. Patterns are literal
+// paths with two kinds of captured segments:
+//   /sessions/:id/audio  ":id" matches one non-empty segment
+//   /personas/*rest      "*rest" matches the rest of the path (a bare "*" is named "*")
+// On a lookup, literal segments win over ":" segments, which win over "*". Lookup cost
+// depends on the path length, not on the number of routes.
+typedef struct RouteNode RouteNode;
+
+typedef struct {
+    RouteNode* root;
+} Router;
+
+typedef struct {
+    const char* name;
+    const char* value;  // Points into the looked-up path; not NUL-terminated
+    size_t length;
+} RouteParam;
+
+typedef struct {
+    void* const* values;  // The matched route's values, indexed by method
+    int param_count;
+    RouteParam params[ROUTER_MAX_PARAMS];
+} RouteMatch;
+
+// Adds value for method (0 .. ROUTER_MAX_METHODS-1) under pattern. Returns -1 if the pattern
+// is malformed, conflicts with another route's parameter name, or is already registered
+// for method.
+int router_insert(Router* router, const char* pattern, int method, void* value);
+
+// Returns 1 and fills match if some route matches path (whatever its methods), 0 otherwise.
+// Never allocates.
+int router_lookup(const Router* router, const char* path, RouteMatch* match);
+
+// Frees every node, passing each stored value to free_value (may be NULL)
+void router_free(Router* router, void (*free_value)(void* value));
+
+#endif
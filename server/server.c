@@ -2,6 +2,10 @@
 #include "server.h"
 #include "http.h"
 #include "endpoint.h"
+#include "reactor.h"
+#include "file_cache.h"
+#include "worker_pool.h"
+#include "admission.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,54 +13,73 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 
 #ifdef ENABLE_WEBSOCKET
 #include "websocket.h"
 #include "ws_endpoint.h"
-#include <pthread.h>
 #endif
 
 typedef struct {
-    int socket_fd;
     int port;
     int is_running;
+    ServerConfig config;
+    Reactor* reactors;
+    int reactor_count;
+    WorkerPool* workers;
 } InternalServer;
 
 static InternalServer server;
-static int handle_client(int client_fd);
-
-#ifdef ENABLE_WEBSOCKET
-static void handle_websocket_client(int client_fd, const char* path, const char* request);
-static void* websocket_thread(void* arg);
-#endif
-
-int server_init(int port) {
-    printf("Initializing server on port %d...\n", port);
 
-    server.port = port;
-    server.is_running = 0;
-
-    endpoint_system_init();
-#ifdef ENABLE_WEBSOCKET
-    ws_endpoint_system_init();
-#endif
+void server_config_default(ServerConfig* config) {
+    memset(config, 0, sizeof(*config));
+    config->reactor_threads = 1;
+    config->pin_reactor_threads = 0;
+    config->listen_backlog = SOMAXCONN;
+    config->max_connections = 0;
+    config->max_connections_per_ip = 0;
+    config->shed_latency_ms = 0;
+    config->keepalive_timeout_ms = 5000;
+    config->header_timeout_ms = 10000;
+    config->body_timeout_ms = 30000;
+    config->handler_timeout_ms = 30000;
+    config->ws_idle_timeout_ms = 120000;
+    config->ws_max_frame_size = 1024 * 1024;
+    config->ws_max_message_size = 16 * 1024 * 1024;
+    config->ws_send_high_watermark = 1024 * 1024;
+    config->ws_send_low_watermark = 256 * 1024;
+    config->ws_send_queue_limit = 16 * 1024 * 1024;
+    config->max_keepalive_requests = 100;
+    config->max_request_head_size = 64 * 1024;
+    config->file_cache_entries = FILE_CACHE_DEFAULT_ENTRIES;
+    config->sse_heartbeat_ms = 15000;
+    config->max_body_size = 16 * 1024 * 1024;
+    config->max_upload_size = 0;
+    config->worker_threads = 4;
+    config->worker_queue_depth = 1024;
+    config->worker_overflow_policy = WORKER_OVERFLOW_REJECT;
+}
 
-    server.socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server.socket_fd == -1) {
+static int create_listen_socket(int port, int backlog) {
+    int socket_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1) {
         perror("socket");
         return -1;
     }
 
     int opt = 1;
-    if (setsockopt(server.socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
         perror("setsockopt SO_REUSEADDR");
-        close(server.socket_fd);
+        close(socket_fd);
         return -1;
     }
 
-    if (setsockopt(server.socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+    // Every reactor binds its own socket to the port; the kernel load-balances accepts between them
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
         perror("setsockopt SO_REUSEPORT");
-        close(server.socket_fd);
+        close(socket_fd);
         return -1;
     }
 
@@ -65,153 +88,175 @@ int server_init(int port) {
     addr.sin_port = htons(port);
     addr.sin_addr.s_addr = INADDR_ANY;
 
-    printf("Attempting to bind to port %d (socket_fd=%d)...\n", port, server.socket_fd);
-    if (bind(server.socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+    printf("Attempting to bind to port %d (socket_fd=%d)...\n", port, socket_fd);
+    if (bind(socket_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
         perror("bind");
-        close(server.socket_fd);
+        close(socket_fd);
         return -1;
     }
     printf("Successfully bound to port %d\n", port);
 
-    if (listen(server.socket_fd, 10) == -1) {
+    if (listen(socket_fd, backlog) == -1) {
         perror("listen");
+        close(socket_fd);
         return -1;
     }
 
-    printf("Server initialized successfully\n");
-    return 0;
+    return socket_fd;
 }
 
-int server_start() {
-    server.is_running = 1;
-    while (server.is_running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
-        int client_fd = accept(server.socket_fd, (struct sockaddr*)&client_addr, &client_addr_len);
-        if (client_fd == -1) {
-            perror("accept");
-            continue;
-        }
-        int should_close = handle_client(client_fd);
-        if (should_close) {
-            close(client_fd);
-        }
+static void destroy_reactors(int count) {
+    for (int i = 0; i < count; i++) {
+        reactor_destroy(&server.reactors[i]);
     }
-    return 0;
+    free(server.reactors);
+    server.reactors = NULL;
+    server.reactor_count = 0;
 }
 
-void server_stop() {
-    server.is_running = 0;
-    close(server.socket_fd);
+int server_init(int port) {
+    ServerConfig config;
+    server_config_default(&config);
+    return server_init_with_config(port, &config);
 }
 
-static void parse_url(const char* url, char* path, char* query_string) {
-    const char* question_mark = strchr(url, '?');
-    if (question_mark) {
-        size_t path_len = question_mark - url;
-        strncpy(path, url, path_len);
-        path[path_len] = '\0';
-        strcpy(query_string, question_mark + 1);
-    } else {
-        strcpy(path, url);
-        query_string[0] = '\0';
+int server_init_with_config(int port, const ServerConfig* config) {
+    printf("Initializing server on port %d...\n", port);
+
+    server.port = port;
+    server.is_running = 0;
+    server.config = *config;
+
+    int reactor_count = config->reactor_threads;
+    if (reactor_count <= 0) {
+        reactor_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (reactor_count <= 0) reactor_count = 1;
     }
-}
 
-HttpResponse* handle_route_with_body(char* method, char* url, const char* content_type, char* body, int body_length) {
-    char path[256];
-    char query_string[512];
+    endpoint_system_init();
+    file_cache_init(config->file_cache_entries);
+    admission_init(config->max_connections, config->max_connections_per_ip);
 
-    parse_url(url, path, query_string);
+    // sendfile() has no MSG_NOSIGNAL; a peer that disconnects mid-file must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+#ifdef ENABLE_WEBSOCKET
+    ws_endpoint_system_init();
+#endif
 
-    EndpointResponse* endpoint_response = endpoint_dispatch_with_body(method, path, query_string, content_type, body, body_length);
+    server.reactors = calloc(reactor_count, sizeof(Reactor));
+    if (!server.reactors) {
+        perror("calloc");
+        return -1;
+    }
 
-    if (endpoint_response) {
-        HttpResponse* http_response = http_build_binary_response(
-            endpoint_response->status_code,
-            endpoint_response->body,
-            endpoint_response->body_length,
-            endpoint_response->content_type
-        );
+    for (int i = 0; i < reactor_count; i++) {
+        int socket_fd = create_listen_socket(port, config->listen_backlog);
+        if (socket_fd == -1) {
+            destroy_reactors(i);
+            return -1;
+        }
 
-        endpoint_response_free(endpoint_response);
-        return http_response;
-    } else {
-        const char* error_body = "{\"error\": \"Endpoint not found\"}";
-        HttpResponse* http_response = http_build_binary_response(404, error_body, strlen(error_body), "application/json");
-        return http_response;
+        if (reactor_init(&server.reactors[i], socket_fd, &server.config) != 0) {
+            fprintf(stderr, "Failed to create event loop\n");
+            close(socket_fd);
+            destroy_reactors(i);
+            return -1;
+        }
+        server.reactor_count = i + 1;
     }
-}
 
-static int handle_client(int client_fd) {
-    char header_buffer[4096];
-    ssize_t bytes_read = read(client_fd, header_buffer, sizeof(header_buffer) - 1);
-    if (bytes_read <= 0) {
-        return 1; // Close the socket
+    if (config->worker_threads > 0) {
+        server.workers = worker_pool_create(config->worker_threads, config->worker_queue_depth,
+                                            config->worker_overflow_policy);
+        if (!server.workers) {
+            fprintf(stderr, "Failed to start worker threads\n");
+            destroy_reactors(reactor_count);
+            return -1;
+        }
+        for (int i = 0; i < reactor_count; i++) {
+            server.reactors[i].workers = server.workers;
+        }
     }
-    header_buffer[bytes_read] = '\0';
 
-    char method[10], url[256];
-    http_parse_request(header_buffer, method, url);
+    printf("Server initialized successfully (%d reactor thread%s, %d worker%s)\n",
+           reactor_count, reactor_count == 1 ? "" : "s",
+           config->worker_threads, config->worker_threads == 1 ? "" : "s");
+    return 0;
+}
 
-    // Extract path from URL (remove query string)
-    char path[256];
-    char query_string[512];
-    parse_url(url, path, query_string);
+static void pin_current_thread(int index) {
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count <= 0) return;
 
-#ifdef ENABLE_WEBSOCKET
-    // Check if this is a WebSocket upgrade request
-    if (ws_is_upgrade_request(header_buffer) && ws_endpoint_exists(path)) {
-        printf("WebSocket upgrade request detected for path: %s\n", path);
-        handle_websocket_client(client_fd, path, header_buffer);
-        return 0; // Don't close the socket - WebSocket thread manages it
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % cpu_count, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0) {
+        fprintf(stderr, "Warning: could not pin reactor %d: %s\n", index, strerror(err));
     }
-#endif
-
-    // Regular HTTP handling
-    char content_type[128];
-    http_get_content_type(header_buffer, content_type, sizeof(content_type));
-    int content_length = http_get_content_length(header_buffer);
+}
 
-    const char* body_in_buffer = http_find_body(header_buffer);
-    char* body = NULL;
-    int body_length = 0;
+static void* reactor_thread(void* arg) {
+    Reactor* reactor = (Reactor*)arg;
+    int index = (int)(reactor - server.reactors);
+    if (server.config.pin_reactor_threads) {
+        pin_current_thread(index);
+    }
+    reactor_run(reactor);
+    return NULL;
+}
 
-    if (content_length > 0 && body_in_buffer) {
-        int body_already_read = bytes_read - (body_in_buffer - header_buffer);
+int server_start() {
+    if (server.reactor_count == 0) {
+        fprintf(stderr, "Server not initialized\n");
+        return -1;
+    }
+    server.is_running = 1;
 
-        body = malloc(content_length);
-        if (!body) {
-            return 1; // Close the socket
-        }
+    // Reactor 0 runs on the calling thread, the rest get a thread each
+    int count = server.reactor_count;
+    pthread_t* threads = calloc(count, sizeof(pthread_t));
+    if (!threads) {
+        perror("calloc");
+        return -1;
+    }
 
-        memcpy(body, body_in_buffer, body_already_read);
-
-        int remaining = content_length - body_already_read;
-        if (remaining > 0) {
-            int total_read = 0;
-            while (total_read < remaining) {
-                ssize_t additional = read(client_fd, body + body_already_read + total_read, remaining - total_read);
-                if (additional <= 0) {
-                    free(body);
-                    return 1; // Close the socket
-                }
-                total_read += additional;
-            }
+    int started = 1;
+    for (int i = 1; i < count; i++) {
+        if (pthread_create(&threads[i], NULL, reactor_thread, &server.reactors[i]) != 0) {
+            fprintf(stderr, "Failed to create reactor thread %d\n", i);
+            break;
         }
-        body_length = content_length;
+        started++;
     }
 
-    HttpResponse* response = handle_route_with_body(method, url, content_type, body, body_length);
-    write(client_fd, response->body, response->body_length);
+    reactor_thread(&server.reactors[0]);
+
+    for (int i = 1; i < count; i++) {
+        reactor_stop(&server.reactors[i]);
+    }
+    for (int i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
 
-    free(response->body);
-    free(response);
-    if (body) {
-        free(body);
+    // Workers finish (or cancel) their jobs before the connections those jobs point to go away
+    for (int i = 0; i < count; i++) {
+        reactor_close_streams(&server.reactors[i]);
     }
+    worker_pool_destroy(server.workers);
+    server.workers = NULL;
+    destroy_reactors(count);
+    file_cache_clear();
+    return 0;
+}
 
-    return 1; // Close the socket after HTTP response
+void server_stop() {
+    server.is_running = 0;
+    for (int i = 0; i < server.reactor_count; i++) {
+        reactor_stop(&server.reactors[i]);
+    }
 }
 
 static HttpMethod parse_method_string(const char* method_str) {
@@ -229,123 +274,89 @@ int server_register_handler(const char* path, const char* method, EndpointHandle
     return endpoint_register(path, http_method, handler);
 }
 
-const char* request_get_param(const RequestContext* request, const char* param_name) {
-    return endpoint_get_param(request, param_name);
-}
+int server_register_handler_flags(const char* path, const char* method, EndpointHandler handler, int flags) {
+    printf("Registering custom endpoint: %s %s%s\n", method, path, flags ? " (worker pool)" : "");
 
-int request_get_param_int(const RequestContext* request, const char* param_name, int default_value) {
-    return endpoint_get_param_int(request, param_name, default_value);
+    HttpMethod http_method = parse_method_string(method);
+    return endpoint_register_flags(path, http_method, handler, flags);
 }
 
-const char* request_get_body(const RequestContext* request) {
-    return request->body;
-}
+int server_register_stream_handler(const char* path, const char* method, StreamHandler handler) {
+    printf("Registering streaming endpoint: %s %s\n", method, path);
 
-EndpointResponse* response_json(int status_code, const char* json_body) {
-    return endpoint_json_response(status_code, json_body);
-}
-
-EndpointResponse* response_text(int status_code, const char* text_body) {
-    return endpoint_create_response(status_code, text_body, "text/plain");
+    HttpMethod http_method = parse_method_string(method);
+    return endpoint_register_stream(path, http_method, handler);
 }
 
-EndpointResponse* response_error(int status_code, const char* error_message) {
-    return endpoint_error_response(status_code, error_message);
+int server_register_sse_handler(const char* path, SseHandler handler) {
+    printf("Registering SSE endpoint: GET %s\n", path);
+    return endpoint_register_sse(path, handler);
 }
 
-#ifdef ENABLE_WEBSOCKET
-// WebSocket thread argument
-typedef struct {
-    int client_fd;
-    char path[256];
-} WsThreadArg;
-
-static void* websocket_thread(void* arg) {
-    WsThreadArg* ws_arg = (WsThreadArg*)arg;
-    int client_fd = ws_arg->client_fd;
-    char path[256];
-    strncpy(path, ws_arg->path, sizeof(path) - 1);
-    path[sizeof(path) - 1] = '\0';
-    free(ws_arg);
-
-    // Create client object
-    WebSocketClient* client = ws_client_create(client_fd, path);
-    if (!client) {
-        fprintf(stderr, "Failed to create WebSocket client\n");
-        close(client_fd);
-        return NULL;
+int server_register_body_handler(const char* path, const char* method, BodyHandlers handlers) {
+    if (!handlers.on_data || !handlers.on_end) {
+        fprintf(stderr, "Error: Body handlers need on_data and on_end\n");
+        return -1;
     }
+    printf("Registering upload endpoint: %s %s\n", method, path);
 
-    printf("WebSocket client connected: id=%d, path=%s\n", client->id, path);
+    HttpMethod http_method = parse_method_string(method);
+    return endpoint_register_body(path, http_method, handlers);
+}
 
-    // Dispatch connect event
-    ws_endpoint_dispatch_connect(path, client);
+int server_register_raw_upload_handler(const char* path, const char* method, const char* directory,
+                                       int flags, RawUploadHandler handler) {
+    printf("Registering raw upload endpoint: %s %s\n", method, path);
 
-    // Message loop
-    while (client->is_active) {
-        WebSocketFrame* frame = ws_read_frame(client_fd);
-        if (!frame) {
-            printf("WebSocket client disconnected: id=%d\n", client->id);
-            break;
-        }
+    HttpMethod http_method = parse_method_string(method);
+    return endpoint_register_raw_upload(path, http_method, directory, flags, handler);
+}
 
-        if (frame->opcode == WS_OPCODE_TEXT || frame->opcode == WS_OPCODE_BINARY) {
-            int is_binary = (frame->opcode == WS_OPCODE_BINARY);
-            ws_endpoint_dispatch_message(path, client, frame->payload,
-                                        frame->payload_length, is_binary);
-        } else if (frame->opcode == WS_OPCODE_CLOSE) {
-            printf("WebSocket close frame received from client %d\n", client->id);
-            ws_send_close(client);
-            ws_frame_free(frame);
-            break;
-        } else if (frame->opcode == WS_OPCODE_PING) {
-            ws_send_pong(client, frame->payload, frame->payload_length);
-        }
+const char* request_get_param(const RequestContext* request, const char* param_name) {
+    return endpoint_get_param(request, param_name);
+}
 
-        ws_frame_free(frame);
-    }
+int request_get_param_int(const RequestContext* request, const char* param_name, int default_value) {
+    return endpoint_get_param_int(request, param_name, default_value);
+}
 
-    // Dispatch disconnect event
-    ws_endpoint_dispatch_disconnect(path, client);
+int request_get_param_long(const RequestContext* request, const char* param_name, long long* value) {
+    return endpoint_get_param_long(request, param_name, value);
+}
 
-    // Cleanup
-    ws_client_destroy(client);
-    close(client_fd);
+int request_get_param_double(const RequestContext* request, const char* param_name, double* value) {
+    return endpoint_get_param_double(request, param_name, value);
+}
 
-    return NULL;
+const char* request_get_path_param(const RequestContext* request, const char* param_name) {
+    return endpoint_get_path_param(request, param_name);
 }
 
-static void handle_websocket_client(int client_fd, const char* path, const char* request) {
-    // Perform WebSocket handshake
-    if (ws_perform_handshake(client_fd, request) != 0) {
-        fprintf(stderr, "WebSocket handshake failed\n");
-        close(client_fd);
-        return;
-    }
+const char* request_get_body(const RequestContext* request) {
+    return request->body;
+}
 
-    printf("WebSocket handshake successful for path: %s\n", path);
+const char* request_get_header(const RequestContext* request, const char* header_name) {
+    return endpoint_get_header(request, header_name);
+}
 
-    // Create thread argument
-    WsThreadArg* arg = malloc(sizeof(WsThreadArg));
-    arg->client_fd = client_fd;
-    strncpy(arg->path, path, sizeof(arg->path) - 1);
-    arg->path[sizeof(arg->path) - 1] = '\0';
+EndpointResponse* response_json(int status_code, const char* json_body) {
+    return endpoint_json_response(status_code, json_body);
+}
 
-    // Spawn thread to handle WebSocket connection
-    pthread_t thread;
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+EndpointResponse* response_text(int status_code, const char* text_body) {
+    return endpoint_create_response(status_code, text_body, "text/plain");
+}
 
-    if (pthread_create(&thread, &attr, websocket_thread, arg) != 0) {
-        fprintf(stderr, "Failed to create WebSocket thread\n");
-        free(arg);
-        close(client_fd);
-    }
+EndpointResponse* response_error(int status_code, const char* error_message) {
+    return endpoint_error_response(status_code, error_message);
+}
 
-    pthread_attr_destroy(&attr);
+EndpointResponse* response_binary(int status_code, void* data, size_t length, const char* content_type) {
+    return endpoint_binary_response_take(status_code, data, length, content_type);
 }
 
+#ifdef ENABLE_WEBSOCKET
 int server_register_ws_handler(const char* path, WsHandlers handlers) {
     printf("Registering WebSocket endpoint: %s\n", path);
     return ws_endpoint_register(path, handlers);
@@ -9,21 +9,35 @@ typedef struct {
     int id;
     int is_active;
     char path[256];
+    struct WsSendQueue* send_queue;  // Outbound frames, written by the connection's event loop
 } WebSocketClient;
 
 // WebSocket handler types
 typedef void (*WsConnectHandler)(WebSocketClient* client);
 typedef void (*WsMessageHandler)(WebSocketClient* client, const char* message, int length, int is_binary);
 typedef void (*WsDisconnectHandler)(WebSocketClient* client);
+// One frame of a fragmented message as it arrives; is_final is set on the last one
+typedef void (*WsFragmentHandler)(WebSocketClient* client, const char* data, int length, int is_binary, int is_final);
+// The send queue is back down to ws_send_low_watermark after a send returned WS_SEND_BACKPRESSURE
+typedef void (*WsDrainHandler)(WebSocketClient* client);
 
 typedef struct {
     WsConnectHandler on_connect;
     WsMessageHandler on_message;
     WsDisconnectHandler on_disconnect;
+    // Optional: receives fragmented messages piece by piece instead of on_message getting
+    // them joined, so they are never buffered whole. Gets unfragmented ones too (as a single
+    // final piece) when on_message is not set.
+    WsFragmentHandler on_fragment;
+    // Optional: resume sending after backpressure
+    WsDrainHandler on_drain;
+    // HANDLER_BLOCKING / HANDLER_CPU_HEAVY: on_message and on_fragment run on the worker pool,
+    // one at a time per client. Other handlers always run on the event loop.
+    int flags;
 } WsHandlers;
 
 #define MAX_PARAM_LENGTH 128
-#define MAX_PARAMS 10
+#define MAX_PATH_PARAMS 4  // ":name" and "*name" captures in one route
 #define MAX_PATH_LENGTH 256
 
 typedef enum {
@@ -34,18 +48,26 @@ typedef enum {
 } HttpMethod;
 
 typedef struct {
-    char name[MAX_PARAM_LENGTH];
-    char value[MAX_PARAM_LENGTH];
+    const char* name;
+    const char* value;  // Percent-decoded
 } RequestParam;
 
+struct HttpRequest;
+
+// Everything here points into the request (or the caller's strings); nothing is copied.
+// Valid only while the handler runs.
 typedef struct RequestContext {
     HttpMethod method;
-    char path[MAX_PATH_LENGTH];
+    const char* path;
     char* body;
     int body_length;
-    RequestParam params[MAX_PARAMS];
-    int param_count;
-    char content_type[128];
+    const char* content_type;        // "" when the request has none
+    const struct HttpRequest* http;  // Parsed request head, NULL when dispatched without one
+    char* query;                     // Raw query, percent-decoded in place on the first lookup
+    size_t query_length;
+    int query_decoded;
+    RequestParam* path_params;  // Captured by the route ("/sessions/:id"), decoded
+    int path_param_count;
 } RequestContext;
 
 typedef struct EndpointResponse {
@@ -57,19 +79,131 @@ typedef struct EndpointResponse {
 
 typedef EndpointResponse* (*EndpointHandler)(const RequestContext* request);
 
+// Streaming handlers run on their own thread and send the body in pieces as it is produced
+typedef struct ResponseWriter ResponseWriter;
+typedef void (*StreamHandler)(const RequestContext* request, ResponseWriter* writer);
+
+// Server-Sent Events: the handler runs on the event loop when a client connects and picks
+// the stream to subscribe it to (NULL answers 404). Subscribers cost no thread.
+typedef struct SseStream SseStream;
+typedef SseStream* (*SseHandler)(const RequestContext* request);
+
+// Streaming request bodies: instead of buffering the whole body, on_data is handed each piece
+// as it arrives, so an upload of any size uses a fixed amount of memory. All callbacks run on
+// the event loop; the context's body is NULL. on_data returns non-zero to reject the upload.
+typedef struct {
+    void* (*on_begin)(const RequestContext* request);  // Returns per-request state (may be NULL)
+    int (*on_data)(void* state, const char* data, size_t length);
+    EndpointResponse* (*on_end)(void* state, const RequestContext* request);
+    void (*on_abort)(void* state);  // Called instead of on_end if the upload fails (may be NULL)
+} BodyHandlers;
+
+// Raw uploads: the body is moved from the socket into a temp file with splice(), never
+// passing through user space, and the handler gets the file once it is complete. The file
+// is deleted after the handler returns; rename() it to keep it.
+typedef struct {
+    const char* path;
+    size_t size;
+    unsigned int crc32;  // Only filled in with RAW_UPLOAD_CRC32
+} StoredBody;
+
+typedef EndpointResponse* (*RawUploadHandler)(const RequestContext* request, const StoredBody* body);
+
+#define RAW_UPLOAD_CRC32 1  // Checksum the body as it is written (spliced chunks are read back while cached)
+
+typedef struct {
+    int reactor_threads;      // Event loops, each with its own SO_REUSEPORT listener (0 = one per CPU)
+    int pin_reactor_threads;  // Pin reactor N to CPU N
+
+    int listen_backlog;          // Completed handshakes the kernel queues per listener (capped by somaxconn)
+    int max_connections;         // Open connections across all reactors; more are answered 503 (0 = no limit)
+    int max_connections_per_ip;  // Open connections from one client address (0 = no limit)
+    int shed_latency_ms;         // Answer new connections 503 while requests wait longer than this (0 = never)
+
+    int keepalive_timeout_ms;    // Close idle persistent connections after this long (0 = disable keep-alive)
+
+    // Enforced from each reactor's timer wheel (0 = no limit)
+    int header_timeout_ms;   // Accept or first byte of a request to the end of its head; then 408
+    int body_timeout_ms;     // Longest pause between pieces of a request body; then 408
+    int handler_timeout_ms;  // Worker pool handlers; the client gets 504 and the late response is dropped
+    int ws_idle_timeout_ms;  // WebSocket connections that receive nothing for this long are closed
+
+    // WebSocket connections exceeding these are closed with status 1009
+    size_t ws_max_frame_size;    // Checked on the frame header, before anything is allocated
+    size_t ws_max_message_size;  // Total of a message joined for on_message
+
+    // Per-client send queue: sends at or over the high watermark return WS_SEND_BACKPRESSURE
+    // and on_drain is called once it is back down to the low one. Sends that would queue
+    // more than the limit fail.
+    size_t ws_send_high_watermark;
+    size_t ws_send_low_watermark;
+    size_t ws_send_queue_limit;
+    int max_keepalive_requests;  // Requests served on one connection before it is closed (0 = unlimited)
+
+    size_t max_request_head_size;  // Read buffers grow up to this size; larger request heads get 431
+
+    int file_cache_entries;  // Open descriptors kept for endpoint_file_response() (0 = no caching)
+
+    int sse_heartbeat_ms;  // Comment line sent to idle Server-Sent Events subscribers (0 = never)
+
+    // Larger Content-Length values are answered with 413 before the body is read (0 = no limit)
+    size_t max_body_size;    // Bodies buffered for regular handlers
+    size_t max_upload_size;  // Bodies streamed to BodyHandlers
+
+    // Pool for handlers registered with HANDLER_BLOCKING or HANDLER_CPU_HEAVY, and for stream handlers
+    int worker_threads;          // 0 = no pool; flagged handlers then run on the event loop, streams get 503
+    int worker_queue_depth;      // Requests waiting for a worker (rounded up to a power of two)
+    int worker_overflow_policy;  // What happens to requests beyond worker_queue_depth
+} ServerConfig;
+
+#define WORKER_OVERFLOW_REJECT 0  // Answer 503 with Retry-After
+#define WORKER_OVERFLOW_QUEUE 1   // Keep them waiting (unbounded)
+
+// Handler flags: the handler runs on the worker pool and its response is written by the event
+// loop, so it cannot hold up other connections. Unflagged handlers run inline on the event
+// loop, which is cheapest for fast ones.
+#define HANDLER_BLOCKING 1   // Sleeps, waits on I/O or locks
+#define HANDLER_CPU_HEAVY 2  // Computes for more than a few hundred microseconds
+
+void server_config_default(ServerConfig* config);
+
 int server_init(int port);
+int server_init_with_config(int port, const ServerConfig* config);
 int server_start(void);
 void server_stop(void);
 
 int server_register_handler(const char* path, const char* method, EndpointHandler handler);
+// flags is a combination of HANDLER_BLOCKING and HANDLER_CPU_HEAVY
+int server_register_handler_flags(const char* path, const char* method, EndpointHandler handler, int flags);
+int server_register_stream_handler(const char* path, const char* method, StreamHandler handler);
+int server_register_sse_handler(const char* path, SseHandler handler);
+int server_register_body_handler(const char* path, const char* method, BodyHandlers handlers);
+// directory holds the temp files (NULL = /tmp); flags is 0 or RAW_UPLOAD_CRC32
+int server_register_raw_upload_handler(const char* path, const char* method, const char* directory,
+                                       int flags, RawUploadHandler handler);
 
+// Query parameters are percent-decoded ('+' is a space); the first of repeated names wins.
+// There is no limit on their number or length.
 const char* request_get_param(const RequestContext* request, const char* param_name);
+// Returns default_value if the parameter is missing, not a whole number, or out of range
 int request_get_param_int(const RequestContext* request, const char* param_name, int default_value);
+
+// Typed accessors: on PARAM_OK *value is set, otherwise it is left alone
+#define PARAM_OK 0
+#define PARAM_MISSING -1
+#define PARAM_INVALID -2  // Present but not entirely a number, or out of range
+int request_get_param_long(const RequestContext* request, const char* param_name, long long* value);
+int request_get_param_double(const RequestContext* request, const char* param_name, double* value);
+// Value captured by ":name" or "*name" in the route's path, or NULL
+const char* request_get_path_param(const RequestContext* request, const char* param_name);
 const char* request_get_body(const RequestContext* request);
+const char* request_get_header(const RequestContext* request, const char* header_name);
 
 EndpointResponse* response_json(int status_code, const char* json_body);
 EndpointResponse* response_text(int status_code, const char* text_body);
 EndpointResponse* response_error(int status_code, const char* error_message);
+// Sends data without copying it; the framework frees data (which must come from malloc)
+EndpointResponse* response_binary(int status_code, void* data, size_t length, const char* content_type);
 
 typedef struct {
     char filename[256];
@@ -78,16 +212,95 @@ typedef struct {
     size_t size;
 } UploadedFile;
 
+// Finds the first file part in a buffered multipart/form-data body; file->data points into the body
 int parse_multipart_file(const RequestContext* request, UploadedFile* file);
 
+// Incremental multipart/form-data parsing, for use from BodyHandlers. The body can be fed
+// in pieces of any size; every part is reported, with its data in one or more calls.
+// Callbacks may be NULL and return non-zero to stop parsing.
+typedef struct {
+    char name[MAX_PARAM_LENGTH];
+    char filename[256];       // Empty for plain form fields
+    char content_type[128];
+} MultipartPart;
+
+typedef struct {
+    int (*on_part_begin)(void* user, const MultipartPart* part);
+    int (*on_part_data)(void* user, const MultipartPart* part, const char* data, size_t length);
+    int (*on_part_end)(void* user, const MultipartPart* part);
+} MultipartCallbacks;
+
+typedef struct MultipartParser MultipartParser;
+
+// Returns NULL if content_type has no usable boundary
+MultipartParser* multipart_parser_create(const char* content_type, const MultipartCallbacks* callbacks, void* user);
+// Both return -1 on malformed input or when a callback stopped parsing;
+// multipart_parser_finish() also fails if the closing boundary never arrived
+int multipart_parser_feed(MultipartParser* parser, const char* data, size_t length);
+int multipart_parser_finish(MultipartParser* parser);
+void multipart_parser_free(MultipartParser* parser);
+
+// Spools a multipart body as it arrives: file parts are written to temp files in directory,
+// form fields are kept in memory. After multipart_spool_finish() every part's data is readable
+// (files are mapped read-only), so a multi-gigabyte upload never sits on the heap.
+// multipart_spool_free() removes the temp files; rename() a part's path first to keep it.
+typedef struct {
+    MultipartPart info;
+    const char* data;  // Field value (NUL-terminated) or the mapped file; NULL until finished
+    size_t size;
+    char path[256];    // Temp file for file parts, empty for fields
+} SpooledPart;
+
+typedef struct MultipartSpool MultipartSpool;
+
+MultipartSpool* multipart_spool_create(const char* content_type, const char* directory);
+int multipart_spool_feed(MultipartSpool* spool, const char* data, size_t length);
+int multipart_spool_finish(MultipartSpool* spool);
+int multipart_spool_count(const MultipartSpool* spool);
+const SpooledPart* multipart_spool_part(const MultipartSpool* spool, int index);
+void multipart_spool_free(MultipartSpool* spool);
+
+// Streaming responses (Transfer-Encoding: chunked). Defaults to 200 text/plain if
+// response_writer_begin() is not called before the first write. Writes block while the
+// client is not keeping up and return -1 once it has disconnected.
+int response_writer_begin(ResponseWriter* writer, int status_code, const char* content_type);
+int response_writer_write(ResponseWriter* writer, const void* data, size_t length);
+int response_writer_print(ResponseWriter* writer, const char* text);
+
+// Server-Sent Events streams. The last replay_events events are kept so a client that
+// reconnects with Last-Event-ID gets what it missed. Publishing is thread-safe and returns
+// the event id (or -1); event may be NULL. Closing ends every subscriber and drops the
+// caller's reference, so the stream must not be used afterwards.
+SseStream* sse_stream_create(int replay_events);
+long long sse_publish(SseStream* stream, const char* event, const char* data);
+void sse_stream_close(SseStream* stream);
+
 // WebSocket API
 int server_register_ws_handler(const char* path, WsHandlers handlers);
+// Thread-safe and non-blocking: the frame is queued for the connection's event loop.
+// Return 0, WS_SEND_BACKPRESSURE if the frame was queued but the client is falling behind,
+// or -1 if it was not sent.
+#define WS_SEND_BACKPRESSURE 1
 int ws_send_text(WebSocketClient* client, const char* message);
 int ws_send_binary(WebSocketClient* client, const void* data, size_t length);
+// A client is freed after on_disconnect returns. Threads that keep a client to send to later
+// hold a reference; sends after the disconnect fail instead of touching freed memory.
+void ws_client_retain(WebSocketClient* client);
+void ws_client_release(WebSocketClient* client);
+// A capture of the endpoint's route ("/sessions/:id/audio" -> "id"), percent-decoded, or NULL
+const char* ws_client_get_path_param(const WebSocketClient* client, const char* param_name);
 
 // Convenience macros
 #define SERVER_GET(path, handler) server_register_handler(path, "GET", handler)
 #define SERVER_POST(path, handler) server_register_handler(path, "POST", handler)
+#define SERVER_GET_BLOCKING(path, handler) server_register_handler_flags(path, "GET", handler, HANDLER_BLOCKING)
+#define SERVER_POST_BLOCKING(path, handler) server_register_handler_flags(path, "POST", handler, HANDLER_BLOCKING)
+#define SERVER_STREAM(path, handler) server_register_stream_handler(path, "GET", handler)
+#define SERVER_SSE(path, handler) server_register_sse_handler(path, handler)
+#define SERVER_UPLOAD(path, begin, data, end, abort) \
+    server_register_body_handler(path, "POST", (BodyHandlers){.on_begin = begin, .on_data = data, .on_end = end, .on_abort = abort})
+#define SERVER_RAW_UPLOAD(path, directory, handler) \
+    server_register_raw_upload_handler(path, "POST", directory, 0, handler)
 #define SERVER_WS(path, on_msg, on_conn, on_disc) \
     server_register_ws_handler(path, (WsHandlers){.on_connect = on_conn, .on_message = on_msg, .on_disconnect = on_disc})
 
@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include "sse.h"
+#include "connection.h"
+#include "reactor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+static const char SSE_RESPONSE_HEAD[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+static void group_task(EventLoop* loop, EventTask* task);
+
+SseStream* sse_stream_create(int replay_events) {
+    if (replay_events <= 0) replay_events = SSE_DEFAULT_REPLAY_EVENTS;
+
+    SseStream* stream = calloc(1, sizeof(SseStream));
+    if (!stream) return NULL;
+    stream->ring = calloc(replay_events, sizeof(SseEvent));
+    if (!stream->ring) {
+        free(stream);
+        return NULL;
+    }
+    stream->capacity = replay_events;
+    stream->refcount = 1;
+    pthread_mutex_init(&stream->lock, NULL);
+    return stream;
+}
+
+static void stream_release(SseStream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    int destroy = --stream->refcount == 0;
+    pthread_mutex_unlock(&stream->lock);
+
+    if (destroy) {
+        for (int i = 0; i < stream->capacity; i++) {
+            free(stream->ring[i].frame);
+        }
+        free(stream->ring);
+        pthread_mutex_destroy(&stream->lock);
+        free(stream);
+    }
+}
+
+// Caller holds stream->lock
+static void notify_groups(SseStream* stream) {
+    for (SseGroup* group = stream->groups; group; group = group->next) {
+        if (!group->task_posted) {
+            group->task_posted = 1;
+            event_loop_post(&group->reactor->loop, &group->task);
+        }
+    }
+}
+
+static char* format_event(uint64_t id, const char* event, const char* data, size_t* length) {
+    // Every line of data gets its own "data: " prefix
+    size_t lines = 1;
+    for (const char* p = data; *p; p++) {
+        if (*p == '\n') lines++;
+    }
+    size_t capacity = 32 + (event ? strlen(event) + 8 : 0) + strlen(data) + lines * 7 + 2;
+    char* frame = malloc(capacity);
+    if (!frame) return NULL;
+
+    size_t offset = sprintf(frame, "id: %llu\n", (unsigned long long)id);
+    if (event) {
+        offset += sprintf(frame + offset, "event: %s\n", event);
+    }
+    const char* line = data;
+    for (;;) {
+        const char* newline = strchr(line, '\n');
+        size_t line_length = newline ? (size_t)(newline - line) : strlen(line);
+        memcpy(frame + offset, "data: ", 6);
+        memcpy(frame + offset + 6, line, line_length);
+        offset += 6 + line_length;
+        frame[offset++] = '\n';
+        if (!newline) break;
+        line = newline + 1;
+    }
+    frame[offset++] = '\n';
+
+    *length = offset;
+    return frame;
+}
+
+long long sse_publish(SseStream* stream, const char* event, const char* data) {
+    pthread_mutex_lock(&stream->lock);
+    if (stream->closed) {
+        pthread_mutex_unlock(&stream->lock);
+        return -1;
+    }
+
+    uint64_t id = stream->last_id + 1;
+    size_t length;
+    char* frame = format_event(id, event, data ? data : "", &length);
+    if (!frame) {
+        pthread_mutex_unlock(&stream->lock);
+        return -1;
+    }
+
+    SseEvent* slot = &stream->ring[id % stream->capacity];
+    free(slot->frame);
+    slot->id = id;
+    slot->frame = frame;
+    slot->length = length;
+    stream->last_id = id;
+
+    notify_groups(stream);
+    pthread_mutex_unlock(&stream->lock);
+    return (long long)id;
+}
+
+void sse_stream_close(SseStream* stream) {
+    pthread_mutex_lock(&stream->lock);
+    stream->closed = 1;
+    notify_groups(stream);
+    pthread_mutex_unlock(&stream->lock);
+
+    stream_release(stream);
+}
+
+static int subscriber_append(SseSubscriber* subscriber, const char* data, size_t length) {
+    if (subscriber->out_offset == subscriber->out_length) {
+        subscriber->out_offset = 0;
+        subscriber->out_length = 0;
+    }
+    if (subscriber->out_length - subscriber->out_offset + length > SSE_MAX_BUFFERED) {
+        return -1;
+    }
+    if (subscriber->out_length + length > subscriber->out_capacity) {
+        // Compact before growing
+        memmove(subscriber->out, subscriber->out + subscriber->out_offset,
+                subscriber->out_length - subscriber->out_offset);
+        subscriber->out_length -= subscriber->out_offset;
+        subscriber->out_offset = 0;
+
+        size_t capacity = subscriber->out_capacity ? subscriber->out_capacity : 4096;
+        while (capacity < subscriber->out_length + length) capacity *= 2;
+        if (capacity != subscriber->out_capacity) {
+            char* out = realloc(subscriber->out, capacity);
+            if (!out) return -1;
+            subscriber->out = out;
+            subscriber->out_capacity = capacity;
+        }
+    }
+    memcpy(subscriber->out + subscriber->out_length, data, length);
+    subscriber->out_length += length;
+    return 0;
+}
+
+// Copies events the subscriber has not seen yet. Caller holds stream->lock.
+static void deliver_events(SseSubscriber* subscriber, SseStream* stream) {
+    uint64_t oldest = stream->last_id > (uint64_t)stream->capacity ? stream->last_id - stream->capacity + 1 : 1;
+    uint64_t id = subscriber->last_id + 1 < oldest ? oldest : subscriber->last_id + 1;
+
+    for (; id <= stream->last_id; id++) {
+        SseEvent* event = &stream->ring[id % stream->capacity];
+        if (subscriber_append(subscriber, event->frame, event->length) != 0) {
+            subscriber->dropped = 1; // Too far behind; the client can reconnect with Last-Event-ID
+            break;
+        }
+    }
+    subscriber->last_id = stream->last_id;
+    if (stream->closed) {
+        subscriber->closing = 1;
+    }
+}
+
+// Caller holds stream->lock
+static void group_unlink(SseStream* stream, SseGroup* group) {
+    SseGroup** link = &stream->groups;
+    while (*link != group) {
+        link = &(*link)->next;
+    }
+    *link = group->next;
+}
+
+static void group_task(EventLoop* loop, EventTask* task) {
+    (void)loop;
+    SseGroup* group = (SseGroup*)task;
+    SseStream* stream = group->stream;
+
+    pthread_mutex_lock(&stream->lock);
+    group->task_posted = 0;
+    for (SseSubscriber* subscriber = group->subscribers; subscriber; subscriber = subscriber->group_next) {
+        deliver_events(subscriber, stream);
+    }
+    // Keeps the group alive while flushing closes connections below
+    group->subscriber_count++;
+    pthread_mutex_unlock(&stream->lock);
+
+    SseSubscriber* subscriber = group->subscribers;
+    while (subscriber) {
+        SseSubscriber* next = subscriber->group_next;
+        if (sse_flush(subscriber) != 0) {
+            connection_close(subscriber->conn);
+        }
+        subscriber = next;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    int free_group = --group->subscriber_count == 0 && !group->task_posted;
+    if (free_group) {
+        group_unlink(stream, group);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    if (free_group) {
+        free(group);
+        stream_release(stream);
+    }
+}
+
+SseSubscriber* sse_subscribe(struct Connection* conn, SseStream* stream) {
+    Reactor* reactor = conn->reactor;
+
+    SseSubscriber* subscriber = calloc(1, sizeof(SseSubscriber));
+    if (!subscriber) return NULL;
+    subscriber->conn = conn;
+    if (subscriber_append(subscriber, SSE_RESPONSE_HEAD, sizeof(SSE_RESPONSE_HEAD) - 1) != 0) {
+        free(subscriber);
+        return NULL;
+    }
+
+    const char* last_event_id = http_request_header(&conn->request, HTTP_HEADER_LAST_EVENT_ID, NULL);
+    char* end = NULL;
+    unsigned long long resume_id = last_event_id ? strtoull(last_event_id, &end, 10) : 0;
+    int resume = last_event_id && end != last_event_id && *end == '\0';
+
+    pthread_mutex_lock(&stream->lock);
+
+    SseGroup* group = stream->groups;
+    while (group && group->reactor != reactor) {
+        group = group->next;
+    }
+    if (!group) {
+        group = calloc(1, sizeof(SseGroup));
+        if (!group) {
+            pthread_mutex_unlock(&stream->lock);
+            free(subscriber->out);
+            free(subscriber);
+            return NULL;
+        }
+        group->task.run = group_task;
+        group->stream = stream;
+        group->reactor = reactor;
+        group->next = stream->groups;
+        stream->groups = group;
+        stream->refcount++;
+    }
+
+    subscriber->group = group;
+    subscriber->group_next = group->subscribers;
+    if (group->subscribers) {
+        group->subscribers->group_prev = subscriber;
+    }
+    group->subscribers = subscriber;
+    group->subscriber_count++;
+
+    // Without Last-Event-ID only new events are sent
+    subscriber->last_id = resume && resume_id < stream->last_id ? resume_id : stream->last_id;
+    deliver_events(subscriber, stream);
+
+    pthread_mutex_unlock(&stream->lock);
+
+    if (!reactor->sse_subscribers) {
+        reactor->next_heartbeat_ms = reactor->loop.now_ms + reactor->config->sse_heartbeat_ms;
+    }
+    subscriber->reactor_next = reactor->sse_subscribers;
+    if (reactor->sse_subscribers) {
+        reactor->sse_subscribers->reactor_prev = subscriber;
+    }
+    reactor->sse_subscribers = subscriber;
+    return subscriber;
+}
+
+void sse_unsubscribe(SseSubscriber* subscriber) {
+    Reactor* reactor = subscriber->conn->reactor;
+    if (subscriber->reactor_prev) {
+        subscriber->reactor_prev->reactor_next = subscriber->reactor_next;
+    } else {
+        reactor->sse_subscribers = subscriber->reactor_next;
+    }
+    if (subscriber->reactor_next) {
+        subscriber->reactor_next->reactor_prev = subscriber->reactor_prev;
+    }
+
+    SseGroup* group = subscriber->group;
+    SseStream* stream = group->stream;
+
+    pthread_mutex_lock(&stream->lock);
+    if (subscriber->group_prev) {
+        subscriber->group_prev->group_next = subscriber->group_next;
+    } else {
+        group->subscribers = subscriber->group_next;
+    }
+    if (subscriber->group_next) {
+        subscriber->group_next->group_prev = subscriber->group_prev;
+    }
+    int free_group = --group->subscriber_count == 0 && !group->task_posted;
+    if (free_group) {
+        group_unlink(stream, group);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    if (free_group) {
+        free(group);
+        stream_release(stream);
+    }
+    free(subscriber->out);
+    free(subscriber);
+}
+
+int sse_flush(SseSubscriber* subscriber) {
+    if (subscriber->dropped) return -1;
+    while (subscriber->out_offset < subscriber->out_length) {
+        ssize_t n = send(subscriber->conn->fd, subscriber->out + subscriber->out_offset,
+                         subscriber->out_length - subscriber->out_offset, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        subscriber->out_offset += n;
+    }
+    return subscriber->closing ? -1 : 0;
+}
+
+int sse_heartbeat(struct Reactor* reactor, uint64_t now) {
+    int interval = reactor->config->sse_heartbeat_ms;
+    if (!reactor->sse_subscribers || interval <= 0) return -1;
+
+    if (now >= reactor->next_heartbeat_ms) {
+        SseSubscriber* subscriber = reactor->sse_subscribers;
+        while (subscriber) {
+            SseSubscriber* next = subscriber->reactor_next;
+            // A comment line keeps proxies from timing out a quiet stream
+            if (subscriber_append(subscriber, ":\n\n", 3) != 0) {
+                subscriber->dropped = 1;
+            }
+            if (sse_flush(subscriber) != 0) {
+                connection_close(subscriber->conn);
+            }
+            subscriber = next;
+        }
+        reactor->next_heartbeat_ms = now + interval;
+    }
+    return (int)(reactor->next_heartbeat_ms - now);
+}
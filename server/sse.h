@@ -0,0 +1,77 @@
+#ifndef SSE_H
+#define SSE_H
+
+#include "server.h"
+#include "event_loop.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#define SSE_DEFAULT_REPLAY_EVENTS 64
+#define SSE_MAX_BUFFERED (256 * 1024)  // Subscribers further behind than this are dropped
+
+struct Connection;
+struct Reactor;
+struct SseGroup;
+
+typedef struct {
+    uint64_t id;
+    char* frame;  // Formatted "id:/event:/data:" block
+    size_t length;
+} SseEvent;
+
+// Events are stored at ring[id % capacity], so replaying from an id needs no search
+struct SseStream {
+    pthread_mutex_t lock;
+    int refcount;
+    int closed;
+    uint64_t last_id;
+    SseEvent* ring;
+    int capacity;
+
+    // One group per reactor with subscribers on this stream
+    struct SseGroup* groups;
+};
+
+// A stream's subscribers on one reactor. Publishing posts the group's task once;
+// the task copies new events to every subscriber on the reactor thread.
+typedef struct SseGroup {
+    EventTask task;
+    SseStream* stream;
+    struct Reactor* reactor;
+    struct SseSubscriber* subscribers;
+    int subscriber_count;
+    int task_posted;
+    struct SseGroup* next;
+} SseGroup;
+
+typedef struct SseSubscriber {
+    struct Connection* conn;
+    SseGroup* group;
+    uint64_t last_id;
+    int closing;  // Close once the buffered output is written
+    int dropped;  // Too far behind: close without waiting for a peer that may never read
+
+    char* out;
+    size_t out_length;
+    size_t out_capacity;
+    size_t out_offset;
+
+    struct SseSubscriber* group_prev;
+    struct SseSubscriber* group_next;
+    // Reactor list, for heartbeats
+    struct SseSubscriber* reactor_prev;
+    struct SseSubscriber* reactor_next;
+} SseSubscriber;
+
+// Sends the response head and any events after Last-Event-ID. Returns NULL on failure.
+SseSubscriber* sse_subscribe(struct Connection* conn, SseStream* stream);
+void sse_unsubscribe(SseSubscriber* subscriber);
+
+// Writes buffered output. Returns 0 while the subscription is open, -1 once the connection should close
+// (at once for a dropped subscriber).
+int sse_flush(SseSubscriber* subscriber);
+
+// Called from the reactor's prepare hook; returns ms until the next heartbeat is due, or -1
+int sse_heartbeat(struct Reactor* reactor, uint64_t now);
+
+#endif
@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include "../server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <time.h>
+
+// Requests/sec scaling from 1 to N reactor threads.
+// Usage: bench_reactors [max_reactors] [seconds_per_run] [client_threads] [pin]
+
+#define BENCH_PORT 9995
+#define BENCH_HOST "127.0.0.1"
+
+static volatile int bench_running = 0;
+static long total_requests = 0;
+static long total_errors = 0;
+
+static EndpointResponse* handle_fast(const RequestContext* req) {
+    return response_json(200, "{\"status\":\"ok\"}");
+}
+
+static int connect_to_server(void) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    inet_pton(AF_INET, BENCH_HOST, &addr.sin_addr);
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int do_request(void) {
+    int sock = connect_to_server();
+    if (sock < 0) return -1;
+
+    const char* request = "GET /fast HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    if (write(sock, request, strlen(request)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    char buffer[1024];
+    ssize_t total = 0;
+    ssize_t n;
+    while ((n = read(sock, buffer, sizeof(buffer))) > 0) {
+        total += n;
+    }
+    close(sock);
+    return total > 0 ? 0 : -1;
+}
+
+static void* client_thread_func(void* arg) {
+    long ok = 0;
+    long errors = 0;
+    while (bench_running) {
+        if (do_request() == 0) ok++;
+        else errors++;
+    }
+    __atomic_add_fetch(&total_requests, ok, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&total_errors, errors, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static pid_t spawn_server(int reactors, int pin) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    // Child: silence startup logging and serve until killed
+    freopen("/dev/null", "w", stdout);
+
+    ServerConfig config;
+    server_config_default(&config);
+    config.reactor_threads = reactors;
+    config.pin_reactor_threads = pin;
+    if (server_init_with_config(BENCH_PORT, &config) != 0) {
+        _exit(1);
+    }
+    SERVER_GET("/fast", handle_fast);
+    server_start();
+    _exit(0);
+}
+
+static int wait_for_server(void) {
+    for (int i = 0; i < 100; i++) {
+        int sock = connect_to_server();
+        if (sock >= 0) {
+            close(sock);
+            return 0;
+        }
+        usleep(20000);
+    }
+    return -1;
+}
+
+static double run_load(int clients, int seconds) {
+    total_requests = 0;
+    total_errors = 0;
+    bench_running = 1;
+
+    pthread_t* threads = malloc(sizeof(pthread_t) * clients);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < clients; i++) {
+        pthread_create(&threads[i], NULL, client_thread_func, NULL);
+    }
+    sleep(seconds);
+    bench_running = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(threads);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return total_requests / elapsed;
+}
+
+int main(int argc, char** argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_reactors = argc > 1 ? atoi(argv[1]) : (int)(cpus > 0 ? cpus : 1);
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    int clients = argc > 3 ? atoi(argv[3]) : 16;
+    int pin = argc > 4 ? atoi(argv[4]) : 0;
+
+    printf("=== Reactor Scaling Benchmark ===\n");
+    printf("CPUs online: %ld, client threads: %d, %ds per run, pinning %s\n\n",
+           cpus, clients, seconds, pin ? "on" : "off");
+    printf("%-10s %-14s %-10s %-8s\n", "reactors", "req/s", "speedup", "errors");
+
+    double baseline = 0;
+    for (int n = 1; n <= max_reactors; n++) {
+        pid_t pid = spawn_server(n, pin);
+        if (pid < 0 || wait_for_server() != 0) {
+            fprintf(stderr, "Server with %d reactors failed to start\n", n);
+            if (pid > 0) kill(pid, SIGKILL);
+            return 1;
+        }
+
+        double rps = run_load(clients, seconds);
+        if (n == 1) baseline = rps;
+
+        printf("%-10d %-14.0f %-10.2f %-8ld\n", n, rps, baseline > 0 ? rps / baseline : 0.0, total_errors);
+        fflush(stdout);
+
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include "../ws_mask.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// WebSocket payload unmasking throughput: the byte-at-a-time loop ws_read_frame() used,
+// against ws_unmask() in place and ws_mask_copy() fused with the copy out of a read buffer.
+// Usage: bench_ws_mask [megabytes_per_run]
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void unmask_bytewise(char* data, size_t length, const uint8_t mask[4]) {
+    for (size_t i = 0; i < length; i++) {
+        data[i] ^= mask[i % 4];
+    }
+}
+
+static void copy_then_unmask(char* dst, const char* src, size_t length, const uint8_t mask[4]) {
+    memcpy(dst, src, length);
+    unmask_bytewise(dst, length, mask);
+}
+
+// Keeps the compiler from dropping the work
+static volatile unsigned char sink;
+
+static double run_in_place(void (*unmask)(char*, size_t, const uint8_t*), char* buffer, size_t length,
+                           size_t total, const uint8_t mask[4]) {
+    size_t rounds = total / length + 1;
+    double start = now_seconds();
+    for (size_t i = 0; i < rounds; i++) {
+        unmask(buffer, length, mask);
+        sink = buffer[i % length];
+    }
+    return rounds * length / (now_seconds() - start) / 1e9;
+}
+
+static double run_copy(void (*copy)(char*, const char*, size_t, const uint8_t*), char* dst, const char* src,
+                       size_t length, size_t total, const uint8_t mask[4]) {
+    size_t rounds = total / length + 1;
+    double start = now_seconds();
+    for (size_t i = 0; i < rounds; i++) {
+        copy(dst, src, length, mask);
+        sink = dst[i % length];
+    }
+    return rounds * length / (now_seconds() - start) / 1e9;
+}
+
+// Compares against the byte loop at every length and misalignment up to 300 bytes
+static int check_correctness(void) {
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    char src[320], expected[320], actual[320];
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = (char)(i * 7 + 3);
+    }
+    for (size_t offset = 0; offset < 8; offset++) {
+        for (size_t length = 0; length + offset < 300; length++) {
+            memcpy(expected, src + offset, length);
+            unmask_bytewise(expected, length, mask);
+
+            memcpy(actual, src + offset, length);
+            ws_unmask(actual, length, mask);
+            if (memcmp(actual, expected, length) != 0) return 0;
+
+            ws_mask_copy(actual + 1, src + offset, length, mask);
+            if (memcmp(actual + 1, expected, length) != 0) return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    size_t total = (size_t)(argc > 1 ? atoi(argv[1]) : 512) * 1024 * 1024;
+
+    if (!check_correctness()) {
+        fprintf(stderr, "ws_mask_copy disagrees with the byte loop\n");
+        return 1;
+    }
+
+    // 125: largest small frame; 1920: 20 ms of 48 kHz 16-bit mono PCM; then bulk sizes
+    size_t sizes[] = {125, 1920, 16 * 1024, 1024 * 1024};
+    const uint8_t mask[4] = {0xa1, 0xb2, 0xc3, 0xd4};
+    char* src = malloc(sizes[3] + 64);
+    char* dst = malloc(sizes[3] + 64);
+    if (!src || !dst) return 1;
+    for (size_t i = 0; i < sizes[3] + 64; i++) {
+        src[i] = (char)rand();
+    }
+
+    printf("%-10s %12s %12s %14s %14s\n", "frame", "byte loop", "ws_unmask", "memcpy+loop", "ws_mask_copy");
+    printf("%-10s %12s %12s %14s %14s\n", "(bytes)", "GB/s", "GB/s", "GB/s", "GB/s");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t length = sizes[i];
+        double bytewise = run_in_place(unmask_bytewise, src, length, total, mask);
+        double vector = run_in_place(ws_unmask, src, length, total, mask);
+        double copy_loop = run_copy(copy_then_unmask, dst, src, length, total, mask);
+        double fused = run_copy(ws_mask_copy, dst, src, length, total, mask);
+        printf("%-10zu %12.2f %12.2f %14.2f %14.2f   (%.1fx in place)\n",
+               length, bytewise, vector, copy_loop, fused, vector / bytewise);
+    }
+
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -13,22 +13,43 @@ mkdir -p build
 
 # Compile server library
 echo "Compiling server library..."
-gcc -Wall -Wextra -g -I.. -pthread -c ../server.c -o build/server.o
-gcc -Wall -Wextra -g -I.. -pthread -c ../endpoint.c -o build/endpoint.o
-gcc -Wall -Wextra -g -I.. -pthread -c ../http.c -o build/http.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../server.c -o build/server.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../endpoint.c -o build/endpoint.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../http.c -o build/http.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../event_loop.c -o build/event_loop.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../reactor.c -o build/reactor.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../connection.c -o build/connection.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../buffer_pool.c -o build/buffer_pool.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../file_cache.c -o build/file_cache.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../response_writer.c -o build/response_writer.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../sse.c -o build/sse.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../multipart.c -o build/multipart.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../raw_upload.c -o build/raw_upload.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../arena.c -o build/arena.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../router.c -o build/router.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../worker_pool.c -o build/worker_pool.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../admission.c -o build/admission.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../timer_wheel.c -o build/timer_wheel.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../websocket.c -o build/websocket.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../ws_endpoint.c -o build/ws_endpoint.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../ws_mask.c -o build/ws_mask.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../ws_send_queue.c -o build/ws_send_queue.o
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../ws_session.c -o build/ws_session.o
+
+SERVER_OBJS="build/server.o build/endpoint.o build/http.o build/event_loop.o build/reactor.o build/connection.o build/buffer_pool.o build/file_cache.o build/response_writer.o build/sse.o build/multipart.o build/raw_upload.o build/arena.o build/router.o build/worker_pool.o build/admission.o build/timer_wheel.o build/websocket.o build/ws_endpoint.o build/ws_mask.o build/ws_send_queue.o build/ws_session.o"
 
 # Compile tests
 echo "Compiling test_http_endpoints..."
-gcc -Wall -Wextra -g -I.. -pthread test_http_endpoints.c build/server.o build/endpoint.o build/http.o -o build/test_http_endpoints -pthread
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET test_http_endpoints.c $SERVER_OBJS -o build/test_http_endpoints -pthread -lssl -lcrypto
 
 echo "Compiling test_memory_leaks..."
-gcc -Wall -Wextra -g -I.. -pthread test_memory_leaks.c build/server.o build/endpoint.o build/http.o -o build/test_memory_leaks -pthread
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET test_memory_leaks.c $SERVER_OBJS -o build/test_memory_leaks -pthread -lssl -lcrypto
 
 echo "Compiling test_stress..."
-gcc -Wall -Wextra -g -I.. -pthread test_stress.c build/server.o build/endpoint.o build/http.o -o build/test_stress -pthread
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET test_stress.c $SERVER_OBJS -o build/test_stress -pthread -lssl -lcrypto
 
 echo "Compiling test_edge_cases..."
-gcc -Wall -Wextra -g -I.. -pthread test_edge_cases.c build/server.o build/endpoint.o build/http.o -o build/test_edge_cases -pthread
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET test_edge_cases.c $SERVER_OBJS -o build/test_edge_cases -pthread -lssl -lcrypto
 
 echo ""
 echo "==================================="
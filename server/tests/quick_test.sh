@@ -4,32 +4,24 @@
 cd "$(dirname "$0")"
 mkdir -p build
 
-echo "Step 1: Compile server.c"
-gcc -Wall -Wextra -g -I.. -pthread -c ../server.c -o build/server.o 2>&1
-if [ $? -ne 0 ]; then
-    echo "ERROR: Failed to compile server.c"
-    exit 1
-fi
-echo "OK"
-
-echo "Step 2: Compile endpoint.c"
-gcc -Wall -Wextra -g -I.. -pthread -c ../endpoint.c -o build/endpoint.o 2>&1
-if [ $? -ne 0 ]; then
-    echo "ERROR: Failed to compile endpoint.c"
-    exit 1
-fi
-echo "OK"
+SOURCES="server endpoint http event_loop reactor connection buffer_pool file_cache response_writer sse multipart raw_upload arena router worker_pool admission timer_wheel websocket ws_endpoint ws_mask ws_send_queue ws_session"
+OBJECTS=""
+STEP=1
 
-echo "Step 3: Compile http.c"
-gcc -Wall -Wextra -g -I.. -pthread -c ../http.c -o build/http.o 2>&1
-if [ $? -ne 0 ]; then
-    echo "ERROR: Failed to compile http.c"
-    exit 1
-fi
-echo "OK"
+for src in $SOURCES; do
+    echo "Step $STEP: Compile $src.c"
+    gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET -c ../$src.c -o build/$src.o 2>&1
+    if [ $? -ne 0 ]; then
+        echo "ERROR: Failed to compile $src.c"
+        exit 1
+    fi
+    echo "OK"
+    OBJECTS="$OBJECTS build/$src.o"
+    STEP=$((STEP + 1))
+done
 
-echo "Step 4: Compile test_http_endpoints"
-gcc -Wall -Wextra -g -I.. -pthread test_http_endpoints.c build/server.o build/endpoint.o build/http.o -o build/test_http_endpoints -pthread 2>&1
+echo "Step $STEP: Compile test_http_endpoints"
+gcc -Wall -Wextra -g -I.. -pthread -DENABLE_WEBSOCKET test_http_endpoints.c $OBJECTS -o build/test_http_endpoints -pthread -lssl -lcrypto 2>&1
 if [ $? -ne 0 ]; then
     echo "ERROR: Failed to compile test_http_endpoints"
     exit 1
@@ -39,4 +31,3 @@ echo "OK"
 echo ""
 echo "SUCCESS: All compilation steps completed!"
 echo "Run with: ./build/test_http_endpoints"
-
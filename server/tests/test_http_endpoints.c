@@ -1,23 +1,57 @@
 #define _GNU_SOURCE
 #include "../server.h"
+#include "../endpoint.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
 
 #define TEST_PORT 9999
 #define TEST_HOST "127.0.0.1"
+#define TEST_MAX_CONNECTIONS_PER_IP 16
+#define TEST_REQUEST_TIMEOUT_MS 500
+#define TEST_WS_MAX_FRAME (64 * 1024)
+#define TEST_WS_MAX_MESSAGE (256 * 1024)
+#define TEST_WS_FLOOD_FRAME (32 * 1024)
+#define TEST_WS_FLOOD_MAX_FRAMES 1000
+#define TEST_WS_IDLE_TIMEOUT_MS 1500
 
 // Test state
 static int tests_passed = 0;
 static int tests_failed = 0;
 static pthread_t server_thread;
 
+// Heap allocations made on the event loop thread, counted by interposing on glibc's malloc
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+static __thread int on_server_thread;
+static long server_allocations;
+
+void* malloc(size_t size) {
+    if (on_server_thread) __atomic_add_fetch(&server_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    if (on_server_thread) __atomic_add_fetch(&server_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (on_server_thread) __atomic_add_fetch(&server_allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
 // Helper: Send HTTP request and get response
 static char* send_http_request(const char* request, size_t* response_len) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -100,6 +134,43 @@ static EndpointResponse* handle_post_echo(const RequestContext* req) {
     return response_json(200, response);
 }
 
+// Registered HANDLER_BLOCKING, so it sleeps on a worker thread instead of a reactor
+static EndpointResponse* handle_slow(const RequestContext* req) {
+    usleep(request_get_param_int(req, "ms", 200) * 1000);
+    return response_json(200, "{\"slow\":true}");
+}
+
+static EndpointResponse* handle_status(const RequestContext* req) {
+    return response_json(request_get_param_int(req, "code", 200), "{}");
+}
+
+static EndpointResponse* handle_query(const RequestContext* req) {
+    long long count = 0;
+    double ratio = 0;
+    int count_result = request_get_param_long(req, "count", &count);
+    int ratio_result = request_get_param_double(req, "ratio", &ratio);
+    const char* text = request_get_param(req, "text");
+    const char* last = request_get_param(req, "p15");
+    const char* long_value = request_get_param(req, "long");
+    const char* flag = request_get_param(req, "debug");
+
+    char response[512];
+    snprintf(response, sizeof(response),
+             "{\"count\":[%d,%lld],\"ratio\":[%d,%g],\"age\":%d,\"text\":\"%s\",\"p15\":\"%s\",\"debug\":\"%s\",\"long\":%zu}",
+             count_result, count, ratio_result, ratio, request_get_param_int(req, "age", -1),
+             text ? text : "", last ? last : "", flag ? flag : "(null)", long_value ? strlen(long_value) : 0);
+    return response_json(200, response);
+}
+
+static EndpointResponse* handle_route(const RequestContext* req) {
+    const char* id = request_get_path_param(req, "id");
+    const char* rest = request_get_path_param(req, "rest");
+    char response[512];
+    snprintf(response, sizeof(response), "{\"route\":\"%s\",\"id\":\"%s\",\"rest\":\"%s\"}",
+             req->path, id ? id : "", rest ? rest : "");
+    return response_json(200, response);
+}
+
 static EndpointResponse* handle_binary_data(const RequestContext* req) {
     // Return some binary data
     unsigned char data[] = {0x00, 0x01, 0x02, 0x03, 0xFF, 0xFE, 0xFD};
@@ -127,8 +198,217 @@ static EndpointResponse* handle_large_response(const RequestContext* req) {
     return resp;
 }
 
+static EndpointResponse* handle_headers(const RequestContext* req) {
+    const char* custom = request_get_header(req, "x-custom");
+    const char* host = request_get_header(req, "Host");
+
+    char response[256];
+    snprintf(response, sizeof(response), "{\"custom\":\"%s\",\"host\":\"%s\"}",
+             custom ? custom : "none", host ? host : "none");
+    return response_json(200, response);
+}
+
+#define BLOB_SIZE (4 * 1024 * 1024)
+
+static EndpointResponse* handle_blob(const RequestContext* req) {
+    (void)req;
+    // Multi-megabyte payload handed to the server without a copy
+    unsigned char* blob = malloc(BLOB_SIZE);
+    for (size_t i = 0; i < BLOB_SIZE; i++) {
+        blob[i] = (unsigned char)(i * 31);
+    }
+    return response_binary(200, blob, BLOB_SIZE, "audio/mpeg");
+}
+
+#define TEST_FILE_PATH "/tmp/test_http_endpoints_file.mp3"
+
+#define TEST_RANGE_FILE_PATH "/tmp/test_http_endpoints_range.mp3"
+
+static EndpointResponse* handle_file(const RequestContext* req) {
+    (void)req;
+    return endpoint_file_response(200, TEST_FILE_PATH);
+}
+
+static EndpointResponse* handle_range_file(const RequestContext* req) {
+    (void)req;
+    return endpoint_file_response(200, TEST_RANGE_FILE_PATH);
+}
+
+static void handle_stream_tokens(const RequestContext* req, ResponseWriter* writer) {
+    (void)req;
+    response_writer_begin(writer, 200, "text/plain");
+    char token[32];
+    for (int i = 0; i < 5; i++) {
+        snprintf(token, sizeof(token), "token%d ", i);
+        response_writer_print(writer, token);
+        usleep(100000);
+    }
+}
+
+static volatile int stream_write_failed = 0;
+
+static void handle_stream_forever(const RequestContext* req, ResponseWriter* writer) {
+    (void)req;
+    char chunk[1024];
+    memset(chunk, 'x', sizeof(chunk));
+    while (response_writer_write(writer, chunk, sizeof(chunk)) == 0) {
+    }
+    stream_write_failed = 1;
+}
+
+static SseStream* events_stream;
+
+static SseStream* handle_events(const RequestContext* req) {
+    (void)req;
+    return events_stream;
+}
+
+typedef struct {
+    size_t received;
+    size_t largest_chunk;
+    unsigned int checksum;
+} UploadCount;
+
+static UploadCount last_upload;
+
+static void* handle_upload_begin(const RequestContext* req) {
+    (void)req;
+    return calloc(1, sizeof(UploadCount));
+}
+
+static int handle_upload_data(void* state, const char* data, size_t length) {
+    UploadCount* count = state;
+    for (size_t i = 0; i < length; i++) {
+        count->checksum = count->checksum * 31 + (unsigned char)data[i];
+    }
+    count->received += length;
+    if (length > count->largest_chunk) count->largest_chunk = length;
+    return 0;
+}
+
+static EndpointResponse* handle_upload_end(void* state, const RequestContext* req) {
+    (void)req;
+    UploadCount* count = state;
+    last_upload = *count;
+    free(count);
+    char json[128];
+    snprintf(json, sizeof(json), "{\"received\": %zu}", last_upload.received);
+    return response_json(200, json);
+}
+
+static void handle_upload_abort(void* state) {
+    free(state);
+}
+
+static void* handle_form_begin(const RequestContext* req) {
+    return multipart_spool_create(req->content_type, "/tmp");
+}
+
+static int handle_form_data(void* state, const char* data, size_t length) {
+    return state ? multipart_spool_feed(state, data, length) : -1;
+}
+
+// Reports each part as name:size:checksum
+static EndpointResponse* handle_form_end(void* state, const RequestContext* req) {
+    (void)req;
+    MultipartSpool* spool = state;
+    if (!spool || multipart_spool_finish(spool) != 0) {
+        multipart_spool_free(spool);
+        return response_error(400, "Bad multipart body");
+    }
+    char text[1024] = "";
+    size_t offset = 0;
+    for (int i = 0; i < multipart_spool_count(spool); i++) {
+        const SpooledPart* part = multipart_spool_part(spool, i);
+        unsigned int checksum = 0;
+        for (size_t j = 0; j < part->size; j++) {
+            checksum = checksum * 31 + (unsigned char)part->data[j];
+        }
+        offset += snprintf(text + offset, sizeof(text) - offset, "%s:%s:%zu:%u;",
+                           part->info.name, part->info.filename, part->size, checksum);
+    }
+    multipart_spool_free(spool);
+    return response_text(200, text);
+}
+
+static void handle_form_abort(void* state) {
+    multipart_spool_free(state);
+}
+
+// Reports where the spliced body landed; the file is checked on disk before it is deleted
+static EndpointResponse* handle_raw_upload(const RequestContext* req, const StoredBody* body) {
+    (void)req;
+    struct stat st;
+    int on_disk = stat(body->path, &st) == 0 && (size_t)st.st_size == body->size;
+    char text[512];
+    snprintf(text, sizeof(text), "%s %zu %08x %d", body->path, body->size, body->crc32, on_disk);
+    return response_text(200, text);
+}
+
+static void handle_ws_echo(WebSocketClient* client, const char* message, int length, int is_binary) {
+    if (is_binary) {
+        ws_send_binary(client, message, length);
+    } else {
+        ws_send_text(client, message);
+    }
+}
+
+static void handle_ws_room_connect(WebSocketClient* client) {
+    const char* room = ws_client_get_path_param(client, "room");
+    ws_send_text(client, room ? room : "(null)");
+}
+
+// Sends numbered binary frames from its own thread until the client falls behind
+static void* ws_flood_thread(void* arg) {
+    WebSocketClient* client = arg;
+    unsigned char* frame = malloc(TEST_WS_FLOOD_FRAME);
+    int sent = 0;
+    int result = 0;
+    while (result == 0 && sent < TEST_WS_FLOOD_MAX_FRAMES) {
+        memset(frame, sent & 0xFF, TEST_WS_FLOOD_FRAME);
+        memcpy(frame, &sent, sizeof(sent));
+        result = ws_send_binary(client, frame, TEST_WS_FLOOD_FRAME);
+        if (result >= 0) sent++;
+    }
+    char message[64];
+    snprintf(message, sizeof(message), "sent:%d:%s", sent, result == WS_SEND_BACKPRESSURE ? "backpressure" : "none");
+    ws_send_text(client, message);
+    free(frame);
+    ws_client_release(client);
+    return NULL;
+}
+
+static void handle_ws_flood(WebSocketClient* client, const char* message, int length, int is_binary) {
+    (void)length;
+    (void)is_binary;
+    if (strcmp(message, "flood") != 0) return;
+    pthread_t thread;
+    ws_client_retain(client);
+    if (pthread_create(&thread, NULL, ws_flood_thread, client) != 0) {
+        ws_client_release(client);
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static void handle_ws_flood_drain(WebSocketClient* client) {
+    ws_send_text(client, "drained");
+}
+
+// Registered HANDLER_BLOCKING: sleeps on a worker, then says whether it ran on the reactor
+static void handle_ws_blocking(WebSocketClient* client, const char* message, int length, int is_binary) {
+    (void)length;
+    (void)is_binary;
+    if (strcmp(message, "early") == 0) ws_send_text(client, "started");
+    usleep(200000);
+    char reply[64];
+    snprintf(reply, sizeof(reply), "%s:%d", message, on_server_thread);
+    ws_send_text(client, reply);
+}
+
 // Server thread
 static void* server_thread_func(void* arg) {
+    on_server_thread = 1;
     server_start();
     return NULL;
 }
@@ -173,6 +453,70 @@ static void test_get_with_query_params() {
     free(response);
 }
 
+static void test_query_decoding() {
+    printf("TEST: Percent-decoding and typed query parameters... ");
+
+    char long_value[601];
+    memset(long_value, 'v', 600);
+    long_value[600] = '\0';
+
+    static const struct {
+        const char* query;
+        const char* expected;
+    } cases[] = {
+        {"count=42&ratio=0.5&age=30&text=a%20b+c%26d%3D", "\"count\":[0,42],\"ratio\":[0,0.5],\"age\":30,\"text\":\"a b c&d=\""},
+        {"count=12abc&ratio=&age=3x", "\"count\":[-2,0],\"ratio\":[-2,0],\"age\":-1"},
+        {"count=99999999999999999999&age=4294967296", "\"count\":[-2,0],\"ratio\":[-1,0],\"age\":-1"},
+        {"p0=0&p1=1&p2=2&p3=3&p4=4&p5=5&p6=6&p7=7&p8=8&p9=9&p10=10&p11=11&p12=12&p13=13&p14=14&p15=last",
+         "\"p15\":\"last\""},
+        {"text=%zz%4&&novalue&text=second", "\"text\":\"%zz%4\""},
+        // Bare names are kept with an empty value, wherever they are
+        {"debug&count=5", "\"count\":[0,5],\"ratio\":[-1,0],\"age\":-1,\"text\":\"\",\"p15\":\"\",\"debug\":\"\""},
+        {"count=5&de%62ug", "\"count\":[0,5],\"ratio\":[-1,0],\"age\":-1,\"text\":\"\",\"p15\":\"\",\"debug\":\"\""},
+        {"text=a%20b&debug=on&text=c", "\"text\":\"a b\",\"p15\":\"\",\"debug\":\"on\""},
+        {"debugger&debu", "\"debug\":\"(null)\""},
+    };
+
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]) + 1; i++) {
+        char request[1024];
+        const char* expected;
+        if (i < sizeof(cases) / sizeof(cases[0])) {
+            snprintf(request, sizeof(request), "GET /query?%s HTTP/1.1\r\nHost: localhost\r\n\r\n", cases[i].query);
+            expected = cases[i].expected;
+        } else {
+            // Values are not cut short
+            snprintf(request, sizeof(request), "GET /query?long=%s HTTP/1.1\r\nHost: localhost\r\n\r\n", long_value);
+            expected = "\"long\":600}";
+        }
+        size_t len;
+        char* response = send_http_request(request, &len);
+        if (!response || !strstr(response, expected)) {
+            const char* body = response ? strstr(response, "\r\n\r\n") : NULL;
+            printf("\n  case %zu: %s", i, body ? body + 4 : "(no response)");
+            failures++;
+        }
+        free(response);
+    }
+
+    // Route captures are decoded too
+    size_t len;
+    char* response = send_http_request("GET /sessions/a%2Fb%20c/audio HTTP/1.1\r\nHost: localhost\r\n\r\n", &len);
+    if (!response || !strstr(response, "\"id\":\"a/b c\"")) {
+        printf("\n  path capture: %s", response ? response : "(no response)");
+        failures++;
+    }
+    free(response);
+
+    if (failures == 0) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("\nFAIL (%d)\n", failures);
+        tests_failed++;
+    }
+}
+
 static void test_post_request() {
     printf("TEST: POST request with body... ");
     
@@ -254,6 +598,50 @@ static void test_404_not_found() {
     free(response);
 }
 
+static void test_routing() {
+    printf("TEST: Path parameters, wildcards and 405... ");
+
+    static const struct {
+        const char* request_line;
+        const char* expected;
+    } cases[] = {
+        {"GET /sessions/42/audio", "\"id\":\"42\",\"rest\":\"\"}"},
+        {"GET /sessions/latest/audio", "\"route\":\"/sessions/latest/audio\",\"id\":\"\""},
+        {"GET /sessions/latest-1/audio", "\"id\":\"latest-1\""},
+        {"PUT /sessions/7/audio", "\"id\":\"7\""},
+        {"GET /personas/narrator/voices/a.mp3", "\"rest\":\"narrator/voices/a.mp3\""},
+        {"GET /personas/", "\"rest\":\"\"}"},
+        {"GET /sessions//audio", "HTTP/1.1 404 Not Found"},
+        {"GET /sessions/42", "HTTP/1.1 404 Not Found"},
+        {"GET /personas", "HTTP/1.1 404 Not Found"},
+        {"DELETE /hello", "Allow: GET\r\n"},
+        {"POST /sessions/42/audio", "Allow: GET, PUT\r\n"},
+        {"PATCH /echo", "HTTP/1.1 405 Method Not Allowed"},
+    };
+
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char request[256];
+        snprintf(request, sizeof(request), "%s HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n",
+                 cases[i].request_line);
+        size_t len;
+        char* response = send_http_request(request, &len);
+        if (!response || !strstr(response, cases[i].expected)) {
+            printf("\n  %s: %.60s", cases[i].request_line, response ? response : "(no response)");
+            failures++;
+        }
+        free(response);
+    }
+
+    if (failures == 0) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("\nFAIL (%d)\n", failures);
+        tests_failed++;
+    }
+}
+
 static void test_multiple_requests() {
     printf("TEST: Multiple sequential requests... ");
     
@@ -280,11 +668,1570 @@ static void test_multiple_requests() {
     }
 }
 
+// Helper: Open a connection that the caller keeps for several requests
+static int open_connection(void) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    inet_pton(AF_INET, TEST_HOST, &addr.sin_addr);
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Helper: Read until `count` complete responses have arrived or the peer closes
+static int read_responses(int sock, char* buffer, size_t buffer_size, int count) {
+    size_t total = 0;
+    buffer[0] = '\0';
+    for (;;) {
+        int complete = 0;
+        const char* cursor = buffer;
+        const char* head;
+        while ((head = strstr(cursor, "\r\n\r\n")) != NULL) {
+            const char* cl_header = strstr(cursor, "Content-Length: ");
+            if (!cl_header || cl_header > head) break;
+            size_t content_length = strtoul(cl_header + 16, NULL, 10);
+            const char* end = head + 4 + content_length;
+            if (end > buffer + total) break;
+            complete++;
+            cursor = end;
+        }
+        if (complete >= count) return complete;
+
+        ssize_t n = read(sock, buffer + total, buffer_size - total - 1);
+        if (n <= 0) return complete;
+        total += n;
+        buffer[total] = '\0';
+    }
+}
+
+static void test_keep_alive_pipelining() {
+    printf("TEST: Keep-alive with pipelined requests... ");
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    // Two requests in one write must be answered in order on the same socket
+    const char* pipelined =
+        "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "GET /params?name=Pipe&age=7 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(sock, pipelined, strlen(pipelined));
+
+    char buffer[8192];
+    int first = read_responses(sock, buffer, sizeof(buffer), 2);
+    char* hello = strstr(buffer, "hello");
+    char* pipe = strstr(buffer, "Pipe");
+    int in_order = hello && pipe && hello < pipe;
+    int kept_alive = strstr(buffer, "Connection: keep-alive") != NULL;
+
+    // A third request on the same socket, asking the server to close afterwards
+    const char* last = "GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    write(sock, last, strlen(last));
+    int second = read_responses(sock, buffer, sizeof(buffer), 1);
+    int closed = strstr(buffer, "Connection: close") != NULL && read(sock, buffer, sizeof(buffer)) == 0;
+
+    close(sock);
+
+    if (first == 2 && in_order && kept_alive && second == 1 && closed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (first=%d in_order=%d keep_alive=%d second=%d closed=%d)\n",
+               first, in_order, kept_alive, second, closed);
+        tests_failed++;
+    }
+}
+
+static void test_http10_closes() {
+    printf("TEST: HTTP/1.0 request closes connection... ");
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    const char* request = "GET /hello HTTP/1.0\r\n\r\n";
+    write(sock, request, strlen(request));
+
+    char buffer[4096];
+    int responses = read_responses(sock, buffer, sizeof(buffer), 1);
+    int closed = read(sock, buffer, sizeof(buffer)) == 0;
+    close(sock);
+
+    if (responses == 1 && closed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL\n");
+        tests_failed++;
+    }
+}
+
+// Helper: Send request on a fresh connection and read until the server closes it. Returns
+// the number of responses seen; buffer holds everything that arrived.
+static int exchange_until_closed(const char* request, char* buffer, size_t buffer_size, int* closed) {
+    int sock = open_connection();
+    if (sock < 0) return -1;
+    write(sock, request, strlen(request));
+    int responses = read_responses(sock, buffer, buffer_size, 2);
+    *closed = read(sock, buffer + strlen(buffer), buffer_size - strlen(buffer) - 1) == 0;
+    close(sock);
+    return responses;
+}
+
+static void test_chunked_request_rejected() {
+    printf("TEST: Chunked request body answered with 501... ");
+
+    // Unread, the chunk lines would be parsed as a second request on the same connection
+    const char* request =
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "4\r\nbody\r\n0\r\n\r\n";
+    char buffer[4096];
+    int closed = 0;
+    int responses = exchange_until_closed(request, buffer, sizeof(buffer), &closed);
+
+    if (responses == 1 && strstr(buffer, "501 Not Implemented") && !strstr(buffer, "received") && closed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (responses=%d closed=%d)\n", responses, closed);
+        printf("Response: %s\n", buffer);
+        tests_failed++;
+    }
+}
+
+static void test_transfer_encoding_with_content_length() {
+    printf("TEST: Transfer-Encoding with Content-Length answered with 400... ");
+
+    const char* request =
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "0\r\n\r\nGET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char buffer[4096];
+    int closed = 0;
+    int responses = exchange_until_closed(request, buffer, sizeof(buffer), &closed);
+
+    if (responses == 1 && strstr(buffer, "400 Bad Request") && !strstr(buffer, "hello") && closed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (responses=%d closed=%d)\n", responses, closed);
+        printf("Response: %s\n", buffer);
+        tests_failed++;
+    }
+}
+
+static void test_split_request_headers() {
+    printf("TEST: Request split across writes with header lookup... ");
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    const char* parts[] = {
+        "GET /head",
+        "ers HTTP/1.1\r\nHost: split.test\r\nX-Cus",
+        "tom:   spaced value  \r\nConnection: close\r\n\r",
+        "\n",
+    };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        write(sock, parts[i], strlen(parts[i]));
+        usleep(20000);
+    }
+
+    char buffer[4096];
+    int responses = read_responses(sock, buffer, sizeof(buffer), 1);
+    close(sock);
+
+    if (responses == 1 && strstr(buffer, "200 OK") &&
+        strstr(buffer, "\"custom\":\"spaced value\"") && strstr(buffer, "\"host\":\"split.test\"")) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL\n");
+        printf("Response: %s\n", buffer);
+        tests_failed++;
+    }
+}
+
+// Helper: Build a request whose Cookie header is cookie_size bytes long
+static char* build_large_header_request(size_t cookie_size, const char* connection) {
+    size_t size = cookie_size + 256;
+    char* request = malloc(size);
+    int length = snprintf(request, size, "GET /headers HTTP/1.1\r\nHost: big.test\r\nCookie: ");
+    memset(request + length, 'c', cookie_size);
+    length += cookie_size;
+    snprintf(request + length, size - length, "\r\nX-Custom: after-cookie\r\nConnection: %s\r\n\r\n", connection);
+    return request;
+}
+
+static void test_large_headers() {
+    printf("TEST: Large request headers grow the read buffer... ");
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    // 20 KiB of cookies, well past the initial 4 KiB buffer
+    char* request = build_large_header_request(20 * 1024, "keep-alive");
+    send(sock, request, strlen(request), MSG_NOSIGNAL);
+    free(request);
+
+    char buffer[4096];
+    int first = read_responses(sock, buffer, sizeof(buffer), 1);
+    int large_ok = strstr(buffer, "200 OK") && strstr(buffer, "\"custom\":\"after-cookie\"");
+
+    // The same connection keeps working after its buffer shrinks back
+    const char* small = "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(sock, small, strlen(small));
+    int second = read_responses(sock, buffer, sizeof(buffer), 1);
+    int small_ok = strstr(buffer, "200 OK") && strstr(buffer, "hello");
+    close(sock);
+
+    // Heads beyond max_request_head_size are rejected
+    sock = open_connection();
+    request = build_large_header_request(128 * 1024, "close");
+    send(sock, request, strlen(request), MSG_NOSIGNAL);
+    free(request);
+    int third = read_responses(sock, buffer, sizeof(buffer), 1);
+    int rejected = strstr(buffer, "431") != NULL;
+    close(sock);
+
+    if (first == 1 && large_ok && second == 1 && small_ok && third == 1 && rejected) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (large=%d small=%d rejected=%d)\n", large_ok, small_ok, rejected);
+        tests_failed++;
+    }
+}
+
+static void test_large_binary_slow_reader() {
+    printf("TEST: 4MB binary response to a slow reader... ");
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    const char* request = "GET /blob HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    write(sock, request, strlen(request));
+
+    // Let the socket fill so the server has to resume a partial write
+    usleep(100000);
+
+    size_t capacity = BLOB_SIZE + 4096;
+    unsigned char* buffer = malloc(capacity);
+    size_t total = 0;
+    ssize_t n;
+    while (total < capacity && (n = read(sock, buffer + total, capacity - total)) > 0) {
+        total += n;
+    }
+    close(sock);
+
+    unsigned char* head_end = memmem(buffer, total, "\r\n\r\n", 4);
+    int intact = 0;
+    if (head_end) {
+        unsigned char* body = head_end + 4;
+        size_t body_length = total - (body - buffer);
+        intact = body_length == BLOB_SIZE;
+        for (size_t i = 0; intact && i < body_length; i++) {
+            intact = body[i] == (unsigned char)(i * 31);
+        }
+    }
+    free(buffer);
+
+    if (intact) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (received %zu bytes)\n", total);
+        tests_failed++;
+    }
+}
+
+static void write_test_file(const char* path, size_t size, unsigned char seed) {
+    FILE* file = fopen(path, "wb");
+    for (size_t i = 0; i < size; i++) {
+        fputc((unsigned char)(i + seed), file);
+    }
+    fclose(file);
+}
+
+// Helper: Fetch /file on sock and check it matches write_test_file(size, seed)
+static int fetch_test_file(int sock, size_t size, unsigned char seed) {
+    const char* request = "GET /file HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(sock, request, strlen(request));
+
+    size_t capacity = size + 4096;
+    char* buffer = malloc(capacity);
+    int responses = read_responses(sock, buffer, capacity, 1);
+
+    int intact = 0;
+    char* head_end = strstr(buffer, "\r\n\r\n");
+    if (responses == 1 && head_end && strstr(buffer, "Content-Type: audio/mpeg")) {
+        unsigned char* body = (unsigned char*)head_end + 4;
+        intact = 1;
+        for (size_t i = 0; intact && i < size; i++) {
+            intact = body[i] == (unsigned char)(i + seed);
+        }
+    }
+    free(buffer);
+    return intact;
+}
+
+static void test_file_response() {
+    printf("TEST: File response via sendfile and descriptor cache... ");
+
+    write_test_file(TEST_FILE_PATH, 256 * 1024, 0);
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    int first = fetch_test_file(sock, 256 * 1024, 0);
+    int cached = fetch_test_file(sock, 256 * 1024, 0);
+
+    // A replaced file is picked up once the cached entry is revalidated
+    unlink(TEST_FILE_PATH);
+    write_test_file(TEST_FILE_PATH, 100 * 1024, 7);
+    sleep(1);
+    usleep(100000);
+    int replaced = fetch_test_file(sock, 100 * 1024, 7);
+
+    close(sock);
+    unlink(TEST_FILE_PATH);
+
+    if (first && cached && replaced) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (first=%d cached=%d replaced=%d)\n", first, cached, replaced);
+        tests_failed++;
+    }
+}
+
+// Helper: Copy the value of header `name` from a raw response
+static int copy_header(const char* response, const char* name, char* value, size_t size) {
+    const char* start = strstr(response, name);
+    if (!start) return 0;
+    start += strlen(name);
+    const char* end = strstr(start, "\r\n");
+    size_t length = end - start;
+    if (length >= size) return 0;
+    memcpy(value, start, length);
+    value[length] = '\0';
+    return 1;
+}
+
+static void test_status_lines() {
+    printf("TEST: Status lines, Date and error responses... ");
+
+    static const struct {
+        const char* path;
+        const char* status_line;
+    } cases[] = {
+        {"/status?code=201", "HTTP/1.1 201 Created\r\n"},
+        {"/status?code=422", "HTTP/1.1 422 Unprocessable Content\r\n"},
+        {"/status?code=503", "HTTP/1.1 503 Service Unavailable\r\n"},
+        {"/status?code=499", "HTTP/1.1 499 Client Error\r\n"},
+        {"/nonexistent", "HTTP/1.1 404 Not Found\r\n"},
+    };
+
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char request[256];
+        snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", cases[i].path);
+        size_t len;
+        char* response = send_http_request(request, &len);
+        char date[64];
+        if (!response || strncmp(response, cases[i].status_line, strlen(cases[i].status_line)) != 0 ||
+            !copy_header(response, "Date: ", date, sizeof(date)) || !strstr(date, " GMT")) {
+            printf("\n  %s: %.40s", cases[i].path, response ? response : "(no response)");
+            failures++;
+        }
+        free(response);
+    }
+
+    // The 404 body is the JSON error with a matching Content-Length
+    size_t len;
+    char* response = send_http_request("GET /nonexistent HTTP/1.1\r\nHost: localhost\r\n\r\n", &len);
+    const char* expected = "{\"error\": \"Endpoint not found\"}";
+    char content_length[16];
+    const char* body = response ? strstr(response, "\r\n\r\n") : NULL;
+    if (!body || strcmp(body + 4, expected) != 0 ||
+        !copy_header(response, "Content-Length: ", content_length, sizeof(content_length)) ||
+        (size_t)atoi(content_length) != strlen(expected)) {
+        failures++;
+    }
+    free(response);
+
+    if (failures == 0) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("\nFAIL (%d)\n", failures);
+        tests_failed++;
+    }
+}
+
+static void test_file_conditional_and_range() {
+    printf("TEST: File ETag, 304 and Range requests... ");
+
+    write_test_file(TEST_RANGE_FILE_PATH, 64 * 1024, 3);
+    char request[512];
+    char etag[96] = "", last_modified[64] = "";
+
+    char* response = send_http_request("GET /range_file HTTP/1.1\r\nConnection: close\r\n\r\n", NULL);
+    int validators = response && copy_header(response, "ETag: ", etag, sizeof(etag)) &&
+                     copy_header(response, "Last-Modified: ", last_modified, sizeof(last_modified)) &&
+                     strstr(response, "Accept-Ranges: bytes");
+    free(response);
+
+    // Repeat loads with either validator cost headers only
+    snprintf(request, sizeof(request), "GET /range_file HTTP/1.1\r\nIf-None-Match: %s\r\nConnection: close\r\n\r\n", etag);
+    size_t length = 0;
+    response = send_http_request(request, &length);
+    int etag_304 = response && strstr(response, "304 Not Modified") && strstr(response, "\r\n\r\n") + 4 == response + length;
+    free(response);
+
+    snprintf(request, sizeof(request), "GET /range_file HTTP/1.1\r\nIf-Modified-Since: %s\r\nConnection: close\r\n\r\n", last_modified);
+    response = send_http_request(request, NULL);
+    int date_304 = response && strstr(response, "304 Not Modified");
+    free(response);
+
+    // Single range is sent straight from the file
+    response = send_http_request("GET /range_file HTTP/1.1\r\nRange: bytes=1000-1009\r\nConnection: close\r\n\r\n", NULL);
+    int single = 0;
+    if (response && strstr(response, "206 Partial Content") && strstr(response, "Content-Range: bytes 1000-1009/65536")) {
+        unsigned char* body = (unsigned char*)strstr(response, "\r\n\r\n") + 4;
+        single = 1;
+        for (int i = 0; i < 10; i++) {
+            single = single && body[i] == (unsigned char)(1000 + i + 3);
+        }
+    }
+    free(response);
+
+    // Several ranges come back as multipart/byteranges
+    response = send_http_request("GET /range_file HTTP/1.1\r\nRange: bytes=0-1, -2\r\nConnection: close\r\n\r\n", NULL);
+    int multi = response && strstr(response, "multipart/byteranges; boundary=") &&
+                strstr(response, "Content-Range: bytes 0-1/65536") && strstr(response, "Content-Range: bytes 65534-65535/65536");
+    free(response);
+
+    response = send_http_request("GET /range_file HTTP/1.1\r\nRange: bytes=70000-\r\nConnection: close\r\n\r\n", NULL);
+    int unsatisfiable = response && strstr(response, "416") && strstr(response, "Content-Range: bytes */65536");
+    free(response);
+
+    unlink(TEST_RANGE_FILE_PATH);
+
+    if (validators && etag_304 && date_304 && single && multi && unsatisfiable) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (validators=%d etag=%d date=%d single=%d multi=%d unsatisfiable=%d)\n",
+               validators, etag_304, date_304, single, multi, unsatisfiable);
+        tests_failed++;
+    }
+}
+
+static double elapsed_ms(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void test_streaming_response() {
+    printf("TEST: Chunked streaming response... ");
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const char* request = "GET /stream HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(sock, request, strlen(request));
+
+    char buffer[4096] = "";
+    size_t total = 0;
+    double first_byte_ms = -1;
+    while (!strstr(buffer, "\r\n0\r\n\r\n") && total < sizeof(buffer) - 1) {
+        ssize_t n = read(sock, buffer + total, sizeof(buffer) - total - 1);
+        if (n <= 0) break;
+        if (first_byte_ms < 0) first_byte_ms = elapsed_ms(&start);
+        total += n;
+        buffer[total] = '\0';
+    }
+    double total_ms = elapsed_ms(&start);
+
+    // Decode the chunked body
+    char body[256] = "";
+    char* cursor = strstr(buffer, "\r\n\r\n");
+    int chunked = strstr(buffer, "Transfer-Encoding: chunked") != NULL;
+    if (cursor) {
+        cursor += 4;
+        size_t size;
+        while ((size = strtoul(cursor, &cursor, 16)) > 0) {
+            cursor += 2;
+            strncat(body, cursor, size);
+            cursor += size + 2;
+        }
+    }
+
+    // The connection stays usable afterwards
+    const char* next = "GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    write(sock, next, strlen(next));
+    int reused = read_responses(sock, buffer, sizeof(buffer), 1) == 1 && strstr(buffer, "hello");
+    close(sock);
+
+    if (chunked && strcmp(body, "token0 token1 token2 token3 token4 ") == 0 &&
+        first_byte_ms < total_ms / 2 && reused) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (body='%s' first=%.0fms total=%.0fms reused=%d)\n", body, first_byte_ms, total_ms, reused);
+        tests_failed++;
+    }
+}
+
+static void test_blocking_handlers() {
+    printf("TEST: Blocking handlers run on workers without stalling other requests... ");
+
+    // Four sleeping handlers (one per default worker), each on its own connection, plus a
+    // pipelined request behind the first that must still be answered afterwards
+    const char* slow = "GET /slow?ms=300 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    const char* pipelined = "GET /slow?ms=300 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                            "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    int socks[4];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 4; i++) {
+        socks[i] = open_connection();
+        const char* request = i == 0 ? pipelined : slow;
+        if (socks[i] >= 0) write(socks[i], request, strlen(request));
+    }
+    usleep(50000);
+
+    size_t len;
+    char* fast = send_http_request("GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n", &len);
+    double fast_ms = elapsed_ms(&start);
+    int fast_ok = fast && strstr(fast, "hello") != NULL;
+    free(fast);
+
+    char buffer[4096];
+    int slow_ok = 1;
+    for (int i = 0; i < 4; i++) {
+        int expected = i == 0 ? 2 : 1;
+        if (socks[i] < 0 || read_responses(socks[i], buffer, sizeof(buffer), expected) != expected ||
+            !strstr(buffer, "\"slow\":true") || (i == 0 && !strstr(buffer, "hello"))) {
+            slow_ok = 0;
+        }
+        if (socks[i] >= 0) close(socks[i]);
+    }
+    double total_ms = elapsed_ms(&start);
+
+    if (fast_ok && fast_ms < 250 && slow_ok && total_ms < 550) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (fast=%d %.0fms slow=%d total=%.0fms)\n", fast_ok, fast_ms, slow_ok, total_ms);
+        tests_failed++;
+    }
+}
+
+// Helper: Send `request` in pieces `interval_us` apart (a slowloris client), then read until
+// the server closes. Returns how long that took and leaves the response in buffer.
+static double timed_exchange(const char* request, size_t piece, int interval_us, char* buffer, size_t size) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int sock = open_connection();
+    buffer[0] = '\0';
+    if (sock < 0) return -1;
+
+    size_t length = strlen(request);
+    for (size_t sent = 0; sent < length; sent += piece) {
+        size_t n = length - sent < piece ? length - sent : piece;
+        if (write(sock, request + sent, n) < 0) break;
+        usleep(interval_us);
+    }
+    size_t total = 0;
+    ssize_t n;
+    while (total < size - 1 && (n = read(sock, buffer + total, size - total - 1)) > 0) {
+        total += n;
+    }
+    buffer[total] = '\0';
+    close(sock);
+    return elapsed_ms(&start);
+}
+
+static void test_request_timeouts() {
+    printf("TEST: Header, body and handler timeouts... ");
+
+    char silent[1024], slowloris[1024], body[1024], handler[1024];
+    // Connects and sends nothing
+    double silent_ms = timed_exchange("", 1, 0, silent, sizeof(silent));
+    // Keeps the head open with a byte every 100 ms: the header deadline is not pushed back
+    double slowloris_ms = timed_exchange("GET /hello HTTP/1.1\r\nHost: localhost\r\nX-Padding: aaaaaaaaaaaaaaaaaaaaaa",
+                                         1, 100000, slowloris, sizeof(slowloris));
+    // Stops halfway through the body
+    double body_ms = timed_exchange("POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 10\r\n\r\nabc",
+                                    1024, 0, body, sizeof(body));
+    // Outlives handler_timeout_ms on a worker
+    double handler_ms = timed_exchange("GET /slow?ms=1500 HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                                       1024, 0, handler, sizeof(handler));
+
+    int silent_ok = strstr(silent, "HTTP/1.1 408") && silent_ms < 1500;
+    int slowloris_ok = strstr(slowloris, "HTTP/1.1 408") && slowloris_ms < 1500;
+    int body_ok = strstr(body, "HTTP/1.1 408") && body_ms < 1500;
+    int handler_ok = strstr(handler, "HTTP/1.1 504") && handler_ms < 1400;
+    if (silent_ok && slowloris_ok && body_ok && handler_ok) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (silent=%d %.0fms slowloris=%d %.0fms body=%d %.0fms handler=%d %.0fms)\n",
+               silent_ok, silent_ms, slowloris_ok, slowloris_ms, body_ok, body_ms, handler_ok, handler_ms);
+        tests_failed++;
+    }
+}
+
+static void test_streaming_backpressure() {
+    printf("TEST: Streaming writer blocks for slow clients and fails on disconnect... ");
+
+    int sock = open_connection();
+    if (sock < 0) {
+        printf("FAIL (connect)\n");
+        tests_failed++;
+        return;
+    }
+
+    const char* request = "GET /stream_forever HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(sock, request, strlen(request));
+
+    // Without backpressure the handler would keep buffering while nobody reads
+    char buffer[4096];
+    usleep(300000);
+    ssize_t n = read(sock, buffer, sizeof(buffer));
+    int still_running = !stream_write_failed;
+    close(sock);
+
+    for (int i = 0; i < 200 && !stream_write_failed; i++) {
+        usleep(10000);
+    }
+
+    if (n > 0 && still_running && stream_write_failed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (read=%zd running=%d failed=%d)\n", n, still_running, stream_write_failed);
+        tests_failed++;
+    }
+}
+
+// Helper: Read until `pattern` shows up, giving up after one second
+static int read_until(int sock, char* buffer, size_t buffer_size, const char* pattern) {
+    struct timeval timeout = {1, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    size_t total = strlen(buffer);
+    while (!strstr(buffer, pattern)) {
+        ssize_t n = read(sock, buffer + total, buffer_size - total - 1);
+        if (n <= 0) return 0;
+        total += n;
+        buffer[total] = '\0';
+    }
+    return 1;
+}
+
+static void test_server_sent_events() {
+    printf("TEST: Server-Sent Events fan-out and Last-Event-ID replay... ");
+
+    const char* subscribe = "GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    int first = open_connection();
+    int second = open_connection();
+    write(first, subscribe, strlen(subscribe));
+    write(second, subscribe, strlen(subscribe));
+
+    char buffer_a[4096] = "", buffer_b[4096] = "";
+    int subscribed = read_until(first, buffer_a, sizeof(buffer_a), "\r\n\r\n") &&
+                     read_until(second, buffer_b, sizeof(buffer_b), "\r\n\r\n") &&
+                     strstr(buffer_a, "Content-Type: text/event-stream");
+
+    // Both subscribers get the event, each data line framed separately
+    long long id = sse_publish(events_stream, "token", "a\nb");
+    const char* expected = "id: 1\nevent: token\ndata: a\ndata: b\n\n";
+    int fan_out = id == 1 && read_until(first, buffer_a, sizeof(buffer_a), expected) &&
+                  read_until(second, buffer_b, sizeof(buffer_b), expected);
+    close(first);
+    close(second);
+
+    // A reconnecting client only gets what it missed
+    sse_publish(events_stream, NULL, "two");
+    sse_publish(events_stream, NULL, "three");
+    int again = open_connection();
+    const char* resume = "GET /events HTTP/1.1\r\nHost: localhost\r\nLast-Event-ID: 1\r\n\r\n";
+    write(again, resume, strlen(resume));
+    char buffer_c[4096] = "";
+    int replayed = read_until(again, buffer_c, sizeof(buffer_c), "id: 3\ndata: three\n\n") &&
+                   strstr(buffer_c, "id: 2\ndata: two\n\n") && !strstr(buffer_c, "id: 1\n");
+    close(again);
+
+    if (subscribed && fan_out && replayed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (subscribed=%d fan_out=%d replayed=%d)\n", subscribed, fan_out, replayed);
+        tests_failed++;
+    }
+}
+
+static void test_sse_slow_subscriber() {
+    printf("TEST: Server-Sent Events subscriber that stops reading is dropped... ");
+    usleep(200000); // Let the server see earlier tests' connections close
+
+    // A small receive buffer, set before connecting so the window stays small
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int small = 4096;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    inet_pton(AF_INET, TEST_HOST, &addr.sin_addr);
+    int subscribed = connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+
+    const char* subscribe = "GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    write(sock, subscribe, strlen(subscribe));
+    char head[4096] = "";
+    subscribed = subscribed && read_until(sock, head, sizeof(head), "\r\n\r\n");
+
+    // Publish far more than the socket buffers and SSE_MAX_BUFFERED hold, never reading
+    char* data = malloc(64 * 1024 + 1);
+    memset(data, 'x', 64 * 1024);
+    data[64 * 1024] = '\0';
+    for (int i = 0; i < 400; i++) {
+        sse_publish(events_stream, NULL, data);
+        usleep(1000);
+    }
+    free(data);
+    usleep(100000);
+
+    // Still not reading: the subscriber's connection must be gone already, so the whole
+    // per-address allowance is free again
+    int socks[TEST_MAX_CONNECTIONS_PER_IP];
+    char buffer[4096];
+    int dropped = 1;
+    const char* request = "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (int i = 0; i < TEST_MAX_CONNECTIONS_PER_IP; i++) {
+        socks[i] = open_connection();
+        if (socks[i] < 0 || write(socks[i], request, strlen(request)) < 0 ||
+            read_responses(socks[i], buffer, sizeof(buffer), 1) != 1 || !strstr(buffer, "hello")) {
+            dropped = 0;
+        }
+    }
+    for (int i = 0; i < TEST_MAX_CONNECTIONS_PER_IP; i++) {
+        if (socks[i] >= 0) close(socks[i]);
+    }
+    close(sock);
+    usleep(100000);
+
+    if (subscribed && dropped) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (subscribed=%d dropped=%d)\n", subscribed, dropped);
+        tests_failed++;
+    }
+}
+
+#define UPLOAD_SIZE (32 * 1024 * 1024)
+
+static void test_streaming_upload() {
+    printf("TEST: 32MB streaming upload with Expect: 100-continue... ");
+
+    int sock = open_connection();
+    char head[256];
+    snprintf(head, sizeof(head),
+        "POST /upload HTTP/1.1\r\nHost: localhost\r\nContent-Length: %d\r\nExpect: 100-continue\r\n\r\n",
+        UPLOAD_SIZE);
+    write(sock, head, strlen(head));
+
+    char buffer[4096] = "";
+    int continued = read_until(sock, buffer, sizeof(buffer), "\r\n\r\n") &&
+                    strncmp(buffer, "HTTP/1.1 100 Continue\r\n\r\n", 25) == 0;
+
+    char chunk[65536];
+    unsigned int checksum = 0;
+    for (size_t sent = 0; sent < UPLOAD_SIZE; sent += sizeof(chunk)) {
+        for (size_t i = 0; i < sizeof(chunk); i++) {
+            chunk[i] = (char)((sent + i) * 7);
+            checksum = checksum * 31 + (unsigned char)chunk[i];
+        }
+        if (write(sock, chunk, sizeof(chunk)) != sizeof(chunk)) break;
+    }
+
+    buffer[0] = '\0';
+    char expected[64];
+    snprintf(expected, sizeof(expected), "{\"received\": %d}", UPLOAD_SIZE);
+    int answered = read_until(sock, buffer, sizeof(buffer), expected) && strstr(buffer, "HTTP/1.1 200 OK");
+    close(sock);
+
+    // Chunks come straight from the connection's read buffer, never the whole body
+    int bounded = last_upload.received == UPLOAD_SIZE && last_upload.largest_chunk <= 64 * 1024 &&
+                  last_upload.checksum == checksum;
+
+    if (continued && answered && bounded) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (continued=%d answered=%d received=%zu largest=%zu)\n",
+               continued, answered, last_upload.received, last_upload.largest_chunk);
+        tests_failed++;
+    }
+}
+
+static void test_body_limits() {
+    printf("TEST: 413 and 417 before the body is sent... ");
+
+    // Over the default 16 MiB limit for buffered handlers; the body is never sent
+    int sock = open_connection();
+    const char* too_large = "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 1073741824\r\n"
+                            "Expect: 100-continue\r\n\r\n";
+    write(sock, too_large, strlen(too_large));
+    char buffer[4096] = "";
+    int rejected = read_until(sock, buffer, sizeof(buffer), "\r\n\r\n") &&
+                   strncmp(buffer, "HTTP/1.1 413 Content Too Large", 30) == 0;
+    close(sock);
+
+    sock = open_connection();
+    const char* unknown = "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 4\r\n"
+                          "Expect: something-else\r\n\r\n";
+    write(sock, unknown, strlen(unknown));
+    buffer[0] = '\0';
+    int expectation_failed = read_until(sock, buffer, sizeof(buffer), "\r\n\r\n") &&
+                             strncmp(buffer, "HTTP/1.1 417 Expectation Failed", 31) == 0;
+    close(sock);
+
+    if (rejected && expectation_failed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (413=%d 417=%d)\n", rejected, expectation_failed);
+        tests_failed++;
+    }
+}
+
+// Two fields and two files, the second holding NUL bytes and near-miss delimiters
+static size_t build_multipart_body(char* body, char* file_data, size_t file_size) {
+    for (size_t i = 0; i < file_size; i++) {
+        file_data[i] = (char)(i * 13);
+    }
+    memcpy(file_data + 100, "\r\n--XyZbound", 13);  // Delimiter prefix that is not a delimiter
+    memcpy(file_data + file_size - 5, "\r\n--X", 5);
+
+    size_t length = sprintf(body,
+        "preamble\r\n"
+        "--XyZboundary\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+        "My Mix\r\n"
+        "--XyZboundary\r\n"
+        "Content-Disposition: form-data; name=\"empty\"\r\n\r\n"
+        "\r\n"
+        "--XyZboundary\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"a.mp3\"\r\n"
+        "Content-Type: audio/mpeg\r\n\r\n"
+        "ID3abc\r\n"
+        "--XyZboundary\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"b.mp3\"\r\n"
+        "Content-Type: audio/mpeg\r\n\r\n");
+    memcpy(body + length, file_data, file_size);
+    length += file_size;
+    length += sprintf(body + length, "\r\n--XyZboundary--\r\nepilogue");
+    return length;
+}
+
+static unsigned int checksum_of(const char* data, size_t length) {
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < length; i++) {
+        checksum = checksum * 31 + (unsigned char)data[i];
+    }
+    return checksum;
+}
+
+static void test_multipart_upload() {
+    printf("TEST: Multipart upload parsed incrementally and spooled... ");
+
+    size_t file_size = 300000;
+    char* file_data = malloc(file_size);
+    char* body = malloc(file_size + 4096);
+    size_t body_length = build_multipart_body(body, file_data, file_size);
+
+    char expected[512];
+    snprintf(expected, sizeof(expected), "title::6:%u;empty::0:0;file:a.mp3:6:%u;file:b.mp3:%zu:%u;",
+             checksum_of("My Mix", 6), checksum_of("ID3abc", 6), file_size, checksum_of(file_data, file_size));
+
+    // The parser alone, fed one byte at a time so every delimiter straddles feeds
+    MultipartSpool* spool = multipart_spool_create("multipart/form-data; boundary=XyZboundary", "/tmp");
+    int fed = 1;
+    for (size_t i = 0; i < body_length && fed; i++) {
+        fed = multipart_spool_feed(spool, body + i, 1) == 0;
+    }
+    char parsed[512] = "";
+    size_t offset = 0;
+    for (int i = 0; fed && multipart_spool_finish(spool) == 0 && i < multipart_spool_count(spool); i++) {
+        const SpooledPart* part = multipart_spool_part(spool, i);
+        offset += snprintf(parsed + offset, sizeof(parsed) - offset, "%s:%s:%zu:%u;",
+                           part->info.name, part->info.filename, part->size, checksum_of(part->data, part->size));
+    }
+    multipart_spool_free(spool);
+    int byte_at_a_time = strcmp(parsed, expected) == 0;
+
+    // The buffered helper finds the first file part
+    RequestContext context = {0};
+    context.content_type = "multipart/form-data; boundary=XyZboundary";
+    context.body = body;
+    context.body_length = body_length;
+    UploadedFile uploaded_file;
+    int buffered = parse_multipart_file(&context, &uploaded_file) == 0 &&
+                   strcmp(uploaded_file.filename, "a.mp3") == 0 && uploaded_file.size == 6 &&
+                   memcmp(uploaded_file.data, "ID3abc", 6) == 0;
+
+    // Through the server as a streamed body
+    int sock = open_connection();
+    char head[256];
+    int head_length = snprintf(head, sizeof(head),
+        "POST /form HTTP/1.1\r\nHost: localhost\r\n"
+        "Content-Type: multipart/form-data; boundary=\"XyZboundary\"\r\nContent-Length: %zu\r\n\r\n",
+        body_length);
+    write(sock, head, head_length);
+    for (size_t sent = 0; sent < body_length; ) {
+        ssize_t n = write(sock, body + sent, body_length - sent);
+        if (n <= 0) break;
+        sent += n;
+    }
+    char buffer[4096] = "";
+    int uploaded = read_until(sock, buffer, sizeof(buffer), expected) != 0;
+    close(sock);
+
+    free(body);
+    free(file_data);
+
+    if (byte_at_a_time && buffered && uploaded) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (byte_at_a_time=%d buffered=%d uploaded=%d: %s)\n", byte_at_a_time, buffered, uploaded, parsed);
+        tests_failed++;
+    }
+}
+
+static unsigned int crc32_of(const unsigned char* data, size_t length, unsigned int crc) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+#define RAW_UPLOAD_SIZE (8 * 1024 * 1024 + 123)
+
+static void test_raw_upload() {
+    printf("TEST: Raw upload spliced to a file with CRC-32... ");
+
+    int sock = open_connection();
+    char head[256];
+    int head_length = snprintf(head, sizeof(head),
+        "POST /raw HTTP/1.1\r\nHost: localhost\r\nContent-Length: %d\r\n\r\n", RAW_UPLOAD_SIZE);
+
+    // Part of the body rides along with the head, the rest arrives later
+    unsigned char chunk[65536];
+    unsigned int crc = 0;
+    memcpy(chunk, head, head_length);
+    for (size_t i = head_length; i < sizeof(chunk); i++) chunk[i] = (unsigned char)(i * 3);
+    crc = crc32_of(chunk + head_length, sizeof(chunk) - head_length, crc);
+    write(sock, chunk, sizeof(chunk));
+
+    size_t sent = sizeof(chunk) - head_length;
+    while (sent < RAW_UPLOAD_SIZE) {
+        size_t length = RAW_UPLOAD_SIZE - sent < sizeof(chunk) ? RAW_UPLOAD_SIZE - sent : sizeof(chunk);
+        for (size_t i = 0; i < length; i++) chunk[i] = (unsigned char)((sent + i) * 5);
+        crc = crc32_of(chunk, length, crc);
+        if (write(sock, chunk, length) != (ssize_t)length) break;
+        sent += length;
+    }
+
+    char buffer[4096] = "";
+    int answered = read_until(sock, buffer, sizeof(buffer), "\r\n\r\n");
+    char* body = strstr(buffer, "\r\n\r\n");
+    char path[256] = "";
+    size_t size = 0;
+    unsigned int reported_crc = 0;
+    int on_disk = 0;
+    if (answered && body) {
+        read_until(sock, buffer, sizeof(buffer), " 1");
+        sscanf(body + 4, "%255s %zu %x %d", path, &size, &reported_crc, &on_disk);
+    }
+    close(sock);
+
+    struct stat st;
+    int removed = path[0] && stat(path, &st) != 0;
+
+    if (answered && size == RAW_UPLOAD_SIZE && reported_crc == crc && on_disk && removed) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (size=%zu crc=%08x expected=%08x on_disk=%d removed=%d)\n",
+               size, reported_crc, crc, on_disk, removed);
+        tests_failed++;
+    }
+}
+
+// WebSocket client side of a test: the socket after its handshake, and bytes read from it
+// that are not decoded yet
+typedef struct {
+    int sock;
+    unsigned char* buffer;
+    size_t length;
+    size_t capacity;
+    size_t consumed;  // Frame returned by the last ws_test_read(), dropped on the next call
+} WsTestClient;
+
+// Helper: Upgrade a fresh connection on path. Returns -1 unless the server answers 101.
+static int ws_test_connect(WsTestClient* client, const char* path) {
+    memset(client, 0, sizeof(*client));
+    client->sock = open_connection();
+    if (client->sock < 0) return -1;
+    int one = 1;
+    setsockopt(client->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = {2, 0};
+    setsockopt(client->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char request[512];
+    snprintf(request, sizeof(request),
+             "GET %s HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+             "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n", path);
+    write(client->sock, request, strlen(request));
+
+    client->capacity = 64 * 1024;
+    client->buffer = malloc(client->capacity);
+    char* head_end = NULL;
+    while (!head_end) {
+        ssize_t n = read(client->sock, client->buffer + client->length, client->capacity - client->length - 1);
+        if (n <= 0) return -1;
+        client->length += n;
+        client->buffer[client->length] = '\0';
+        head_end = strstr((char*)client->buffer, "\r\n\r\n");
+    }
+    if (!strstr((char*)client->buffer, " 101 ")) return -1;
+
+    // Frames may follow the response head in the same read
+    size_t head_length = (unsigned char*)head_end + 4 - client->buffer;
+    memmove(client->buffer, client->buffer + head_length, client->length - head_length);
+    client->length -= head_length;
+    return 0;
+}
+
+static void ws_test_close(WsTestClient* client) {
+    if (client->sock >= 0) close(client->sock);
+    free(client->buffer);
+    client->buffer = NULL;
+}
+
+// Helper: Encode a masked client frame into out and return its length
+static size_t ws_test_frame(unsigned char* out, int opcode, int fin, const void* payload, size_t length) {
+    static const unsigned char mask[4] = {0x12, 0x34, 0x56, 0x78};
+    size_t header = 0;
+    out[header++] = (fin ? 0x80 : 0) | opcode;
+    if (length < 126) {
+        out[header++] = 0x80 | length;
+    } else if (length < 65536) {
+        out[header++] = 0x80 | 126;
+        out[header++] = length >> 8;
+        out[header++] = length & 0xFF;
+    } else {
+        out[header++] = 0x80 | 127;
+        for (int i = 7; i >= 0; i--) {
+            out[header++] = ((unsigned long long)length >> (i * 8)) & 0xFF;
+        }
+    }
+    memcpy(out + header, mask, 4);
+    header += 4;
+    for (size_t i = 0; i < length; i++) {
+        out[header + i] = ((const unsigned char*)payload)[i] ^ mask[i % 4];
+    }
+    return header + length;
+}
+
+static void ws_test_send(WsTestClient* client, int opcode, int fin, const void* payload, size_t length) {
+    unsigned char* frame = malloc(length + 14);
+    size_t frame_length = ws_test_frame(frame, opcode, fin, payload, length);
+    write(client->sock, frame, frame_length);
+    free(frame);
+}
+
+// Helper: Read the next server frame. Its payload stays valid until the next call.
+// Returns -1 on timeout or close.
+static int ws_test_read(WsTestClient* client, int* opcode, unsigned char** payload, size_t* length) {
+    memmove(client->buffer, client->buffer + client->consumed, client->length - client->consumed);
+    client->length -= client->consumed;
+    client->consumed = 0;
+
+    for (;;) {
+        if (client->length >= 2) {
+            size_t header = 2;
+            size_t payload_length = client->buffer[1] & 0x7F;
+            if (payload_length == 126) {
+                header = 4;
+                payload_length = client->length >= 4 ? (client->buffer[2] << 8 | client->buffer[3]) : 0;
+            } else if (payload_length == 127) {
+                header = 10;
+                payload_length = 0;
+                for (int i = 0; i < 8 && client->length >= 10; i++) {
+                    payload_length = payload_length << 8 | client->buffer[2 + i];
+                }
+            }
+            if (client->length >= header && client->length >= header + payload_length) {
+                *opcode = client->buffer[0] & 0x0F;
+                *payload = client->buffer + header;
+                *length = payload_length;
+                client->consumed = header + payload_length;
+                return 0;
+            }
+            if (header + payload_length + 1 > client->capacity) {
+                client->capacity = header + payload_length + 1;
+                client->buffer = realloc(client->buffer, client->capacity);
+            }
+        }
+        ssize_t n = read(client->sock, client->buffer + client->length, client->capacity - client->length);
+        if (n <= 0) return -1;
+        client->length += n;
+    }
+}
+
+// Helper: Read frames until a close frame arrives and return its status, or -1
+static int ws_test_close_status(WsTestClient* client) {
+    int opcode;
+    unsigned char* payload;
+    size_t length;
+    while (ws_test_read(client, &opcode, &payload, &length) == 0) {
+        if (opcode == 0x8) {
+            return length >= 2 ? (payload[0] << 8 | payload[1]) : 0;
+        }
+    }
+    return -1;
+}
+
+// Helper: Read one frame and compare it with the expected opcode and payload
+static int ws_test_expect(WsTestClient* client, int expected_opcode, const void* expected, size_t expected_length) {
+    int opcode;
+    unsigned char* payload;
+    size_t length;
+    return ws_test_read(client, &opcode, &payload, &length) == 0 && opcode == expected_opcode &&
+           length == expected_length && memcmp(payload, expected, length) == 0;
+}
+
+static void test_ws_frame_reads() {
+    printf("TEST: WebSocket frames split across reads and batched in one read... ");
+
+    WsTestClient client;
+    if (ws_test_connect(&client, "/ws/echo") != 0) {
+        printf("FAIL (handshake)\n");
+        tests_failed++;
+        ws_test_close(&client);
+        return;
+    }
+
+    // One frame with a 16-bit length, trickled a few bytes at a time: the header, mask and
+    // payload all end up cut between reads
+    char text[300];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = 'a' + i % 26;
+    }
+    unsigned char frame[70000];
+    size_t frame_length = ws_test_frame(frame, 0x1, 1, text, sizeof(text));
+    for (size_t offset = 0; offset < frame_length; offset += 7) {
+        size_t piece = frame_length - offset < 7 ? frame_length - offset : 7;
+        write(client.sock, frame + offset, piece);
+        usleep(1000);
+    }
+    int split = ws_test_expect(&client, 0x1, text, sizeof(text));
+
+    // A larger binary frame in two writes, cut inside the payload
+    unsigned char* blob = malloc(60000);
+    for (size_t i = 0; i < 60000; i++) {
+        blob[i] = (unsigned char)(i * 7);
+    }
+    frame_length = ws_test_frame(frame, 0x2, 1, blob, 60000);
+    write(client.sock, frame, 30001);
+    usleep(20000);
+    write(client.sock, frame + 30001, frame_length - 30001);
+    int large = ws_test_expect(&client, 0x2, blob, 60000);
+    free(blob);
+
+    // Many small frames in one write are answered in order
+    size_t batch_length = 0;
+    for (int i = 0; i < 200; i++) {
+        char message[16];
+        int length = snprintf(message, sizeof(message), "m%d", i);
+        batch_length += ws_test_frame(frame + batch_length, 0x1, 1, message, length);
+    }
+    write(client.sock, frame, batch_length);
+    int batched = 0;
+    for (int i = 0; i < 200; i++) {
+        char message[16];
+        int length = snprintf(message, sizeof(message), "m%d", i);
+        if (!ws_test_expect(&client, 0x1, message, length)) break;
+        batched++;
+    }
+    ws_test_close(&client);
+
+    // Clients must mask their frames; an unmasked one fails the connection
+    int unmasked = -1;
+    if (ws_test_connect(&client, "/ws/echo") == 0) {
+        const unsigned char plain[] = {0x81, 0x02, 'h', 'i'};
+        write(client.sock, plain, sizeof(plain));
+        unmasked = ws_test_close_status(&client);
+    }
+    ws_test_close(&client);
+
+    if (split && large && batched == 200 && unmasked == 1002) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (split=%d large=%d batched=%d unmasked=%d)\n", split, large, batched, unmasked);
+        tests_failed++;
+    }
+}
+
+static void test_ws_fragments() {
+    printf("TEST: WebSocket fragmented messages and size limits... ");
+
+    // Fragments are joined into one message; a ping between them is answered right away
+    int joined = 0;
+    WsTestClient client;
+    if (ws_test_connect(&client, "/ws/echo") == 0) {
+        ws_test_send(&client, 0x1, 0, "Hello, ", 7);
+        ws_test_send(&client, 0x9, 1, "ping", 4);
+        ws_test_send(&client, 0x0, 0, "fragmented ", 11);
+        ws_test_send(&client, 0x0, 1, "world", 5);
+        joined = ws_test_expect(&client, 0xA, "ping", 4) &&
+                 ws_test_expect(&client, 0x1, "Hello, fragmented world", 23);
+    }
+    ws_test_close(&client);
+
+    char* data = malloc(TEST_WS_MAX_MESSAGE + 1);
+    memset(data, 'x', TEST_WS_MAX_MESSAGE + 1);
+
+    // One frame over ws_max_frame_size
+    int frame_status = -1;
+    if (ws_test_connect(&client, "/ws/echo") == 0) {
+        ws_test_send(&client, 0x2, 1, data, TEST_WS_MAX_FRAME + 1);
+        frame_status = ws_test_close_status(&client);
+    }
+    ws_test_close(&client);
+
+    // Fragments that each fit, but together go over ws_max_message_size
+    int message_status = -1;
+    if (ws_test_connect(&client, "/ws/echo") == 0) {
+        size_t fragment = TEST_WS_MAX_FRAME / 2;
+        size_t sent = 0;
+        ws_test_send(&client, 0x2, 0, data, fragment);
+        for (sent = fragment; sent + fragment <= TEST_WS_MAX_MESSAGE; sent += fragment) {
+            ws_test_send(&client, 0x0, 0, data, fragment);
+        }
+        ws_test_send(&client, 0x0, 1, data, TEST_WS_MAX_MESSAGE + 1 - sent);
+        message_status = ws_test_close_status(&client);
+    }
+    ws_test_close(&client);
+    free(data);
+
+    if (joined && frame_status == 1009 && message_status == 1009) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (joined=%d frame=%d message=%d)\n", joined, frame_status, message_status);
+        tests_failed++;
+    }
+}
+
+static void test_ws_path_params() {
+    printf("TEST: WebSocket route captures... ");
+
+    WsTestClient client;
+    int captured = ws_test_connect(&client, "/ws/rooms/team%20a") == 0 &&
+                   ws_test_expect(&client, 0x1, "team a", 6);
+    ws_test_close(&client);
+
+    if (captured) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL\n");
+        tests_failed++;
+    }
+}
+
+static void test_ws_backpressure() {
+    printf("TEST: WebSocket send backpressure and on_drain... ");
+
+    WsTestClient client;
+    if (ws_test_connect(&client, "/ws/flood") != 0) {
+        printf("FAIL (handshake)\n");
+        tests_failed++;
+        ws_test_close(&client);
+        return;
+    }
+
+    // Stop reading while another thread floods the client, so the send queue backs up
+    ws_test_send(&client, 0x1, 1, "flood", 5);
+    usleep(300000);
+
+    int opcode;
+    unsigned char* payload;
+    size_t length;
+    int frames = 0;
+    int intact = 1;
+    while (ws_test_read(&client, &opcode, &payload, &length) == 0 && opcode == 0x2) {
+        int seq;
+        memcpy(&seq, payload, sizeof(seq));
+        if (length != TEST_WS_FLOOD_FRAME || seq != frames || payload[length - 1] != (frames & 0xFF)) intact = 0;
+        frames++;
+    }
+    char expected[64];
+    snprintf(expected, sizeof(expected), "sent:%d:backpressure", frames);
+    int summary = opcode == 0x1 && length == strlen(expected) && memcmp(payload, expected, length) == 0;
+    int drained = ws_test_expect(&client, 0x1, "drained", 7);
+    ws_test_close(&client);
+
+    if (frames > 0 && intact && summary && drained) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (frames=%d intact=%d summary=%d drained=%d)\n", frames, intact, summary, drained);
+        tests_failed++;
+    }
+}
+
+static void test_ws_idle_timeout() {
+    printf("TEST: WebSocket idle timeout closes with 1001... ");
+
+    WsTestClient client;
+    if (ws_test_connect(&client, "/ws/echo") != 0) {
+        printf("FAIL (handshake)\n");
+        tests_failed++;
+        ws_test_close(&client);
+        return;
+    }
+
+    // A ping half way through restarts the idle timer
+    usleep(TEST_WS_IDLE_TIMEOUT_MS / 2 * 1000);
+    ws_test_send(&client, 0x9, 1, "", 0);
+    int pong = ws_test_expect(&client, 0xA, "", 0);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = ws_test_close_status(&client);
+    double idle_ms = elapsed_ms(&start);
+    ws_test_close(&client);
+
+    if (pong && status == 1001 && idle_ms > TEST_WS_IDLE_TIMEOUT_MS - 200) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (pong=%d status=%d idle=%.0fms)\n", pong, status, idle_ms);
+        tests_failed++;
+    }
+}
+
+static void test_ws_blocking_handler() {
+    printf("TEST: Blocking WebSocket handlers run on workers in order... ");
+
+    WsTestClient client;
+    if (ws_test_connect(&client, "/ws/blocking") != 0) {
+        printf("FAIL (handshake)\n");
+        tests_failed++;
+        ws_test_close(&client);
+        return;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned char batch[64];
+    size_t batch_length = ws_test_frame(batch, 0x1, 1, "a", 1);
+    batch_length += ws_test_frame(batch + batch_length, 0x1, 1, "b", 1);
+    batch_length += ws_test_frame(batch + batch_length, 0x1, 1, "c", 1);
+    write(client.sock, batch, batch_length);
+    usleep(50000);
+
+    // The reactor keeps serving while the handler sleeps
+    size_t len;
+    char* fast = send_http_request("GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n", &len);
+    double fast_ms = elapsed_ms(&start);
+    int fast_ok = fast && strstr(fast, "hello") != NULL;
+    free(fast);
+
+    // One message at a time per client, so the replies keep the order the messages had
+    int ordered = ws_test_expect(&client, 0x1, "a:0", 3) && ws_test_expect(&client, 0x1, "b:0", 3) &&
+                  ws_test_expect(&client, 0x1, "c:0", 3);
+    double total_ms = elapsed_ms(&start);
+    ws_test_close(&client);
+
+    if (fast_ok && fast_ms < 150 && ordered && total_ms >= 550) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (fast=%d %.0fms ordered=%d total=%.0fms)\n", fast_ok, fast_ms, ordered, total_ms);
+        tests_failed++;
+    }
+}
+
+static void test_ws_blocking_handler_sends() {
+    printf("TEST: Blocking WebSocket handlers send before they return... ");
+
+    WsTestClient client;
+    if (ws_test_connect(&client, "/ws/blocking") != 0) {
+        printf("FAIL (handshake)\n");
+        tests_failed++;
+        ws_test_close(&client);
+        return;
+    }
+
+    // The pong is queued on the loop right before the message goes to a worker; neither it
+    // nor what the handler sends before sleeping may wait for the handler to return
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned char batch[64];
+    size_t batch_length = ws_test_frame(batch, 0x9, 1, "p", 1);
+    batch_length += ws_test_frame(batch + batch_length, 0x1, 1, "early", 5);
+    write(client.sock, batch, batch_length);
+
+    int pong = ws_test_expect(&client, 0xA, "p", 1);
+    int started = ws_test_expect(&client, 0x1, "started", 7);
+    double started_ms = elapsed_ms(&start);
+    int finished = ws_test_expect(&client, 0x1, "early:0", 7);
+    ws_test_close(&client);
+
+    if (pong && started && started_ms < 150 && finished) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (pong=%d started=%d %.0fms finished=%d)\n", pong, started, started_ms, finished);
+        tests_failed++;
+    }
+}
+
+static void test_connection_limits() {
+    printf("TEST: Connections past the per-address limit get 503... ");
+    usleep(200000); // Let the server see earlier tests' connections close
+
+    int socks[TEST_MAX_CONNECTIONS_PER_IP];
+    char buffer[4096];
+    int admitted = 1;
+    const char* request = "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    for (int i = 0; i < TEST_MAX_CONNECTIONS_PER_IP; i++) {
+        socks[i] = open_connection();
+        if (socks[i] < 0 || write(socks[i], request, strlen(request)) < 0 ||
+            read_responses(socks[i], buffer, sizeof(buffer), 1) != 1 || !strstr(buffer, "hello")) {
+            admitted = 0;
+        }
+    }
+
+    // Refused with the canned response before anything is read
+    int extra = open_connection();
+    int shed = extra >= 0 && read_responses(extra, buffer, sizeof(buffer), 1) == 1 &&
+               strstr(buffer, "HTTP/1.1 503") && strstr(buffer, "Retry-After: 1");
+    if (extra >= 0) close(extra);
+
+    for (int i = 0; i < TEST_MAX_CONNECTIONS_PER_IP; i++) {
+        if (socks[i] >= 0) close(socks[i]);
+    }
+    usleep(100000);
+    char* response = send_http_request(request, NULL);
+    int recovered = response && strstr(response, "hello") != NULL;
+    free(response);
+
+    if (admitted && shed && recovered) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (admitted=%d shed=%d recovered=%d)\n", admitted, shed, recovered);
+        tests_failed++;
+    }
+}
+
+static void test_no_allocations_on_hot_path() {
+    printf("TEST: Keep-alive JSON requests make no heap allocations... ");
+
+    const char* requests =
+        "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "GET /params?name=Ann&age=7 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+        "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 11\r\n\r\nhello world"
+        "GET /missing HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    int sock = open_connection();
+    char buffer[8192];
+    int ok = 1;
+    long before = 0;
+
+    // The first rounds fill the buffer pool; after that every request must be served from it
+    // (20 rounds stay under the default 100 requests per connection)
+    for (int round = 0; round < 20 && ok; round++) {
+        if (round == 5) before = __atomic_load_n(&server_allocations, __ATOMIC_RELAXED);
+        write(sock, requests, strlen(requests));
+        ok = read_responses(sock, buffer, sizeof(buffer), 4) == 4 && strstr(buffer, "\"received\":\"hello world\"");
+    }
+    long allocations = __atomic_load_n(&server_allocations, __ATOMIC_RELAXED) - before;
+    close(sock);
+
+    if (ok && allocations == 0) {
+        printf("PASS\n");
+        tests_passed++;
+    } else {
+        printf("FAIL (ok=%d allocations=%ld)\n", ok, allocations);
+        tests_failed++;
+    }
+}
+
 int main() {
     printf("=== HTTP Endpoint Tests ===\n\n");
     
     // Initialize server
-    if (server_init(TEST_PORT) != 0) {
+    ServerConfig config;
+    server_config_default(&config);
+    config.max_connections_per_ip = TEST_MAX_CONNECTIONS_PER_IP;
+    config.header_timeout_ms = TEST_REQUEST_TIMEOUT_MS;
+    config.body_timeout_ms = TEST_REQUEST_TIMEOUT_MS;
+    config.handler_timeout_ms = 2 * TEST_REQUEST_TIMEOUT_MS;
+    config.ws_max_frame_size = TEST_WS_MAX_FRAME;
+    config.ws_max_message_size = TEST_WS_MAX_MESSAGE;
+    config.ws_send_high_watermark = 256 * 1024;
+    config.ws_send_low_watermark = 64 * 1024;
+    config.ws_idle_timeout_ms = TEST_WS_IDLE_TIMEOUT_MS;
+    if (server_init_with_config(TEST_PORT, &config) != 0) {
         fprintf(stderr, "Failed to initialize server\n");
         return 1;
     }
@@ -293,8 +2240,30 @@ int main() {
     SERVER_GET("/hello", handle_get_hello);
     SERVER_GET("/params", handle_get_with_params);
     SERVER_POST("/echo", handle_post_echo);
+    SERVER_GET("/status", handle_status);
+    SERVER_GET_BLOCKING("/slow", handle_slow);
+    SERVER_GET("/query", handle_query);
+    SERVER_GET("/sessions/:id/audio", handle_route);
+    server_register_handler("/sessions/:id/audio", "PUT", handle_route);
+    SERVER_GET("/sessions/latest/audio", handle_route);
+    SERVER_GET("/personas/*rest", handle_route);
     SERVER_GET("/binary", handle_binary_data);
     SERVER_GET("/large", handle_large_response);
+    SERVER_GET("/headers", handle_headers);
+    SERVER_GET("/blob", handle_blob);
+    SERVER_GET("/file", handle_file);
+    SERVER_GET("/range_file", handle_range_file);
+    SERVER_STREAM("/stream", handle_stream_tokens);
+    SERVER_STREAM("/stream_forever", handle_stream_forever);
+    events_stream = sse_stream_create(16);
+    SERVER_SSE("/events", handle_events);
+    SERVER_UPLOAD("/upload", handle_upload_begin, handle_upload_data, handle_upload_end, handle_upload_abort);
+    server_register_raw_upload_handler("/raw", "POST", "/tmp", RAW_UPLOAD_CRC32, handle_raw_upload);
+    SERVER_UPLOAD("/form", handle_form_begin, handle_form_data, handle_form_end, handle_form_abort);
+    server_register_ws_handler("/ws/echo", (WsHandlers){.on_message = handle_ws_echo});
+    server_register_ws_handler("/ws/flood", (WsHandlers){.on_message = handle_ws_flood, .on_drain = handle_ws_flood_drain});
+    server_register_ws_handler("/ws/rooms/:room", (WsHandlers){.on_connect = handle_ws_room_connect});
+    server_register_ws_handler("/ws/blocking", (WsHandlers){.on_message = handle_ws_blocking, .flags = HANDLER_BLOCKING});
     
     // Start server in background thread
     pthread_create(&server_thread, NULL, server_thread_func, NULL);
@@ -303,11 +2272,42 @@ int main() {
     // Run tests
     test_get_request();
     test_get_with_query_params();
+    test_query_decoding();
     test_post_request();
     test_binary_response();
     test_large_response();
     test_404_not_found();
+    test_status_lines();
+    test_routing();
     test_multiple_requests();
+    test_keep_alive_pipelining();
+    test_no_allocations_on_hot_path();
+    test_http10_closes();
+    test_chunked_request_rejected();
+    test_transfer_encoding_with_content_length();
+    test_split_request_headers();
+    test_large_headers();
+    test_large_binary_slow_reader();
+    test_file_response();
+    test_file_conditional_and_range();
+    test_streaming_response();
+    test_blocking_handlers();
+    test_request_timeouts();
+    test_streaming_backpressure();
+    test_server_sent_events();
+    test_sse_slow_subscriber();
+    test_streaming_upload();
+    test_body_limits();
+    test_multipart_upload();
+    test_raw_upload();
+    test_ws_frame_reads();
+    test_ws_fragments();
+    test_ws_path_params();
+    test_ws_backpressure();
+    test_ws_idle_timeout();
+    test_ws_blocking_handler();
+    test_ws_blocking_handler_sends();
+    test_connection_limits();
     
     // Print results
     printf("\n=== Results ===\n");
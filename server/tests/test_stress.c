@@ -293,8 +293,8 @@ int main() {
     
     // Register test endpoints
     SERVER_GET("/fast", handle_fast);
-    SERVER_GET("/slow", handle_slow);
-    SERVER_GET("/compute", handle_compute);
+    SERVER_GET_BLOCKING("/slow", handle_slow);
+    server_register_handler_flags("/compute", "GET", handle_compute, HANDLER_CPU_HEAVY);
     SERVER_GET("/large", handle_large_payload);
     SERVER_POST("/post_large", handle_post_large);
     
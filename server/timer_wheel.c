@@ -0,0 +1,132 @@
+#include "timer_wheel.h"
+#include <string.h>
+#include <limits.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now_ms) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now_ms = now_ms;
+}
+
+// Links timer into the lowest level whose span covers its deadline
+static void insert(TimerWheel* wheel, Timer* timer) {
+    uint64_t delta = timer->deadline_ms - wheel->now_ms;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1ULL << ((level + 1) * TIMER_WHEEL_SLOT_BITS))) {
+        level++;
+    }
+
+    Timer** slot = &wheel->slots[level][(timer->deadline_ms >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK];
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+    timer->slot = slot;
+}
+
+static void unlink_timer(Timer* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->slot = NULL;
+}
+
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t deadline_ms) {
+    if (timer->slot) {
+        unlink_timer(timer);
+        wheel->count--;
+    }
+    if (deadline_ms <= wheel->now_ms) {
+        deadline_ms = wheel->now_ms + 1;
+    } else if (deadline_ms - wheel->now_ms > TIMER_WHEEL_MAX_DELAY_MS) {
+        deadline_ms = wheel->now_ms + TIMER_WHEEL_MAX_DELAY_MS;
+    }
+    timer->deadline_ms = deadline_ms;
+    insert(wheel, timer);
+    wheel->count++;
+}
+
+void timer_cancel(TimerWheel* wheel, Timer* timer) {
+    if (!timer->slot) return;
+    unlink_timer(timer);
+    wheel->count--;
+}
+
+// The next tick that fires a timer or moves a higher-level slot down, or UINT64_MAX
+static uint64_t next_event(const TimerWheel* wheel) {
+    if (wheel->count == 0) return UINT64_MAX;
+
+    uint64_t best = UINT64_MAX;
+    for (uint64_t i = 1; i < TIMER_WHEEL_SLOTS; i++) {
+        if (wheel->slots[0][(wheel->now_ms + i) & SLOT_MASK]) {
+            best = wheel->now_ms + i;
+            break;
+        }
+    }
+
+    // A higher-level slot is moved down when the wheel reaches the start of its span
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = level * TIMER_WHEEL_SLOT_BITS;
+        uint64_t position = wheel->now_ms >> shift;
+        for (uint64_t i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+            if (wheel->slots[level][(position + i) & SLOT_MASK]) {
+                uint64_t start = (position + i) << shift;
+                if (start < best) best = start;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now_ms) {
+    while (wheel->now_ms < now_ms) {
+        // Ticks with nothing to do are skipped, so a long sleep costs nothing
+        uint64_t tick = next_event(wheel);
+        if (tick > now_ms) {
+            wheel->now_ms = now_ms;
+            return;
+        }
+        wheel->now_ms = tick;
+
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            int shift = level * TIMER_WHEEL_SLOT_BITS;
+            if (tick & ((1ULL << shift) - 1)) break;
+
+            Timer** slot = &wheel->slots[level][(tick >> shift) & SLOT_MASK];
+            Timer* timer = *slot;
+            *slot = NULL;
+            while (timer) {
+                Timer* next = timer->next;
+                insert(wheel, timer);
+                timer = next;
+            }
+        }
+
+        // Everything left in this slot is due now; a callback may cancel the timers after it
+        Timer** slot = &wheel->slots[0][tick & SLOT_MASK];
+        while (*slot) {
+            Timer* timer = *slot;
+            unlink_timer(timer);
+            wheel->count--;
+            timer->on_expire(timer);
+        }
+    }
+}
+
+int timer_wheel_timeout(const TimerWheel* wheel) {
+    uint64_t tick = next_event(wheel);
+    if (tick == UINT64_MAX) return -1;
+    uint64_t delay = tick - wheel->now_ms;
+    return delay > INT_MAX ? INT_MAX : (int)delay;
+}
@@ -0,0 +1,49 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+// Longest delay the wheel holds (about 4.6 hours); later deadlines fire at this distance
+#define TIMER_WHEEL_MAX_DELAY_MS ((1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS)) - 1)
+
+// Embedded in the owner's struct; the callback gets it back and casts with offsetof
+typedef struct Timer {
+    void (*on_expire)(struct Timer* timer);
+    uint64_t deadline_ms;
+    struct Timer* next;
+    struct Timer* prev;
+    struct Timer** slot;  // List head the timer is on; NULL when not armed
+} Timer;
+
+// Hierarchical timing wheel with 1 ms ticks: level 0 has one slot per millisecond for the
+// next 64 ms, and each higher level has one slot per 64 slots of the level below. A timer
+// sits in the lowest level that covers its deadline and moves down as the wheel turns,
+// so arming and cancelling are O(1) no matter how many timers are pending.
+// Not thread-safe; each event loop owns one.
+typedef struct TimerWheel {
+    uint64_t now_ms;  // Every timer with an earlier or equal deadline has fired
+    int count;
+    Timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now_ms);
+
+// Arms (or re-arms) timer; a deadline that has already passed fires on the next advance
+void timer_arm(TimerWheel* wheel, Timer* timer, uint64_t deadline_ms);
+// Safe on a timer that is not armed
+void timer_cancel(TimerWheel* wheel, Timer* timer);
+
+static inline int timer_is_armed(const Timer* timer) {
+    return timer->slot != 0;
+}
+
+// Fires every timer due by now_ms, in deadline order. Callbacks may arm and cancel timers.
+void timer_wheel_advance(TimerWheel* wheel, uint64_t now_ms);
+
+// Milliseconds until timer_wheel_advance() has work to do, or -1 if no timer is armed
+int timer_wheel_timeout(const TimerWheel* wheel);
+
+#endif
@@ -1,16 +1,34 @@
 #define _GNU_SOURCE
 #include "websocket.h"
+#include "ws_mask.h"
+#include "endpoint.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <openssl/sha.h>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 #include <openssl/buffer.h>
 
-static WebSocketClient clients[WS_MAX_CLIENTS];
+#define WS_CLIENT_BUCKETS 1024
+
+// A client and its send queue, freed when the last reference is dropped
+typedef struct WsClientEntry {
+    WebSocketClient client;
+    WsSendQueue send_queue;
+    RequestParam* path_params;  // Decoded route captures, one malloc'd block
+    int path_param_count;
+    int refcount;
+    struct WsClientEntry* next;  // Chain in the id table
+} WsClientEntry;
+
+static WsClientEntry* client_table[WS_CLIENT_BUCKETS];
+static pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
 static int next_client_id = 1;
 
 // Base64 encoding for WebSocket handshake
@@ -45,32 +63,12 @@ char* ws_generate_accept_key(const char* client_key) {
     return base64_encode(hash, SHA_DIGEST_LENGTH);
 }
 
-const char* ws_get_websocket_key(const char* request) {
-    const char* key_header = "Sec-WebSocket-Key: ";
-    const char* key_start = strstr(request, key_header);
-    if (!key_start) return NULL;
-
-    key_start += strlen(key_header);
-    const char* key_end = strstr(key_start, "\r\n");
-    if (!key_end) return NULL;
-
-    static char key[256];
-    size_t key_len = key_end - key_start;
-    if (key_len >= sizeof(key)) key_len = sizeof(key) - 1;
-    
-    strncpy(key, key_start, key_len);
-    key[key_len] = '\0';
-    
-    return key;
-}
-
-int ws_is_upgrade_request(const char* request) {
-    return (strstr(request, "Upgrade: websocket") != NULL ||
-            strstr(request, "Upgrade: WebSocket") != NULL);
+int ws_is_upgrade_request(const HttpRequest* request) {
+    const char* upgrade = http_request_header(request, HTTP_HEADER_UPGRADE, NULL);
+    return upgrade && strcasecmp(upgrade, "websocket") == 0;
 }
 
-int ws_perform_handshake(int client_fd, const char* request) {
-    const char* client_key = ws_get_websocket_key(request);
+int ws_perform_handshake(int client_fd, const char* client_key) {
     if (!client_key) {
         fprintf(stderr, "No WebSocket key found in request\n");
         return -1;
@@ -93,167 +91,288 @@ int ws_perform_handshake(int client_fd, const char* request) {
     return (result > 0) ? 0 : -1;
 }
 
-WebSocketFrame* ws_read_frame(int client_fd) {
-    uint8_t header[2];
-    ssize_t n = read(client_fd, header, 2);
-    if (n <= 0) return NULL;
-
-    WebSocketFrame* frame = calloc(1, sizeof(WebSocketFrame));
-    frame->fin = (header[0] & 0x80) >> 7;
-    frame->opcode = header[0] & 0x0F;
-    frame->masked = (header[1] & 0x80) >> 7;
-    frame->payload_length = header[1] & 0x7F;
-
-    // Extended payload length
-    if (frame->payload_length == 126) {
-        uint8_t len[2];
-        if (read(client_fd, len, 2) <= 0) {
-            free(frame);
-            return NULL;
-        }
-        frame->payload_length = (len[0] << 8) | len[1];
-    } else if (frame->payload_length == 127) {
-        uint8_t len[8];
-        if (read(client_fd, len, 8) <= 0) {
-            free(frame);
-            return NULL;
-        }
-        frame->payload_length = 0;
-        for (int i = 0; i < 8; i++) {
-            frame->payload_length = (frame->payload_length << 8) | len[i];
-        }
+void ws_reader_init(WsReader* reader, size_t max_frame_size) {
+    memset(reader, 0, sizeof(*reader));
+    reader->max_frame_size = max_frame_size;
+}
+
+void ws_reader_free(WsReader* reader) {
+    free(reader->data);
+    reader->data = NULL;
+    reader->capacity = 0;
+    reader->start = 0;
+    reader->end = 0;
+    reader->needed = 0;
+    reader->has_saved = 0;
+}
+
+void ws_reader_release(WsReader* reader) {
+    if (reader->start == reader->end) {
+        ws_reader_free(reader);
     }
+}
 
-    // Read mask if present
-    if (frame->masked) {
-        if (read(client_fd, frame->mask, 4) <= 0) {
-            free(frame);
-            return NULL;
-        }
+// Puts back the byte the last payload's NUL terminator replaced
+static void reader_restore(WsReader* reader) {
+    if (reader->has_saved) {
+        reader->data[reader->saved_at] = reader->saved;
+        reader->has_saved = 0;
     }
+}
 
-    // Read payload
-    if (frame->payload_length > 0) {
-        frame->payload = malloc(frame->payload_length + 1);
-        ssize_t total_read = 0;
-        while (total_read < frame->payload_length) {
-            ssize_t chunk = read(client_fd, frame->payload + total_read, 
-                                frame->payload_length - total_read);
-            if (chunk <= 0) {
-                free(frame->payload);
-                free(frame);
-                return NULL;
-            }
-            total_read += chunk;
-        }
-        frame->payload[frame->payload_length] = '\0';
+int ws_reader_parse(WsReader* reader, WebSocketFrame* frame) {
+    reader_restore(reader);
+
+    size_t available = reader->end - reader->start;
+    if (available < 2) return WS_READ_MORE;
+    const uint8_t* p = (const uint8_t*)reader->data + reader->start;
+
+    // Every client frame must be masked (RFC 6455 section 5.1)
+    if (!(p[1] & 0x80)) return WS_READ_ERROR;
+
+    uint64_t length = p[1] & 0x7F;
+    size_t header_length = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) + 4;
+    if (available < header_length) {
+        reader->needed = header_length;
+        return WS_READ_MORE;
+    }
 
-        // Unmask payload
-        if (frame->masked) {
-            for (uint64_t i = 0; i < frame->payload_length; i++) {
-                frame->payload[i] ^= frame->mask[i % 4];
-            }
+    if (length == 126) {
+        length = ((uint64_t)p[2] << 8) | p[3];
+    } else if (length == 127) {
+        length = 0;
+        for (int i = 0; i < 8; i++) {
+            length = (length << 8) | p[2 + i];
         }
+        if (length >> 63) return WS_READ_ERROR; // The most significant bit must be 0
+    }
+
+    uint8_t opcode = p[0] & 0x0F;
+    if ((opcode & 0x08) && (!(p[0] & 0x80) || length > 125)) {
+        return WS_READ_ERROR; // Control frames are never fragmented and carry at most 125 bytes
     }
 
-    return frame;
+    if (reader->max_frame_size > 0 && length > reader->max_frame_size) {
+        return WS_READ_TOO_BIG; // Refused before the buffer grows to hold it
+    }
+    if (length > available - header_length) {
+        reader->needed = header_length + length;
+        return WS_READ_MORE;
+    }
+
+    frame->fin = p[0] >> 7;
+    frame->opcode = opcode;
+    frame->masked = 1;
+    frame->payload_length = length;
+    frame->payload = reader->data + reader->start + header_length;
+    memcpy(frame->mask, p + header_length - 4, 4);
+    ws_unmask(frame->payload, length, frame->mask);
+
+    reader->start += header_length + length;
+    reader->needed = 0;
+    if (reader->start < reader->end) {
+        reader->saved_at = reader->start;
+        reader->saved = reader->data[reader->start];
+        reader->has_saved = 1;
+    }
+    reader->data[reader->start] = '\0'; // capacity always leaves a byte past end
+    return WS_READ_FRAME;
 }
 
-int ws_send_frame(int client_fd, uint8_t opcode, const char* payload, size_t length) {
-    uint8_t header[10];
-    int header_len = 2;
-
-    // FIN bit set, opcode
-    header[0] = 0x80 | (opcode & 0x0F);
-
-    // Payload length
-    if (length < 126) {
-        header[1] = length;
-    } else if (length < 65536) {
-        header[1] = 126;
-        header[2] = (length >> 8) & 0xFF;
-        header[3] = length & 0xFF;
-        header_len = 4;
-    } else {
-        header[1] = 127;
-        for (int i = 0; i < 8; i++) {
-            header[9 - i] = (length >> (i * 8)) & 0xFF;
-        }
-        header_len = 10;
+// Moves the undecoded tail to the front so a frame is always contiguous, and makes room for
+// wanted bytes (counted from the front) plus the terminator
+static int reader_reserve(WsReader* reader, size_t wanted) {
+    if (reader->start > 0) {
+        memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
     }
 
-    // Send header
-    if (write(client_fd, header, header_len) <= 0) {
-        return -1;
+    if (wanted + 1 > reader->capacity) {
+        size_t capacity = reader->capacity ? reader->capacity * 2 : WS_READER_BUFFER_SIZE;
+        while (capacity < wanted + 1) capacity *= 2;
+        char* data = realloc(reader->data, capacity);
+        if (!data) return -1;
+        reader->data = data;
+        reader->capacity = capacity;
     }
+    return 0;
+}
 
-    // Send payload
-    if (length > 0 && payload) {
-        if (write(client_fd, payload, length) <= 0) {
-            return -1;
-        }
+int ws_reader_append(WsReader* reader, const char* data, size_t length) {
+    reader_restore(reader);
+    if (reader_reserve(reader, reader->end - reader->start + length) != 0) return -1;
+    memcpy(reader->data + reader->end, data, length);
+    reader->end += length;
+    return 0;
+}
+
+ssize_t ws_reader_fill(WsReader* reader, int fd) {
+    reader_restore(reader);
+    size_t buffered = reader->end - reader->start;
+    if (reader_reserve(reader, reader->needed > buffered ? reader->needed : buffered + 1) != 0) return -1;
+
+    ssize_t n = read(fd, reader->data + reader->end, reader->capacity - 1 - reader->end);
+    if (n > 0) {
+        reader->end += n;
     }
+    return n;
+}
 
+void ws_assembler_init(WsAssembler* assembler) {
+    memset(assembler, 0, sizeof(*assembler));
+}
+
+int ws_assembler_append(WsAssembler* assembler, const char* data, size_t length, size_t max_length) {
+    if (length > max_length || assembler->length > max_length - length) return -1;
+
+    size_t needed = assembler->length + length + 1;
+    if (needed > assembler->capacity) {
+        size_t capacity = assembler->capacity ? assembler->capacity : WS_READER_BUFFER_SIZE;
+        while (capacity < needed) capacity *= 2;
+        char* grown = realloc(assembler->data, capacity);
+        if (!grown) return -1;
+        assembler->data = grown;
+        assembler->capacity = capacity;
+    }
+    memcpy(assembler->data + assembler->length, data, length);
+    assembler->length += length;
+    assembler->data[assembler->length] = '\0';
     return 0;
 }
 
-void ws_frame_free(WebSocketFrame* frame) {
-    if (frame) {
-        if (frame->payload) {
-            free(frame->payload);
-        }
-        free(frame);
+void ws_assembler_reset(WsAssembler* assembler) {
+    // Keep a small buffer for the next message; give back one grown for a large one
+    if (assembler->capacity > WS_READER_BUFFER_SIZE) {
+        ws_assembler_free(assembler);
     }
+    assembler->length = 0;
+    assembler->opcode = 0;
+    assembler->streaming = 0;
+}
+
+void ws_assembler_free(WsAssembler* assembler) {
+    free(assembler->data);
+    assembler->data = NULL;
+    assembler->capacity = 0;
+    assembler->length = 0;
 }
 
 int ws_send_text(WebSocketClient* client, const char* message) {
     if (!client || !client->is_active) return -1;
-    return ws_send_frame(client->fd, WS_OPCODE_TEXT, message, strlen(message));
+    return ws_send_queue_push(client->send_queue, WS_OPCODE_TEXT, message, strlen(message));
 }
 
 int ws_send_binary(WebSocketClient* client, const void* data, size_t length) {
     if (!client || !client->is_active) return -1;
-    return ws_send_frame(client->fd, WS_OPCODE_BINARY, (const char*)data, length);
+    return ws_send_queue_push(client->send_queue, WS_OPCODE_BINARY, (const char*)data, length);
 }
 
 int ws_send_close(WebSocketClient* client) {
     if (!client || !client->is_active) return -1;
-    return ws_send_frame(client->fd, WS_OPCODE_CLOSE, NULL, 0);
+    return ws_send_queue_push(client->send_queue, WS_OPCODE_CLOSE, NULL, 0);
+}
+
+int ws_send_close_code(WebSocketClient* client, uint16_t code, const char* reason) {
+    if (!client || !client->is_active) return -1;
+    char payload[125];
+    size_t reason_length = reason ? strlen(reason) : 0;
+    if (reason_length > sizeof(payload) - 2) reason_length = sizeof(payload) - 2;
+    payload[0] = (char)(code >> 8);
+    payload[1] = (char)(code & 0xFF);
+    memcpy(payload + 2, reason, reason_length);
+    return ws_send_queue_push(client->send_queue, WS_OPCODE_CLOSE, payload, 2 + reason_length);
 }
 
 int ws_send_pong(WebSocketClient* client, const char* payload, size_t length) {
     if (!client || !client->is_active) return -1;
-    return ws_send_frame(client->fd, WS_OPCODE_PONG, payload, length);
+    return ws_send_queue_push(client->send_queue, WS_OPCODE_PONG, payload, length);
 }
 
-WebSocketClient* ws_client_create(int fd, const char* path) {
-    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
-        if (!clients[i].is_active) {
-            clients[i].fd = fd;
-            clients[i].id = next_client_id++;
-            clients[i].is_active = 1;
-            strncpy(clients[i].path, path, sizeof(clients[i].path) - 1);
-            clients[i].path[sizeof(clients[i].path) - 1] = '\0';
-            return &clients[i];
+static WsClientEntry* entry_of(WebSocketClient* client) {
+    return (WsClientEntry*)((char*)client - offsetof(WsClientEntry, client));
+}
+
+WebSocketClient* ws_client_create(int fd, const char* path, const RouteMatch* match) {
+    WsClientEntry* entry = calloc(1, sizeof(WsClientEntry));
+    if (!entry) return NULL;
+    if (match && match->param_count > 0) {
+        entry->path_params = endpoint_copy_path_params(match, &entry->path_param_count);
+        if (!entry->path_params) {
+            free(entry);
+            return NULL;
         }
     }
-    return NULL;
+
+    WebSocketClient* client = &entry->client;
+    client->fd = fd;
+    client->is_active = 1;
+    strncpy(client->path, path, sizeof(client->path) - 1);
+    client->path[sizeof(client->path) - 1] = '\0';
+    // Closed until the connection sets it up with ws_send_queue_init()
+    entry->send_queue.closed = 1;
+    client->send_queue = &entry->send_queue;
+    entry->refcount = 1;
+
+    pthread_mutex_lock(&client_lock);
+    client->id = next_client_id++;
+    WsClientEntry** bucket = &client_table[client->id % WS_CLIENT_BUCKETS];
+    entry->next = *bucket;
+    *bucket = entry;
+    pthread_mutex_unlock(&client_lock);
+    return client;
 }
 
 void ws_client_destroy(WebSocketClient* client) {
-    if (client) {
-        client->is_active = 0;
-        client->fd = -1;
-        client->id = 0;
+    if (!client) return;
+    WsClientEntry* entry = entry_of(client);
+
+    pthread_mutex_lock(&client_lock);
+    WsClientEntry** link = &client_table[client->id % WS_CLIENT_BUCKETS];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = entry->next;
     }
+    pthread_mutex_unlock(&client_lock);
+
+    client->is_active = 0;
+    client->fd = -1;
+    ws_client_release(client);
 }
 
-WebSocketClient* ws_get_client(int client_id) {
-    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
-        if (clients[i].is_active && clients[i].id == client_id) {
-            return &clients[i];
+void ws_client_retain(WebSocketClient* client) {
+    __atomic_add_fetch(&entry_of(client)->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void ws_client_release(WebSocketClient* client) {
+    WsClientEntry* entry = entry_of(client);
+    if (__atomic_sub_fetch(&entry->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        ws_send_queue_free(&entry->send_queue);
+        free(entry->path_params);
+        free(entry);
+    }
+}
+
+const char* ws_client_get_path_param(const WebSocketClient* client, const char* param_name) {
+    const WsClientEntry* entry = entry_of((WebSocketClient*)client);
+    for (int i = 0; i < entry->path_param_count; i++) {
+        if (strcmp(entry->path_params[i].name, param_name) == 0) {
+            return entry->path_params[i].value;
         }
     }
     return NULL;
 }
 
+WebSocketClient* ws_get_client(int client_id) {
+    pthread_mutex_lock(&client_lock);
+    WsClientEntry* entry = client_table[client_id % WS_CLIENT_BUCKETS];
+    while (entry && entry->client.id != client_id) {
+        entry = entry->next;
+    }
+    // Still linked, so the owner's reference is held until destroy unlinks it under this lock
+    if (entry) ws_client_retain(&entry->client);
+    pthread_mutex_unlock(&client_lock);
+    return entry ? &entry->client : NULL;
+}
@@ -2,11 +2,15 @@
 #define WEBSOCKET_H
 
 #include "server.h"
+#include "http.h"
+#include "ws_send_queue.h"
+#include "router.h"
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
-#define WS_MAX_CLIENTS 50
 #define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_READER_BUFFER_SIZE (16 * 1024)  // Read buffer, allocated on first read; grows for larger frames
 
 // WebSocket opcodes
 typedef enum {
@@ -25,32 +29,90 @@ typedef struct {
     uint8_t masked;
     uint64_t payload_length;
     uint8_t mask[4];
-    char* payload;
+    char* payload;  // Unmasked and NUL-terminated; points into the WsReader that decoded it
 } WebSocketFrame;
 
+// Buffered frame decoder for one connection. Each read() takes whatever the socket has, and
+// every complete frame in it is decoded from the buffer, so a burst of small frames costs
+// one syscall. Partial frames wait in the buffer for the next read.
+typedef struct {
+    char* data;
+    size_t capacity;
+    size_t start;   // First byte not yet decoded
+    size_t end;     // End of buffered input
+    size_t needed;  // Bytes (from start) the pending frame needs, once its header is known
+
+    // Byte after the last payload, overwritten by its NUL terminator
+    size_t saved_at;
+    char saved;
+    int has_saved;
+
+    size_t max_frame_size;
+} WsReader;
+
+#define WS_READ_FRAME 1
+#define WS_READ_MORE 0    // Incomplete frame buffered
+#define WS_READ_ERROR -1  // Malformed frame; the connection must be closed
+#define WS_READ_TOO_BIG -2  // Frame longer than max_frame_size
+
+// Close frame status codes
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_GOING_AWAY 1001
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_TOO_BIG 1009
+#define WS_CLOSE_TRY_AGAIN 1013
+
+// Joins the frames of a fragmented message
+typedef struct {
+    char* data;  // NUL-terminated once complete
+    size_t length;
+    size_t capacity;
+    uint8_t opcode;  // Opcode of the first frame; 0 while no message is in progress
+    int streaming;   // Frames go to on_fragment as they arrive instead of being joined
+} WsAssembler;
+
 // WebSocket handshake
-int ws_perform_handshake(int client_fd, const char* request);
+int ws_perform_handshake(int client_fd, const char* client_key);
 char* ws_generate_accept_key(const char* client_key);
 
-// Frame handling
-WebSocketFrame* ws_read_frame(int client_fd);
-int ws_send_frame(int client_fd, uint8_t opcode, const char* payload, size_t length);
-void ws_frame_free(WebSocketFrame* frame);
+// Frame decoding
+void ws_reader_init(WsReader* reader, size_t max_frame_size);
+void ws_reader_free(WsReader* reader);
+// Frees the buffer if it holds no partial frame, so an idle connection keeps none
+void ws_reader_release(WsReader* reader);
+// Buffers input that was read before the reader existed. Returns -1 if out of memory.
+int ws_reader_append(WsReader* reader, const char* data, size_t length);
+// Decodes the next frame already in the buffer. The frame's payload stays valid until the
+// next call on the reader. Returns WS_READ_FRAME, WS_READ_MORE, WS_READ_ERROR or
+// WS_READ_TOO_BIG.
+int ws_reader_parse(WsReader* reader, WebSocketFrame* frame);
+// One read() into the buffer. Returns bytes read, 0 on EOF, or -1 with errno set
+// (EAGAIN on a non-blocking socket with nothing to read).
+ssize_t ws_reader_fill(WsReader* reader, int fd);
+
+// Message reassembly. append returns -1 if the message would exceed max_length.
+void ws_assembler_init(WsAssembler* assembler);
+int ws_assembler_append(WsAssembler* assembler, const char* data, size_t length, size_t max_length);
+void ws_assembler_reset(WsAssembler* assembler);
+void ws_assembler_free(WsAssembler* assembler);
 
-// High-level send functions
+// High-level send functions; all go through the client's send queue
 int ws_send_text(WebSocketClient* client, const char* message);
 int ws_send_binary(WebSocketClient* client, const void* data, size_t length);
 int ws_send_close(WebSocketClient* client);
+int ws_send_close_code(WebSocketClient* client, uint16_t code, const char* reason);
 int ws_send_pong(WebSocketClient* client, const char* payload, size_t length);
 
-// Client management
-WebSocketClient* ws_client_create(int fd, const char* path);
+// Client management. A client's send queue stays closed until its owner calls
+// ws_send_queue_init(). destroy drops the owner's reference.
+// match holds the route's captures, copied for ws_client_get_path_param(); may be NULL.
+WebSocketClient* ws_client_create(int fd, const char* path, const RouteMatch* match);
 void ws_client_destroy(WebSocketClient* client);
+// Returns a new reference; the caller must ws_client_release() it
 WebSocketClient* ws_get_client(int client_id);
 
 // Utility
-int ws_is_upgrade_request(const char* request);
-const char* ws_get_websocket_key(const char* request);
+int ws_is_upgrade_request(const HttpRequest* request);
 
 #endif
 
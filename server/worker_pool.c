@@ -0,0 +1,204 @@
+#define _GNU_SOURCE
+#include "worker_pool.h"
+#include "event_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+
+// A slot is free for the producer at position p when sequence == p, and holds a job for
+// the consumer at position p when sequence == p + 1 (bounded MPMC queue after D. Vyukov)
+typedef struct {
+    size_t sequence;
+    WorkerJob* job;
+} WorkerSlot;
+
+struct WorkerPool {
+    WorkerSlot* slots;
+    size_t mask;
+    int overflow_policy;
+
+    // Producers and consumers each hammer their own position
+    size_t enqueue_position __attribute__((aligned(64)));
+    size_t dequeue_position __attribute__((aligned(64)));
+
+    pthread_mutex_t overflow_lock __attribute__((aligned(64)));
+    WorkerJob* overflow_head;
+    WorkerJob* overflow_tail;
+
+    int pending;              // Submitted jobs not yet taken by a worker
+    uint64_t queue_delay_ms;  // Wait of the last job taken
+
+    sem_t available;  // One post per submitted job, plus one per thread at shutdown
+    int stopping;
+    pthread_t* threads;
+    int thread_count;
+};
+
+static int ring_push(WorkerPool* pool, WorkerJob* job) {
+    size_t position = __atomic_load_n(&pool->enqueue_position, __ATOMIC_RELAXED);
+    for (;;) {
+        WorkerSlot* slot = &pool->slots[position & pool->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->enqueue_position, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->job = job;
+                __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1; // Full
+        } else {
+            position = __atomic_load_n(&pool->enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static WorkerJob* ring_pop(WorkerPool* pool) {
+    size_t position = __atomic_load_n(&pool->dequeue_position, __ATOMIC_RELAXED);
+    for (;;) {
+        WorkerSlot* slot = &pool->slots[position & pool->mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->dequeue_position, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                WorkerJob* job = slot->job;
+                __atomic_store_n(&slot->sequence, position + pool->mask + 1, __ATOMIC_RELEASE);
+                return job;
+            }
+        } else if (diff < 0) {
+            return NULL; // Empty
+        } else {
+            position = __atomic_load_n(&pool->dequeue_position, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static WorkerJob* take_job(WorkerPool* pool) {
+    WorkerJob* job = ring_pop(pool);
+    if (job || pool->overflow_policy != WORKER_OVERFLOW_QUEUE) return job;
+
+    pthread_mutex_lock(&pool->overflow_lock);
+    job = pool->overflow_head;
+    if (job) {
+        pool->overflow_head = job->next;
+        if (!pool->overflow_head) pool->overflow_tail = NULL;
+        job->next = NULL;
+    }
+    pthread_mutex_unlock(&pool->overflow_lock);
+    return job;
+}
+
+static void* worker_thread(void* arg) {
+    WorkerPool* pool = arg;
+    for (;;) {
+        while (sem_wait(&pool->available) != 0 && errno == EINTR) {}
+        if (__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE)) break;
+
+        // Every post follows a published job, but a producer that claimed an earlier slot
+        // may not have published it yet
+        WorkerJob* job;
+        while (!(job = take_job(pool))) {
+            sched_yield();
+        }
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&pool->queue_delay_ms, event_loop_clock_ms() - job->queued_ms, __ATOMIC_RELAXED);
+        job->run(job);
+    }
+    return NULL;
+}
+
+WorkerPool* worker_pool_create(int threads, int queue_depth, int overflow_policy) {
+    if (threads <= 0) return NULL;
+
+    size_t capacity = 2;
+    while (capacity < (size_t)queue_depth) capacity *= 2;
+
+    WorkerPool* pool;
+    if (posix_memalign((void**)&pool, 64, sizeof(WorkerPool)) != 0) return NULL;
+    memset(pool, 0, sizeof(WorkerPool));
+    pool->slots = calloc(capacity, sizeof(WorkerSlot));
+    pool->threads = calloc(threads, sizeof(pthread_t));
+    if (!pool->slots || !pool->threads) {
+        free(pool->slots);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        pool->slots[i].sequence = i;
+    }
+    pool->mask = capacity - 1;
+    pool->overflow_policy = overflow_policy;
+    pthread_mutex_init(&pool->overflow_lock, NULL);
+    sem_init(&pool->available, 0, 0);
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_thread, pool) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        pool->thread_count++;
+    }
+    if (pool->thread_count == 0) {
+        worker_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int worker_pool_submit(WorkerPool* pool, WorkerJob* job) {
+    job->next = NULL;
+    job->queued_ms = event_loop_clock_ms();
+    if (ring_push(pool, job) != 0) {
+        if (pool->overflow_policy != WORKER_OVERFLOW_QUEUE) return -1;
+
+        pthread_mutex_lock(&pool->overflow_lock);
+        if (pool->overflow_tail) {
+            pool->overflow_tail->next = job;
+        } else {
+            pool->overflow_head = job;
+        }
+        pool->overflow_tail = job;
+        pthread_mutex_unlock(&pool->overflow_lock);
+    }
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+    sem_post(&pool->available);
+    return 0;
+}
+
+uint64_t worker_pool_queue_delay(WorkerPool* pool) {
+    if (__atomic_load_n(&pool->pending, __ATOMIC_RELAXED) <= 0) return 0;
+    return __atomic_load_n(&pool->queue_delay_ms, __ATOMIC_RELAXED);
+}
+
+void worker_pool_destroy(WorkerPool* pool) {
+    if (!pool) return;
+
+    __atomic_store_n(&pool->stopping, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < pool->thread_count; i++) {
+        sem_post(&pool->available);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    // Nothing is running any more; everything left was never started
+    WorkerJob* job;
+    while ((job = take_job(pool))) {
+        job->cancel(job);
+    }
+
+    sem_destroy(&pool->available);
+    pthread_mutex_destroy(&pool->overflow_lock);
+    free(pool->threads);
+    free(pool->slots);
+    free(pool);
+}
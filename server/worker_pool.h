@@ -0,0 +1,31 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "server.h"
+#include <stdint.h>
+
+// Embedded as the first member of the submitter's own struct, like EventTask
+typedef struct WorkerJob {
+    void (*run)(struct WorkerJob* job);     // Called on a worker thread
+    void (*cancel)(struct WorkerJob* job);  // Called instead of run for jobs still queued at shutdown
+    struct WorkerJob* next;                 // Overflow list
+    uint64_t queued_ms;                     // Set by worker_pool_submit
+} WorkerJob;
+
+// Fixed set of threads fed from a bounded lock-free queue (any thread may submit). With
+// WORKER_OVERFLOW_QUEUE, jobs that do not fit wait on a locked overflow list instead.
+typedef struct WorkerPool WorkerPool;
+
+// queue_depth is rounded up to a power of two
+WorkerPool* worker_pool_create(int threads, int queue_depth, int overflow_policy);
+
+// Returns 0, or -1 if the queue is full and the policy is WORKER_OVERFLOW_REJECT
+int worker_pool_submit(WorkerPool* pool, WorkerJob* job);
+
+// How long the most recently started job waited for a worker, or 0 if nothing is waiting
+uint64_t worker_pool_queue_delay(WorkerPool* pool);
+
+// Waits for running jobs to return, cancels queued ones, and frees the pool
+void worker_pool_destroy(WorkerPool* pool);
+
+#endif
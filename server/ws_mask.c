@@ -0,0 +1,111 @@
+#include "ws_mask.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WS_MASK_X86 1
+#endif
+
+// Every block below starts at a multiple of 4 bytes, so the mask lines up with each one
+// without rotating. Unaligned loads and stores (memcpy, loadu/storeu) keep any buffer valid.
+
+static void mask_words(uint8_t* dst, const uint8_t* src, size_t length, uint32_t mask32) {
+    uint64_t mask64 = ((uint64_t)mask32 << 32) | mask32;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, src + i, 8);
+        word ^= mask64;
+        memcpy(dst + i, &word, 8);
+    }
+    if (i + 4 <= length) {
+        uint32_t word;
+        memcpy(&word, src + i, 4);
+        word ^= mask32;
+        memcpy(dst + i, &word, 4);
+        i += 4;
+    }
+
+    const uint8_t* mask = (const uint8_t*)&mask32;
+    for (; i < length; i++) {
+        dst[i] = src[i] ^ mask[i & 3];
+    }
+}
+
+#ifdef WS_MASK_X86
+__attribute__((target("sse2")))
+static size_t mask_sse2(uint8_t* dst, const uint8_t* src, size_t length, uint32_t mask32) {
+    __m128i mask = _mm_set1_epi32((int)mask32);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, mask));
+        _mm_storeu_si128((__m128i*)(dst + i + 16), _mm_xor_si128(b, mask));
+        _mm_storeu_si128((__m128i*)(dst + i + 32), _mm_xor_si128(c, mask));
+        _mm_storeu_si128((__m128i*)(dst + i + 48), _mm_xor_si128(d, mask));
+    }
+    for (; i + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(a, mask));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t mask_avx2(uint8_t* dst, const uint8_t* src, size_t length, uint32_t mask32) {
+    __m256i mask = _mm256_set1_epi32((int)mask32);
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(a, mask));
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), _mm256_xor_si256(b, mask));
+        _mm256_storeu_si256((__m256i*)(dst + i + 64), _mm256_xor_si256(c, mask));
+        _mm256_storeu_si256((__m256i*)(dst + i + 96), _mm256_xor_si256(d, mask));
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(a, mask));
+    }
+    return i;
+}
+
+// 0 = not checked yet, 1 = SSE2, 2 = AVX2. Racing threads all store the same answer.
+static int simd_level;
+
+static int detect_simd(void) {
+    int level = __atomic_load_n(&simd_level, __ATOMIC_RELAXED);
+    if (level == 0) {
+        __builtin_cpu_init();
+        level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse2") ? 1 : 3;
+        __atomic_store_n(&simd_level, level, __ATOMIC_RELAXED);
+    }
+    return level;
+}
+#endif
+
+void ws_mask_copy(char* dst, const char* src, size_t length, const uint8_t mask[4]) {
+    uint32_t mask32;
+    memcpy(&mask32, mask, 4);
+    uint8_t* out = (uint8_t*)dst;
+    const uint8_t* in = (const uint8_t*)src;
+
+    size_t done = 0;
+#ifdef WS_MASK_X86
+    // Short control and text frames are not worth the vector setup
+    if (length >= 32) {
+        int level = detect_simd();
+        if (level == 2) {
+            done = mask_avx2(out, in, length, mask32);
+        } else if (level == 1) {
+            done = mask_sse2(out, in, length, mask32);
+        }
+    }
+#endif
+    mask_words(out + done, in + done, length - done, mask32);
+}
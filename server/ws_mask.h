@@ -0,0 +1,16 @@
+#ifndef WS_MASK_H
+#define WS_MASK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XORs length bytes of src with the repeating 4-byte frame mask into dst. dst may equal src
+// (unmask in place) or be a separate buffer (unmask while copying out of the read buffer,
+// in one pass). Uses AVX2 or SSE2 when the CPU has them, then 8-byte words, then bytes.
+void ws_mask_copy(char* dst, const char* src, size_t length, const uint8_t mask[4]);
+
+static inline void ws_unmask(char* data, size_t length, const uint8_t mask[4]) {
+    ws_mask_copy(data, data, length, mask);
+}
+
+#endif
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+#include "ws_send_queue.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+void ws_send_queue_init(WsSendQueue* queue, size_t high_watermark, size_t low_watermark, size_t limit,
+                        void (*notify)(void* arg), void* notify_arg) {
+    memset(queue, 0, sizeof(*queue));
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+    queue->high_watermark = high_watermark;
+    queue->low_watermark = low_watermark < high_watermark ? low_watermark : high_watermark;
+    queue->limit = limit;
+    queue->notify = notify;
+    queue->notify_arg = notify_arg;
+}
+
+static void list_push(WsSendQueue* queue, WsOutFrame* frame) {
+    __atomic_store_n(&frame->next, NULL, __ATOMIC_RELAXED);
+    WsOutFrame* prev = __atomic_exchange_n(&queue->tail, frame, __ATOMIC_ACQ_REL);
+    // Until this store the frame is unreachable from head; list_pop() waits it out
+    __atomic_store_n(&prev->next, frame, __ATOMIC_RELEASE);
+}
+
+// NULL when empty, or when a push has swapped the tail but not linked its frame yet
+static WsOutFrame* list_pop(WsSendQueue* queue) {
+    WsOutFrame* head = queue->head;
+    WsOutFrame* next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (head == &queue->stub) {
+        if (!next) return NULL;
+        queue->head = next;
+        head = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        queue->head = next;
+        return head;
+    }
+
+    // head is the last frame; put the stub behind it so it can be taken
+    if (head != __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) return NULL;
+    list_push(queue, &queue->stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        queue->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static size_t encode_header(uint8_t* header, uint8_t opcode, size_t length) {
+    // FIN bit set, opcode
+    header[0] = 0x80 | (opcode & 0x0F);
+
+    if (length < 126) {
+        header[1] = length;
+        return 2;
+    }
+    if (length < 65536) {
+        header[1] = 126;
+        header[2] = (length >> 8) & 0xFF;
+        header[3] = length & 0xFF;
+        return 4;
+    }
+    header[1] = 127;
+    for (int i = 0; i < 8; i++) {
+        header[9 - i] = ((uint64_t)length >> (i * 8)) & 0xFF;
+    }
+    return 10;
+}
+
+int ws_send_queue_push(WsSendQueue* queue, uint8_t opcode, const char* payload, size_t length) {
+    __atomic_add_fetch(&queue->pushing, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->closed, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&queue->pushing, 1, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    int result = -1;
+    WsOutFrame* frame = NULL;
+    size_t queued = __atomic_load_n(&queue->queued_bytes, __ATOMIC_RELAXED);
+    if (queue->limit == 0 || (length <= queue->limit && queued <= queue->limit - length)) {
+        frame = malloc(sizeof(WsOutFrame) + 10 + length);
+    }
+    if (frame) {
+        frame->data = (char*)(frame + 1);
+        size_t header_length = encode_header((uint8_t*)frame->data, opcode, length);
+        if (length > 0) {
+            memcpy(frame->data + header_length, payload, length);
+        }
+        frame->length = header_length + length;
+
+        // Counted before the frame is visible, so the owner never subtracts it first
+        queued = __atomic_add_fetch(&queue->queued_bytes, frame->length, __ATOMIC_SEQ_CST);
+        list_push(queue, frame);
+
+        result = 0;
+        if (queue->high_watermark > 0 && queued >= queue->high_watermark) {
+            __atomic_store_n(&queue->above_high, 1, __ATOMIC_SEQ_CST);
+            result = 1;
+        }
+
+        // Last, so the flush it triggers sees the frame and above_high
+        if (!__atomic_exchange_n(&queue->scheduled, 1, __ATOMIC_SEQ_CST) && queue->notify) {
+            queue->notify(queue->notify_arg);
+        }
+    }
+
+    __atomic_sub_fetch(&queue->pushing, 1, __ATOMIC_RELEASE);
+    return result;
+}
+
+int ws_send_queue_flush(WsSendQueue* queue, int fd, int* drained) {
+    // Pushes from here on notify again
+    __atomic_store_n(&queue->scheduled, 0, __ATOMIC_SEQ_CST);
+
+    int result = 0;
+    for (;;) {
+        WsOutFrame* frame;
+        while ((frame = list_pop(queue)) != NULL) {
+            frame->next = NULL;
+            if (queue->pending_tail) {
+                queue->pending_tail->next = frame;
+            } else {
+                queue->pending = frame;
+            }
+            queue->pending_tail = frame;
+        }
+        if (!queue->pending) break;
+
+        // Small frames coalesce: every queued frame up to the batch size goes in one call
+        struct iovec iov[WS_SEND_BATCH];
+        int count = 0;
+        for (frame = queue->pending; frame && count < WS_SEND_BATCH; frame = frame->next) {
+            size_t skip = count == 0 ? queue->pending_offset : 0;
+            iov[count].iov_base = frame->data + skip;
+            iov[count].iov_len = frame->length - skip;
+            count++;
+        }
+
+        // sendmsg rather than writev for MSG_NOSIGNAL
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+            break;
+        }
+
+        __atomic_sub_fetch(&queue->queued_bytes, (size_t)n, __ATOMIC_SEQ_CST);
+        size_t written = (size_t)n;
+        while (written > 0) {
+            frame = queue->pending;
+            size_t left = frame->length - queue->pending_offset;
+            if (written < left) {
+                queue->pending_offset += written;
+                break;
+            }
+            written -= left;
+            queue->pending_offset = 0;
+            queue->pending = frame->next;
+            if (!queue->pending) queue->pending_tail = NULL;
+            free(frame);
+        }
+    }
+
+    if (drained) {
+        *drained = 0;
+        int expected = 1;
+        if (__atomic_load_n(&queue->queued_bytes, __ATOMIC_SEQ_CST) <= queue->low_watermark &&
+            __atomic_compare_exchange_n(&queue->above_high, &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            *drained = 1;
+        }
+    }
+    return result;
+}
+
+void ws_send_queue_shutdown(WsSendQueue* queue) {
+    __atomic_store_n(&queue->closed, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&queue->pushing, __ATOMIC_SEQ_CST) > 0) {
+        sched_yield();
+    }
+}
+
+void ws_send_queue_free(WsSendQueue* queue) {
+    if (!queue->head) return;  // Never initialized
+    WsOutFrame* frame;
+    while ((frame = list_pop(queue)) != NULL) {
+        free(frame);
+    }
+    while (queue->pending) {
+        frame = queue->pending;
+        queue->pending = frame->next;
+        free(frame);
+    }
+    queue->pending_tail = NULL;
+    queue->pending_offset = 0;
+    queue->queued_bytes = 0;
+}
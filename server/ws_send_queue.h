@@ -0,0 +1,62 @@
+#ifndef WS_SEND_QUEUE_H
+#define WS_SEND_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WS_SEND_BATCH 64  // Most frames handed to one sendmsg
+
+// One encoded frame. Header and payload share an allocation, so each frame is one iovec.
+typedef struct WsOutFrame {
+    struct WsOutFrame* next;
+    size_t length;  // Header plus payload
+    char* data;
+} WsOutFrame;
+
+// Outbound frames of one WebSocket connection. Any thread may push, without locks (intrusive
+// MPSC list after D. Vyukov); only the connection's I/O owner flushes, so frames from
+// different senders never interleave on the wire and no sender waits on a slow reader.
+typedef struct WsSendQueue {
+    WsOutFrame* tail __attribute__((aligned(64)));  // Producers swap themselves in here
+
+    // I/O owner only
+    WsOutFrame* head __attribute__((aligned(64)));
+    WsOutFrame stub;
+    WsOutFrame* pending;  // Popped, not completely written; pending_offset bytes of the first are out
+    WsOutFrame* pending_tail;
+    size_t pending_offset;
+
+    size_t queued_bytes;  // Pushed and not yet written
+    int above_high;       // Set at the high watermark, cleared once back down to the low one
+    int scheduled;        // The owner has been notified and has not flushed since
+    int closed;
+    int pushing;          // Pushes in progress, waited out by ws_send_queue_shutdown()
+
+    size_t high_watermark;
+    size_t low_watermark;
+    size_t limit;  // Pushes that would queue more than this fail; 0 for no limit
+
+    // Called by a push that finds the owner not yet notified, from the pushing thread
+    void (*notify)(void* arg);
+    void* notify_arg;
+} WsSendQueue;
+
+void ws_send_queue_init(WsSendQueue* queue, size_t high_watermark, size_t low_watermark, size_t limit,
+                        void (*notify)(void* arg), void* notify_arg);
+
+// Thread-safe. Encodes and queues one unmasked, unfragmented frame. Returns 0, 1 if it is
+// queued but the queue is at or over its high watermark, or -1 if the queue is closed, full
+// or out of memory.
+int ws_send_queue_push(WsSendQueue* queue, uint8_t opcode, const char* payload, size_t length);
+
+// I/O owner only. Writes queued frames to the non-blocking fd, several per sendmsg.
+// Returns 0 once everything is written, 1 if the socket is full, or -1 on a write error.
+// *drained is set when the queue fell to the low watermark after reaching the high one.
+int ws_send_queue_flush(WsSendQueue* queue, int fd, int* drained);
+
+// Refuses further pushes and waits for pushes already running to finish
+void ws_send_queue_shutdown(WsSendQueue* queue);
+// Frees unwritten frames; call after ws_send_queue_shutdown()
+void ws_send_queue_free(WsSendQueue* queue);
+
+#endif
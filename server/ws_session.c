@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+#include "ws_session.h"
+#include "connection.h"
+#include "reactor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+
+// What handle_frame() leaves the caller to do
+#define FRAME_HANDLED 0
+#define FRAME_DELIVER 1      // Pass session->delivery to the endpoint
+#define FRAME_PEER_CLOSED 2  // Close frame answered; close the connection
+// Anything else is the close status to fail the connection with
+
+// The session whose loop-side code is running on this thread. Its sends skip the wakeup,
+// since the loop flushes the queue before it returns.
+static __thread WsSession* loop_session;
+
+static void session_flush_task(EventLoop* loop, EventTask* task);
+static void session_work_run(WorkerJob* work);
+static void session_work_cancel(WorkerJob* work);
+static void session_work_done(EventLoop* loop, EventTask* task);
+
+// Called by a push that finds the queue not yet scheduled, on any thread
+static void session_notify(void* arg) {
+    WsSession* session = arg;
+    if (loop_session == session) return;
+    if (!__atomic_exchange_n(&session->flush_posted, 1, __ATOMIC_SEQ_CST)) {
+        event_loop_post(&session->conn->reactor->loop, &session->flush_task);
+    }
+}
+
+WsSession* ws_session_start(Connection* conn, const RegisteredWsEndpoint* endpoint, const char* path,
+                            const RouteMatch* match, const char* key, const char* pending, size_t pending_length) {
+    const ServerConfig* config = conn->reactor->config;
+    if (ws_perform_handshake(conn->fd, key) != 0) {
+        fprintf(stderr, "WebSocket handshake failed\n");
+        return NULL;
+    }
+
+    WsSession* session = calloc(1, sizeof(WsSession));
+    if (!session) return NULL;
+    session->client = ws_client_create(conn->fd, path, match);
+    if (!session->client) {
+        free(session);
+        return NULL;
+    }
+    session->conn = conn;
+    session->endpoint = endpoint;
+    session->streams = endpoint->handlers.on_fragment != NULL;
+    session->flush_task.run = session_flush_task;
+    session->work.run = session_work_run;
+    session->work.cancel = session_work_cancel;
+    session->work_done.run = session_work_done;
+    ws_reader_init(&session->reader, config->ws_max_frame_size);
+    ws_assembler_init(&session->message);
+    ws_send_queue_init(session->client->send_queue, config->ws_send_high_watermark,
+                       config->ws_send_low_watermark, config->ws_send_queue_limit,
+                       session_notify, session);
+    if (pending_length > 0 && ws_reader_append(&session->reader, pending, pending_length) != 0) {
+        ws_client_destroy(session->client);
+        free(session);
+        return NULL;
+    }
+
+    printf("WebSocket client connected: id=%d, path=%s\n", session->client->id, path);
+    if (endpoint->handlers.on_connect) {
+        WsSession* previous = loop_session;
+        loop_session = session;
+        endpoint->handlers.on_connect(session->client);
+        loop_session = previous;
+    }
+    return session;
+}
+
+// Writes queued frames. Returns 1 while some wait for EPOLLOUT, -1 on a write error.
+static int session_flush(WsSession* session) {
+    int drained;
+    int result = ws_send_queue_flush(session->client->send_queue, session->conn->fd, &drained);
+    if (result >= 0 && drained && session->endpoint->handlers.on_drain) {
+        session->endpoint->handlers.on_drain(session->client);
+        result = ws_send_queue_flush(session->client->send_queue, session->conn->fd, NULL);
+    }
+    return result;
+}
+
+// Best effort: whatever the socket takes now (usually the close frame) goes out first
+static void session_close(WsSession* session) {
+    ws_send_queue_flush(session->client->send_queue, session->conn->fd, NULL);
+    connection_close(session->conn);
+}
+
+void ws_session_fail(WsSession* session, uint16_t status, const char* reason) {
+    WsSession* previous = loop_session;
+    loop_session = session;
+    fprintf(stderr, "Closing WebSocket client %d with status %d\n", session->client->id, status);
+    ws_send_close_code(session->client, status, reason);
+    session_close(session);
+    loop_session = previous;
+}
+
+static void session_invoke(WsSession* session, const WsDelivery* delivery) {
+    const WsHandlers* handlers = &session->endpoint->handlers;
+    if (delivery->is_fragment) {
+        if (handlers->on_fragment) {
+            handlers->on_fragment(session->client, delivery->data, (int)delivery->length,
+                                  delivery->is_binary, delivery->is_final);
+        }
+    } else if (handlers->on_message) {
+        handlers->on_message(session->client, delivery->data, (int)delivery->length, delivery->is_binary);
+    }
+}
+
+// Routes one frame: data frames are delivered whole or joined with the frames that continue
+// them, control frames are answered
+static int handle_frame(WsSession* session, const WebSocketFrame* frame) {
+    size_t max_message = session->conn->reactor->config->ws_max_message_size;
+    WsAssembler* message = &session->message;
+    WsDelivery* delivery = &session->delivery;
+    memset(delivery, 0, sizeof(*delivery));
+
+    switch (frame->opcode) {
+    case WS_OPCODE_TEXT:
+    case WS_OPCODE_BINARY:
+        if (message->opcode) return WS_CLOSE_PROTOCOL_ERROR; // Previous message not finished
+        if (max_message > 0 && frame->payload_length > max_message) return WS_CLOSE_TOO_BIG;
+        delivery->is_binary = (frame->opcode == WS_OPCODE_BINARY);
+
+        if (frame->fin) {
+            // Unfragmented: delivered straight from the read buffer
+            delivery->data = frame->payload;
+            delivery->length = frame->payload_length;
+            delivery->is_fragment = session->streams && !session->endpoint->handlers.on_message;
+            delivery->is_final = 1;
+            return FRAME_DELIVER;
+        }
+
+        message->opcode = frame->opcode;
+        message->streaming = session->streams;
+        if (session->streams) {
+            message->length = frame->payload_length;
+            delivery->data = frame->payload;
+            delivery->length = frame->payload_length;
+            delivery->is_fragment = 1;
+            return FRAME_DELIVER;
+        }
+        if (ws_assembler_append(message, frame->payload, frame->payload_length,
+                                max_message ? max_message : SIZE_MAX) != 0) {
+            return WS_CLOSE_TOO_BIG;
+        }
+        return FRAME_HANDLED;
+
+    case WS_OPCODE_CONTINUATION:
+        if (!message->opcode) return WS_CLOSE_PROTOCOL_ERROR; // Nothing to continue
+        delivery->is_binary = (message->opcode == WS_OPCODE_BINARY);
+        delivery->is_final = frame->fin;
+        delivery->ends_message = frame->fin;
+
+        if (message->streaming) {
+            // Only the running total is kept, to enforce the message limit
+            if (max_message > 0 && (frame->payload_length > max_message ||
+                                    message->length > max_message - frame->payload_length)) {
+                return WS_CLOSE_TOO_BIG;
+            }
+            message->length += frame->payload_length;
+            delivery->data = frame->payload;
+            delivery->length = frame->payload_length;
+            delivery->is_fragment = 1;
+            return FRAME_DELIVER;
+        }
+        if (ws_assembler_append(message, frame->payload, frame->payload_length,
+                                max_message ? max_message : SIZE_MAX) != 0) {
+            return WS_CLOSE_TOO_BIG;
+        }
+        if (!frame->fin) return FRAME_HANDLED;
+        delivery->data = message->data;
+        delivery->length = message->length;
+        return FRAME_DELIVER;
+
+    case WS_OPCODE_CLOSE:
+        printf("WebSocket close frame received from client %d\n", session->client->id);
+        ws_send_close(session->client);
+        return FRAME_PEER_CLOSED;
+
+    case WS_OPCODE_PING:
+        ws_send_pong(session->client, frame->payload, frame->payload_length);
+        return FRAME_HANDLED;
+
+    case WS_OPCODE_PONG:
+        return FRAME_HANDLED;
+
+    default:
+        return WS_CLOSE_PROTOCOL_ERROR; // Reserved opcode
+    }
+}
+
+// Runs the handler inline, or hands it to the worker pool for flagged endpoints. Returns 0
+// once delivered, 1 if a worker has it, or a close status if the pool is too busy.
+static int session_deliver(WsSession* session) {
+    Reactor* reactor = session->conn->reactor;
+    if (session->endpoint->handlers.flags && reactor->workers) {
+        // Same shedding rule as HTTP handlers on the pool
+        int shed_latency = reactor->config->shed_latency_ms;
+        if (shed_latency > 0 && worker_pool_queue_delay(reactor->workers) > (uint64_t)shed_latency) {
+            return WS_CLOSE_TRY_AGAIN;
+        }
+        session->working = 1;
+        if (worker_pool_submit(reactor->workers, &session->work) != 0) {
+            session->working = 0;
+            return WS_CLOSE_TRY_AGAIN;
+        }
+        return 1;
+    }
+
+    session_invoke(session, &session->delivery);
+    if (session->delivery.ends_message) {
+        ws_assembler_reset(&session->message);
+    }
+    return 0;
+}
+
+// Handles every buffered frame, reading until the socket is drained, then writes what the
+// handlers queued. Stops early while a worker runs a handler.
+static void session_read(WsSession* session) {
+    Connection* conn = session->conn;
+    for (;;) {
+        WebSocketFrame frame;
+        int result;
+        while ((result = ws_reader_parse(&session->reader, &frame)) == WS_READ_FRAME) {
+            int status = handle_frame(session, &frame);
+            if (status == FRAME_DELIVER) {
+                status = session_deliver(session);
+                if (status == 1) {
+                    // Sends made on the loop so far (a pong, say) go out now: until they are
+                    // flushed the queue stays scheduled and the worker's sends would not wake it
+                    if (session_flush(session) < 0) {
+                        connection_close(conn); // Freed once the worker lets go
+                    }
+                    return; // Resumed by session_work_done
+                }
+            }
+            if (status == FRAME_PEER_CLOSED) {
+                session_close(session);
+                return;
+            }
+            if (status != FRAME_HANDLED) {
+                ws_session_fail(session, (uint16_t)status,
+                                status == WS_CLOSE_TOO_BIG ? "Message too big" :
+                                status == WS_CLOSE_TRY_AGAIN ? "Server busy" : "Protocol error");
+                return;
+            }
+        }
+        if (result != WS_READ_MORE) {
+            ws_session_fail(session, result == WS_READ_TOO_BIG ? WS_CLOSE_TOO_BIG : WS_CLOSE_PROTOCOL_ERROR,
+                            result == WS_READ_TOO_BIG ? "Message too big" : "Protocol error");
+            return;
+        }
+
+        ssize_t n = ws_reader_fill(&session->reader, conn->fd);
+        if (n > 0) continue;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        printf("WebSocket client disconnected: id=%d\n", session->client->id);
+        connection_close(conn);
+        return;
+    }
+
+    // Nothing to decode until the next readable event, so the buffer can go
+    ws_reader_release(&session->reader);
+    if (session_flush(session) < 0) {
+        connection_close(conn);
+    }
+}
+
+void ws_session_on_event(WsSession* session, uint32_t events) {
+    WsSession* previous = loop_session;
+    loop_session = session;
+
+    if ((events & EPOLLOUT) && session_flush(session) < 0) {
+        connection_close(session->conn);
+    } else if (session->working) {
+        if (events & EPOLLHUP) {
+            connection_close(session->conn); // Freed once the worker lets go
+        }
+        // Anything read meanwhile is picked up when the handler returns
+    } else if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+        session_read(session);
+    }
+
+    loop_session = previous;
+}
+
+static void session_flush_task(EventLoop* loop, EventTask* task) {
+    (void)loop;
+    WsSession* session = (WsSession*)((char*)task - offsetof(WsSession, flush_task));
+    __atomic_store_n(&session->flush_posted, 0, __ATOMIC_SEQ_CST);
+    if (session->conn->state == CONN_STATE_CLOSED) {
+        connection_free(session->conn);
+        return;
+    }
+
+    WsSession* previous = loop_session;
+    loop_session = session;
+    if (session_flush(session) < 0) {
+        connection_close(session->conn);
+    }
+    loop_session = previous;
+}
+
+// Runs on a worker thread; the frame's data stays where it is until the job comes back
+static void session_work_run(WorkerJob* work) {
+    WsSession* session = (WsSession*)((char*)work - offsetof(WsSession, work));
+    session_invoke(session, &session->delivery);
+    event_loop_post(&session->conn->reactor->loop, &session->work_done);
+}
+
+static void session_work_cancel(WorkerJob* work) {
+    WsSession* session = (WsSession*)((char*)work - offsetof(WsSession, work));
+    session->cancelled = 1;
+    event_loop_post(&session->conn->reactor->loop, &session->work_done);
+}
+
+// Back on the reactor: carries on with the frames that arrived meanwhile
+static void session_work_done(EventLoop* loop, EventTask* task) {
+    (void)loop;
+    WsSession* session = (WsSession*)((char*)task - offsetof(WsSession, work_done));
+    session->working = 0;
+    if (session->delivery.ends_message) {
+        ws_assembler_reset(&session->message);
+    }
+    if (session->conn->state == CONN_STATE_CLOSED) {
+        connection_free(session->conn);
+        return;
+    }
+    if (session->cancelled) {
+        ws_session_fail(session, WS_CLOSE_GOING_AWAY, "Server shutting down");
+        return;
+    }
+
+    WsSession* previous = loop_session;
+    loop_session = session;
+    session_read(session);
+    loop_session = previous;
+}
+
+int ws_session_release(WsSession* session) {
+    // No sender can post another flush once this returns
+    ws_send_queue_shutdown(session->client->send_queue);
+    if (session->working || __atomic_load_n(&session->flush_posted, __ATOMIC_SEQ_CST)) {
+        return 1;
+    }
+
+    printf("WebSocket client closed: id=%d\n", session->client->id);
+    if (session->endpoint->handlers.on_disconnect) {
+        session->endpoint->handlers.on_disconnect(session->client);
+    }
+    ws_assembler_free(&session->message);
+    ws_reader_free(&session->reader);
+    ws_client_destroy(session->client);
+    free(session);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef WS_SESSION_H
+#define WS_SESSION_H
+
+#include "event_loop.h"
+#include "worker_pool.h"
+#include "websocket.h"
+#include "ws_endpoint.h"
+#include <stdint.h>
+
+struct Connection;
+
+// A message or fragment on its way to the endpoint's handler
+typedef struct {
+    const char* data;
+    size_t length;
+    int is_binary;
+    int is_fragment;  // Goes to on_fragment rather than on_message
+    int is_final;
+    int ends_message; // The assembler is reset once the handler returns
+} WsDelivery;
+
+// A connection after its WebSocket upgrade. It stays on its reactor: frames are decoded as
+// the socket becomes readable, handlers run on the loop (or the worker pool, for endpoints
+// with HANDLER_BLOCKING / HANDLER_CPU_HEAVY), and the send queue is written from the loop.
+// An idle session holds no read buffer.
+typedef struct WsSession {
+    struct Connection* conn;
+    WebSocketClient* client;
+    const RegisteredWsEndpoint* endpoint;
+    int streams;  // The endpoint takes fragmented messages through on_fragment
+
+    WsReader reader;
+    WsAssembler message;
+
+    // Posted by senders when the queue has frames for the loop to write
+    EventTask flush_task;
+    int flush_posted;
+
+    // A handler running on the worker pool. Nothing more is decoded until it returns, so its
+    // data stays put in the reader or assembler.
+    WorkerJob work;
+    EventTask work_done;
+    WsDelivery delivery;
+    int working;
+    int cancelled;
+} WsSession;
+
+// Sends the 101 response, calls on_connect and takes over the connection. pending is input
+// that followed the request head; it is decoded once ws_session_on_event() runs.
+// Returns NULL on failure.
+// match holds the route's captures for path.
+WsSession* ws_session_start(struct Connection* conn, const RegisteredWsEndpoint* endpoint, const char* path,
+                            const RouteMatch* match, const char* key, const char* pending, size_t pending_length);
+
+// Called on the reactor thread for every readiness event of the connection
+void ws_session_on_event(WsSession* session, uint32_t events);
+
+// Sends a close frame with status and closes the connection
+void ws_session_fail(WsSession* session, uint16_t status, const char* reason);
+
+// From connection_free(): calls on_disconnect and frees the session, returning 0. Returns 1
+// instead while a worker job or posted flush still points at the session; connection_free()
+// is called again when it comes back.
+int ws_session_release(WsSession* session);
+
+#endif